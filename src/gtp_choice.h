@@ -17,6 +17,12 @@ public:
 
 public:
     void execute() {
+        execute_builtin(cfg_weightsfile);
+    }
+
+    // Built-in engine with its own network, shared with other
+    // built-in engines loading the same weights file.
+    void execute_builtin(const string& weightsfile) {
         switch_ = 0;
         gtp_blt.onInput = onInput;
         gtp_blt.onOutput = onOutput;
@@ -25,7 +31,7 @@ public:
         if (onStderr) gtp_blt.onStderr = onStderr;
         else
             gtp_blt.onStderr = [](const string& line) { std::cerr << line << std::flush;  };
-        gtp_blt.execute();
+        gtp_blt.execute(weightsfile);
     }
 
     void execute(const string& cmdline, const string& path="", const int wait_secs=0) {
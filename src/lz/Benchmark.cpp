@@ -0,0 +1,269 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+
+#include "FastBoard.h"
+#include "FastState.h"
+#include "GameState.h"
+#include "GTP.h"
+#include "KoState.h"
+#include "NNCache.h"
+#include "Network.h"
+#include "Random.h"
+#include "Timing.h"
+#include "UCTSearch.h"
+#include "Utils.h"
+
+using namespace Utils;
+
+namespace {
+
+struct Position {
+    const char* name;
+    // "b q16 w d4 ...", colors are explicit so stones can be set up
+    const char* moves;
+    // Random moves played after those
+    int random_moves;
+};
+
+const auto OPENING_MOVES = "b q16 w d4 b q3 w d16 b c14 w f17 b r5";
+
+const Position POSITIONS[] = {
+    {"opening", OPENING_MOVES, 0},
+    {"middlegame", OPENING_MOVES, 110},
+    // White to move with four stones in atari that can only run into
+    // ladders, so every expansion checks them.
+    {"ladders",
+     "w d4 b c4 w q4 b r4 w d16 b c16 w q16 b r16 "
+     "b d3 b q3 b d17 b q17 b e5 b o5 b e15 b o15 "
+     "b e4 b o4 b e16 b o16", 0},
+    // Long history, many captures and few legal moves
+    {"endgame", "", 280},
+};
+
+// A random legal move that doesn't fill an own eye, the first one from
+// a random point on, or a pass. The same one for the same seed.
+template <typename State>
+int random_move(State& state, Random& rng) {
+    const auto size = state.board.get_boardsize();
+    const auto color = state.get_to_move();
+    const auto squares = size * size;
+    const auto first = static_cast<int>(rng.randuint64(squares));
+    for (auto i = 0; i < squares; i++) {
+        const auto square = (first + i) % squares;
+        const auto vertex = state.board.get_vertex(square % size,
+                                                   square / size);
+        if (state.is_move_legal(color, vertex)
+            && !state.board.is_eye(color, vertex)) {
+            return vertex;
+        }
+    }
+    return FastBoard::PASS;
+}
+
+template <typename State>
+void play_random_moves(State& state, const int moves, Random& rng) {
+    for (auto i = 0; i < moves; i++) {
+        state.play_move(state.get_to_move(), random_move(state, rng));
+    }
+}
+
+bool superko(const FastState&) {
+    return false;
+}
+
+bool superko(const KoState& state) {
+    return state.superko();
+}
+
+// Random games from the empty board until two passes, or a superko
+// cycle when KoState checks for them.
+template <typename State>
+std::uint64_t play_random_game(State& state, const int board_size,
+                               const std::uint64_t seed, int& superkos) {
+    const auto max_moves = size_t(3 * board_size * board_size);
+    state.init_game(board_size, 7.5f);
+    auto rng = Random{seed};
+    auto moves = std::uint64_t{0};
+    while (state.get_passes() < 2 && state.get_movenum() < max_moves) {
+        const auto vertex = random_move(state, rng);
+        state.play_move(vertex);
+        moves++;
+        // Passes repeat the position
+        if (vertex != FastBoard::PASS && superko(state)) {
+            superkos++;
+            break;
+        }
+    }
+    return moves;
+}
+
+bool setup_position(GameState& state, const Position& position,
+                    const std::uint64_t seed) {
+    auto moves = std::istringstream{position.moves};
+    auto color = std::string{};
+    auto vertex = std::string{};
+    while (moves >> color >> vertex) {
+        if (!state.play_textmove(color, vertex)) {
+            return false;
+        }
+    }
+    auto rng = Random{seed};
+    play_random_moves(state, position.random_moves, rng);
+    return true;
+}
+
+}
+
+void Benchmark::search(Network& network, const int visits,
+                       const std::vector<int>& threads) {
+    // Only the visits may end a search
+    const auto num_threads = cfg_num_threads;
+    const auto timemanage = cfg_timemanage;
+    const auto quiet = cfg_quiet;
+    cfg_timemanage = TimeManagement::OFF;
+
+    for (const auto requested_threads : threads) {
+        // The search thread pool is sized for --threads
+        cfg_num_threads = std::max(1, std::min(requested_threads,
+                                               num_threads));
+        myprintf("\n%d visits, %d search threads, %d NN threads\n",
+                 visits, cfg_num_threads, cfg_nn_threads);
+        myprintf("%-11s %10s %10s %7s %8s %9s %9s\n",
+                 "position", "playouts/s", "NN evals/s", "cache",
+                 "nodes", "peak RSS", "1st eval");
+
+        auto total_seconds = 0.0;
+        auto total_playouts = 0;
+        auto total_evals = std::uint64_t{0};
+        auto seed = std::uint64_t{0};
+        for (const auto& position : POSITIONS) {
+            auto state = GameState{};
+            state.init_game(network.get_boardsize(), 7.5f);
+            if (!setup_position(state, position, ++seed)) {
+                myprintf("%-11s does not fit a %dx%d board\n", position.name,
+                         network.get_boardsize(), network.get_boardsize());
+                continue;
+            }
+            state.set_timecontrol(0, 1, 0, 0);
+
+            auto& cache = network.get_nncache();
+            cache.clear();
+            Random::get_Rng().seedrandom(cfg_rng_seed);
+            const auto hits = cache.hit_rate();
+            const auto evals = network.get_evaluations();
+
+            UCTSearch search(state, network);
+            search.set_playout_limit(0);
+            search.set_visit_limit(visits);
+            cfg_quiet = true;
+            Time start;
+            search.think(state.get_to_move());
+            Time end;
+            cfg_quiet = quiet;
+
+            const auto seconds = Time::timediff_seconds(start, end);
+            const auto position_hits = cache.hit_rate().first - hits.first;
+            const auto lookups = cache.hit_rate().second - hits.second;
+            const auto position_evals = network.get_evaluations() - evals;
+            myprintf("%-11s %10.1f %10.1f %6.1f%% %8d %7.1f M %7.2f ms\n",
+                     position.name,
+                     search.get_playouts() / seconds,
+                     position_evals / seconds,
+                     100.0 * position_hits / std::max(1, lookups),
+                     search.get_nodes(),
+                     peak_rss() / (1024.0 * 1024.0),
+                     1000.0 * search.get_root_eval_seconds());
+
+            total_seconds += seconds;
+            total_playouts += search.get_playouts();
+            total_evals += position_evals;
+        }
+        if (total_seconds > 0.0) {
+            myprintf("%-11s %10.1f %10.1f\n", "total",
+                     total_playouts / total_seconds,
+                     total_evals / total_seconds);
+        }
+    }
+
+    cfg_num_threads = num_threads;
+    cfg_timemanage = timemanage;
+}
+
+void Benchmark::board(const int board_size, const int games) {
+    myprintf("%d random games on %dx%d\n", games, board_size, board_size);
+
+    // The same games for both, KoState ends those that repeat a position
+    auto fast_moves = std::uint64_t{0};
+    auto fast_checksum = std::uint64_t{0};
+    auto superkos = 0;
+    Time fast_start;
+    for (auto game = 0; game < games; game++) {
+        auto state = FastState{};
+        fast_moves += play_random_game(state, board_size, game + 1, superkos);
+        fast_checksum ^= state.board.get_hash();
+    }
+    Time fast_end;
+
+    auto ko_moves = std::uint64_t{0};
+    auto ko_checksum = std::uint64_t{0};
+    auto finals = std::vector<KoState>{};
+    finals.reserve(games);
+    Time ko_start;
+    for (auto game = 0; game < games; game++) {
+        finals.emplace_back();
+        ko_moves += play_random_game(finals.back(), board_size, game + 1,
+                                     superkos);
+        ko_checksum ^= finals.back().board.get_hash();
+    }
+    Time ko_end;
+
+    constexpr auto SCORE_REPEATS = 20;
+    auto score_sum = 0.0;
+    Time score_start;
+    for (auto repeat = 0; repeat < SCORE_REPEATS; repeat++) {
+        for (const auto& state : finals) {
+            score_sum += state.final_score();
+        }
+    }
+    Time score_end;
+
+    // The move counts and checksums must not change with the board code
+    const auto fast_seconds = Time::timediff_seconds(fast_start, fast_end);
+    const auto ko_seconds = Time::timediff_seconds(ko_start, ko_end);
+    const auto score_seconds = Time::timediff_seconds(score_start,
+                                                      score_end);
+    myprintf("FastState %10llu moves %12.0f moves/s  checksum %016llx\n",
+             static_cast<unsigned long long>(fast_moves),
+             fast_moves / fast_seconds,
+             static_cast<unsigned long long>(fast_checksum));
+    myprintf("KoState   %10llu moves %12.0f moves/s  checksum %016llx, "
+             "%d superko cycles\n",
+             static_cast<unsigned long long>(ko_moves),
+             ko_moves / ko_seconds,
+             static_cast<unsigned long long>(ko_checksum), superkos);
+    myprintf("area_score %9d scores %11.0f scores/s checksum %.1f\n",
+             games * SCORE_REPEATS, games * SCORE_REPEATS / score_seconds,
+             score_sum / SCORE_REPEATS);
+}
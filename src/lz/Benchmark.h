@@ -0,0 +1,45 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BENCHMARK_H_INCLUDED
+#define BENCHMARK_H_INCLUDED
+
+#include "config.h"
+
+#include <vector>
+
+class Network;
+
+/*
+    Reproducible measurements of the engine, independent of time
+    controls and pondering.
+*/
+namespace Benchmark {
+    // Searches each bundled position with a fixed number of visits, from
+    // a fresh tree and an empty NNCache, once per number of search
+    // threads. Runs with one thread always search the same tree.
+    void search(Network& network, int visits,
+                const std::vector<int>& threads);
+
+    // Random games straight on FastState and KoState, then scores of
+    // the final positions. Prints moves/s and scores/s, and checksums of
+    // the same games to compare changes of the board code against.
+    void board(int board_size, int games);
+}
+
+#endif
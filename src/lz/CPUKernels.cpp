@@ -0,0 +1,84 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "CPUKernels.h"
+
+namespace {
+
+CPUKernels::isa_t& isa_in_use() {
+    static auto isa = CPUKernels::detect_isa();
+    return isa;
+}
+
+}
+
+const char* CPUKernels::isa_name(const isa_t isa) {
+    switch (isa) {
+    case GENERIC:
+        return "generic";
+    case SSE42:
+        return "sse4.2";
+    case AVX2:
+        return "avx2";
+    case AVX512:
+        return "avx512";
+    }
+    return "unknown";
+}
+
+bool CPUKernels::isa_from_name(const std::string& name, isa_t& isa) {
+    for (const auto candidate : {GENERIC, SSE42, AVX2, AVX512}) {
+        if (name == isa_name(candidate)) {
+            isa = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+CPUKernels::isa_t CPUKernels::detect_isa() {
+#ifdef CPU_KERNELS_X86
+    __builtin_cpu_init();
+    // The AVX2 and AVX-512 SGEMM microkernels need FMA as well
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")
+        && __builtin_cpu_supports("avx512vl")
+        && __builtin_cpu_supports("fma")) {
+        return AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.2")) {
+        return SSE42;
+    }
+#endif
+    return GENERIC;
+}
+
+CPUKernels::isa_t CPUKernels::isa() {
+    return isa_in_use();
+}
+
+bool CPUKernels::select_isa(const isa_t isa) {
+    if (isa > detect_isa()) {
+        return false;
+    }
+    isa_in_use() = isa;
+    return true;
+}
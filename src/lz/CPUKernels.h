@@ -0,0 +1,106 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CPU_KERNELS_H_INCLUDED
+#define CPU_KERNELS_H_INCLUDED
+
+#include "config.h"
+
+#include <string>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CPU_KERNELS_X86
+// Kernel bodies are forced into the wrapper of every instruction set,
+// so they get compiled for it.
+#define KERNEL_INLINE __attribute__((always_inline))
+#else
+#define KERNEL_INLINE
+#endif
+
+/*
+    Run-time selection of the instruction set for the CPU kernels.
+
+    Builds only assume the baseline of the target (SSE2 on x86-64). The
+    element-wise kernels of the network are written once, as a lambda,
+    and dispatch() runs the copy of it compiled for the best instruction
+    set this CPU has. The SGEMM and int8 microkernels pick theirs within
+    the same level. Levels differ in rounding: the AVX2 and AVX-512
+    SGEMM microkernels use fused multiply-adds, and GCC contracts the
+    kernel lambdas into them in the AVX-512 wrapper (AVX-512F implies
+    FMA, and C++ builds default to -ffp-contract=fast).
+    Results of a level forced with --cpu-kernels match the others only
+    to float tolerance, not bit for bit.
+*/
+namespace CPUKernels {
+    enum isa_t {
+        GENERIC = 0, SSE42 = 1, AVX2 = 2, AVX512 = 3
+    };
+
+    const char* isa_name(isa_t isa);
+    bool isa_from_name(const std::string& name, isa_t& isa);
+    // Best level this CPU supports.
+    isa_t detect_isa();
+    // Level in use, detect_isa() unless overridden.
+    isa_t isa();
+    // Override for testing, returns false if the CPU lacks the level.
+    // Has to happen before the first kernel runs.
+    bool select_isa(isa_t isa);
+
+#ifdef CPU_KERNELS_X86
+    template <typename F>
+    __attribute__((target("sse4.2")))
+    void run_sse42(const F& f) {
+        f();
+    }
+
+    template <typename F>
+    __attribute__((target("avx2")))
+    void run_avx2(const F& f) {
+        f();
+    }
+
+    template <typename F>
+    __attribute__((target("avx512f,avx512bw,avx512vl")))
+    void run_avx512(const F& f) {
+        f();
+    }
+#endif
+
+    // Runs f, a lambda marked KERNEL_INLINE, compiled for isa().
+    template <typename F>
+    void dispatch(const F& f) {
+#ifdef CPU_KERNELS_X86
+        switch (isa()) {
+        case AVX512:
+            run_avx512(f);
+            return;
+        case AVX2:
+            run_avx2(f);
+            return;
+        case SSE42:
+            run_sse42(f);
+            return;
+        case GENERIC:
+            break;
+        }
+#endif
+        f();
+    }
+}
+
+#endif
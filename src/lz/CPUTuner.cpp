@@ -0,0 +1,224 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "CPUTuner.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+#include "CPUKernels.h"
+#include "Utils.h"
+
+using namespace Utils;
+
+const auto CPU_TUNER_FILE_LOCAL = std::string("leelaz_cpu_tuning");
+
+const char* CPUTuner::algorithm_name(const algorithm_t algorithm) {
+    switch (algorithm) {
+    case WINOGRAD_BUILTIN:
+        return "winograd-builtin";
+    case WINOGRAD_BLAS:
+        return "winograd-blas";
+    case IM2COL:
+        return "im2col";
+    case DIRECT:
+        return "direct";
+    case WINOGRAD4_BUILTIN:
+        return "winograd4-builtin";
+    case WINOGRAD4_BLAS:
+        return "winograd4-blas";
+    case WINOGRAD_HALF:
+        return "winograd-half";
+    case WINOGRAD4_HALF:
+        return "winograd4-half";
+    }
+    return "unknown";
+}
+
+bool CPUTuner::algorithm_from_name(const std::string& name,
+                                   algorithm_t& algorithm) {
+    for (const auto candidate : {WINOGRAD_BUILTIN, WINOGRAD_BLAS,
+                                 IM2COL, DIRECT,
+                                 WINOGRAD4_BUILTIN, WINOGRAD4_BLAS,
+                                 WINOGRAD_HALF, WINOGRAD4_HALF}) {
+        if (name == algorithm_name(candidate)) {
+            algorithm = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string CPUTuner::get_cpu_name() {
+    // The brand string, e.g. "Intel(R) Xeon(R) CPU @ 2.00GHz".
+    unsigned int regs[12] = {};
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    if (__get_cpuid_max(0x80000000, nullptr) < 0x80000004) {
+        return "unknown CPU";
+    }
+    for (auto i = 0u; i < 3; i++) {
+        __get_cpuid(0x80000002 + i, &regs[4 * i], &regs[4 * i + 1],
+                    &regs[4 * i + 2], &regs[4 * i + 3]);
+    }
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    for (auto i = 0; i < 3; i++) {
+        __cpuid(reinterpret_cast<int*>(&regs[4 * i]), 0x80000002 + i);
+    }
+#else
+    return "unknown CPU";
+#endif
+    char brand[sizeof(regs) + 1] = {};
+    std::memcpy(brand, regs, sizeof(regs));
+    auto name = std::string{brand};
+    // Trim, and keep the ; separators of the tuning file out.
+    name.erase(0, name.find_first_not_of(' '));
+    name.erase(name.find_last_not_of(' ') + 1);
+    std::replace(begin(name), end(name), ';', ',');
+    return name.empty() ? "unknown CPU" : name;
+}
+
+CPUTuner::CPUTuner(const int threads)
+    : m_cpu_name(get_cpu_name()), m_threads(threads) {
+    // Plans tuned with fewer instruction sets than the CPU has are
+    // kept apart.
+    if (CPUKernels::isa() != CPUKernels::detect_isa()) {
+        m_cpu_name += std::string(" with ")
+                      + CPUKernels::isa_name(CPUKernels::isa());
+    }
+}
+
+CPUTuner::algorithm_t CPUTuner::tune_conv(
+    const std::vector<algorithm_t>& candidates, benchmark_t benchmark) {
+    auto best = candidates.front();
+    auto best_time = 0.0;
+    for (const auto algorithm : candidates) {
+        const auto time = benchmark(algorithm);
+        myprintf("  %-17s %8.3f ms\n", algorithm_name(algorithm), time);
+        if (algorithm == candidates.front() || time < best_time) {
+            best = algorithm;
+            best_time = time;
+        }
+    }
+    return best;
+}
+
+void CPUTuner::store_conv_plan(const std::string& shape,
+                               const algorithm_t algorithm) {
+    auto file_contents = std::vector<std::string>();
+    {
+        // Read the previous contents to string
+        auto file = std::ifstream{CPU_TUNER_FILE_LOCAL};
+        if (file.good()) {
+            auto line = std::string{};
+            while (std::getline(file, line)) {
+                file_contents.emplace_back(line);
+            }
+        }
+    }
+    auto file = std::ofstream{CPU_TUNER_FILE_LOCAL};
+
+    auto tuning_line_prefix = std::to_string(TUNER_VERSION) + ";Conv3x3;"
+        + shape + ";";
+    auto tuning_line_suffix = ";" + m_cpu_name + ";"
+        + std::to_string(m_threads);
+
+    // Write back previous data as long as it's not the machine and
+    // shape we just tuned
+    for (const auto& line: file_contents) {
+        auto algorithm = algorithm_t{};
+        if (!conv_plan_from_line(line, shape, algorithm)) {
+            file << line << std::endl;
+        }
+    }
+
+    // Write new tuning
+    file << tuning_line_prefix << algorithm_name(algorithm)
+         << tuning_line_suffix << std::endl;
+
+    if (file.fail()) {
+        myprintf("Could not save the tuning result.\n");
+        myprintf("Do I have write permissions on %s?\n",
+            CPU_TUNER_FILE_LOCAL.c_str());
+    }
+}
+
+bool CPUTuner::conv_plan_from_line(const std::string& line,
+                                   const std::string& shape,
+                                   algorithm_t& algorithm) {
+    auto s = std::vector<std::string>{};
+    auto ss = std::stringstream{line};
+    auto item = std::string{};
+
+    while (std::getline(ss, item, ';')) {
+        s.emplace_back(item);
+    }
+
+    // version;Conv3x3;channels;outputs;board size;batch size;
+    // algorithm;cpu;threads
+    if (s.size() != 9) {
+        return false;
+    }
+    if (s[0] != std::to_string(TUNER_VERSION) || s[1] != "Conv3x3") {
+        return false;
+    }
+    if (s[2] + ";" + s[3] + ";" + s[4] + ";" + s[5] != shape) {
+        return false;
+    }
+    if (s[7] != m_cpu_name || s[8] != std::to_string(m_threads)) {
+        return false;
+    }
+    return algorithm_from_name(s[6], algorithm);
+}
+
+CPUTuner::algorithm_t CPUTuner::load_conv_plan(
+    const int channels, const int outputs,
+    const int board_size, const int batch_size,
+    const std::vector<algorithm_t>& candidates, benchmark_t benchmark) {
+    auto shape = std::stringstream{};
+    shape << channels << ";" << outputs << ";"
+          << board_size << ";" << batch_size;
+
+    auto file = std::ifstream{CPU_TUNER_FILE_LOCAL};
+    if (file.good()) {
+        auto line = std::string{};
+        while (std::getline(file, line)) {
+            auto algorithm = algorithm_t{};
+            if (conv_plan_from_line(line, shape.str(), algorithm)
+                && std::find(begin(candidates), end(candidates),
+                             algorithm) != end(candidates)) {
+                return algorithm;
+            }
+        }
+    }
+
+    myprintf("Tuning %dx%d convolution, %dx%d board, batch %d on %s.\n",
+             channels, outputs, board_size, board_size, batch_size,
+             m_cpu_name.c_str());
+    const auto algorithm = tune_conv(candidates, benchmark);
+    store_conv_plan(shape.str(), algorithm);
+    return algorithm;
+}
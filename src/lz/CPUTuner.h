@@ -0,0 +1,67 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CPU_TUNER_H_INCLUDED
+#define CPU_TUNER_H_INCLUDED
+
+#include "config.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+/*
+    Picks the fastest way to run a 3x3 convolution of a given shape on
+    this machine, like Tuner does for the OpenCL SGEMM. Winners are kept
+    in leelaz_cpu_tuning keyed by the CPU model and the thread count, so
+    only the first run with a new network shape pays for the benchmarks.
+*/
+class CPUTuner {
+public:
+    enum algorithm_t {
+        WINOGRAD_BUILTIN = 0, WINOGRAD_BLAS = 1, IM2COL = 2, DIRECT = 3,
+        WINOGRAD4_BUILTIN = 4, WINOGRAD4_BLAS = 5,
+        WINOGRAD_HALF = 6, WINOGRAD4_HALF = 7
+    };
+    // Milliseconds per call of an algorithm on the shape being tuned.
+    using benchmark_t = std::function<double(algorithm_t)>;
+
+    static constexpr auto TUNER_VERSION = 0;
+    static const char* algorithm_name(algorithm_t algorithm);
+    static bool algorithm_from_name(const std::string& name,
+                                    algorithm_t& algorithm);
+    static std::string get_cpu_name();
+
+    explicit CPUTuner(const int threads);
+    algorithm_t load_conv_plan(const int channels, const int outputs,
+                               const int board_size, const int batch_size,
+                               const std::vector<algorithm_t>& candidates,
+                               benchmark_t benchmark);
+private:
+    algorithm_t tune_conv(const std::vector<algorithm_t>& candidates,
+                          benchmark_t benchmark);
+    void store_conv_plan(const std::string& shape, algorithm_t algorithm);
+    bool conv_plan_from_line(const std::string& line,
+                             const std::string& shape,
+                             algorithm_t& algorithm);
+
+    std::string m_cpu_name;
+    int m_threads;
+};
+
+#endif
@@ -27,22 +27,28 @@
 #include <exception>
 #include <fstream>
 #include <limits>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <random>
 #include <string>
 #include <vector>
 #include <sstream>
 #include <cstdarg>
 
+#include "Benchmark.h"
 #include "FastBoard.h"
 #include "FullBoard.h"
 #include "GameState.h"
+#include "HugePages.h"
+#include "NNCache.h"
 #include "Network.h"
 #include "SMP.h"
+#include "Telemetry.h"
+#include "Trace.h"
 #include "UCTSearch.h"
 #include "Utils.h"
 #include "Zobrist.h"
-#include "NNCache.h"
 
 using namespace Utils;
 
@@ -50,6 +56,12 @@ using namespace Utils;
 bool cfg_gtp_mode;
 bool cfg_allow_pondering;
 int cfg_num_threads;
+int cfg_nn_threads;
+bool cfg_pin_threads;
+bool cfg_pin_nodes;
+bool cfg_numa_replicas;
+bool cfg_huge_pages;
+bool cfg_trace;
 int cfg_max_threads;
 int cfg_max_playouts;
 int cfg_max_visits;
@@ -66,6 +78,16 @@ bool cfg_tune_only;
 float cfg_puct;
 float cfg_softmax_temp;
 float cfg_fpu_reduction;
+bool cfg_root_average;
+Sgemm::backend_t cfg_cpu_sgemm;
+std::string cfg_cpu_conv;
+bool cfg_cpu_int8;
+bool cfg_cpu_fp16;
+std::string cfg_cpu_kernels;
+std::string cfg_nn_backend;
+int cfg_nn_latency;
+std::string cfg_nn_record;
+std::string cfg_nn_replay;
 std::string cfg_weightsfile;
 std::string cfg_logfile;
 FILE* cfg_logfile_handle;
@@ -83,6 +105,13 @@ void GTP::setup_default_parameters() {
 #else
     cfg_num_threads = cfg_max_threads;
 #endif
+    // 0 is the number of search threads
+    cfg_nn_threads = 0;
+    cfg_pin_threads = false;
+    cfg_pin_nodes = false;
+    cfg_numa_replicas = false;
+    cfg_huge_pages = false;
+    cfg_trace = false;
     cfg_max_playouts = std::numeric_limits<decltype(cfg_max_playouts)>::max();
     cfg_max_visits = std::numeric_limits<decltype(cfg_max_visits)>::max();
     cfg_timemanage = TimeManagement::AUTO;
@@ -95,6 +124,16 @@ void GTP::setup_default_parameters() {
     cfg_puct = 0.8f;
     cfg_softmax_temp = 1.0f;
     cfg_fpu_reduction = 0.25f;
+    cfg_root_average = false;
+    cfg_cpu_sgemm = Sgemm::AUTO;
+    cfg_cpu_conv = "auto";
+    cfg_cpu_int8 = false;
+    cfg_cpu_fp16 = false;
+    cfg_cpu_kernels = "auto";
+    cfg_nn_backend = "network";
+    cfg_nn_latency = 0;
+    cfg_nn_record.clear();
+    cfg_nn_replay.clear();
     // see UCTSearch::should_resign
     cfg_resignpct = -1;
     cfg_dumbpass = false;
@@ -186,7 +225,44 @@ void init_global_objects() {
 
     inited = true;
 
-    thread_pool.initialize(cfg_num_threads);
+    HugePages::set_enabled(cfg_huge_pages);
+    Trace::set_enabled(cfg_trace);
+
+    // Replicas are only read by threads that know their node.
+    if (cfg_numa_replicas && !cfg_pin_threads) {
+        cfg_pin_nodes = true;
+    }
+    const auto pin = cfg_pin_threads ? ThreadPool::PIN_CPU
+                   : cfg_pin_nodes ? ThreadPool::PIN_NODE
+                   : ThreadPool::NO_PIN;
+    // The GTP thread searches too. Pinned, it keeps CPU or node 0, the
+    // search workers come next and the network workers after them.
+    if (pin == ThreadPool::PIN_CPU) {
+        SMP::pin_to_cpu(0);
+    } else if (pin == ThreadPool::PIN_NODE) {
+        SMP::pin_to_node(0);
+    }
+    thread_pool.initialize(cfg_num_threads, pin, 1);
+    if (cfg_nn_threads <= 0) {
+        cfg_nn_threads = cfg_num_threads;
+    }
+    // The evaluating thread itself is the first one
+    nn_thread_pool.initialize(cfg_nn_threads - 1, pin,
+                              pin == ThreadPool::PIN_CPU
+                              ? cfg_num_threads + 1 : 0);
+    if (pin != ThreadPool::NO_PIN) {
+        const auto& nodes = SMP::get_numa_nodes();
+        const auto search = thread_pool.threads_per_node();
+        const auto nn = nn_thread_pool.threads_per_node();
+        for (auto node = size_t{0}; node < nodes.size(); node++) {
+            myprintf("NUMA node %d: CPUs %s, %d search and %d NN threads%s\n",
+                     nodes[node].id,
+                     SMP::format_cpus(nodes[node].cpus).c_str(),
+                     search[node], nn[node],
+                     static_cast<int>(node) == SMP::current_node()
+                     ? ", GTP thread" : "");
+        }
+    }
 
     // Use deterministic random numbers for hashing
     auto rng = std::make_unique<Random>(5489);
@@ -197,10 +273,23 @@ void init_global_objects() {
     // improves reproducibility across platforms.
     Random::get_Rng().seedrandom(cfg_rng_seed);
 
-    NNCache::get_NNCache().set_size_from_playouts(cfg_max_playouts);
+}
 
-    // Initialize network
-    Network::initialize();
+// Built-in engines running the same weights share one network.
+static std::shared_ptr<Network> load_network(const std::string& weightsfile) {
+    static std::mutex mutex;
+    static std::map<std::string, std::weak_ptr<Network>> networks;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto network = networks[weightsfile].lock();
+    if (!network) {
+        network = std::make_shared<Network>();
+        if (!network->initialize(weightsfile)) {
+            exit(EXIT_FAILURE);
+        }
+        networks[weightsfile] = network;
+    }
+    return network;
 }
 
 static const vector<string> s_commands = {
@@ -222,7 +311,13 @@ static const vector<string> s_commands = {
         "time_left",
         "fixed_handicap",
         "place_free_handicap",
-        "set_free_handicap"
+        "set_free_handicap",
+        "lz-benchmark",
+        "lz-bench-search",
+        "lz-bench-board",
+        "lz-stats",
+        "lz-trace",
+        "lz-memory"
     };
 
 bool GTP::support(const string& cmd) {
@@ -238,21 +333,33 @@ void GTP::run() {
 
     init_global_objects();
 
+    // Initialize network
+    network = load_network(weightsfile_);
+
     game = std::make_unique<GameState>();
 
-    /* set board limits */
+    /* set board limits, the network decides the board size */
     auto komi = 7.5f;
-    game->init_game(BOARD_SIZE, komi);
+    board_size_ = network->get_boardsize();
+    game->init_game(board_size_, komi);
+
+    search = std::make_unique<UCTSearch>(*game, *network);
 
-    search = std::make_unique<UCTSearch>(*game);
+    // The weights, the NNCache and the first tree pages are mapped now.
+    HugePages::report();
 
     ready_ = true;
 
     auto gtp_vprint = [&](bool error, const char *fmt, va_list ap) {
 		
-        char buffer[4096];
-        int n = vsprintf(buffer, fmt, ap);
-        auto rsp = string(buffer, n);
+        // Reports like lz-stats can be long.
+        va_list ap2;
+        va_copy(ap2, ap);
+        const auto n = vsnprintf(nullptr, 0, fmt, ap2);
+        va_end(ap2);
+        auto buffer = std::vector<char>(std::max(n, 0) + 1);
+        vsnprintf(buffer.data(), buffer.size(), fmt, ap);
+        auto rsp = string(buffer.data(), std::max(n, 0));
 
         if (onOutput) {
             onOutput((error ? "? " : "= ") + rsp + "\n\n");
@@ -342,6 +449,8 @@ void GTP::run() {
 
         read_th.join();
 
+        Trace::Scope traced("gtp", "gtp", command.c_str());
+
         /* process commands */
         if (command == "protocol_version") {
             gtp_print("%d", GTP_VERSION);
@@ -378,7 +487,7 @@ void GTP::run() {
             cmdstream >> tmp;
 
             if (!cmdstream.fail()) {
-                if (tmp != BOARD_SIZE) {
+                if (tmp != network->get_boardsize()) {
                     gtp_fail("unacceptable size");
                 } else {
                     board_size_ = tmp;
@@ -391,7 +500,7 @@ void GTP::run() {
             }
         } else if (command.find("clear_board") == 0) {
             game->reset_game();
-            search = std::make_unique<UCTSearch>(*game);
+            search = std::make_unique<UCTSearch>(*game, *network);
             clean_board();
             if (onReset)
                 onReset();
@@ -598,7 +707,7 @@ void GTP::run() {
             cmdstream >> stones;
 
             if (!cmdstream.fail()) {
-                game->place_free_handicap(stones);
+                game->place_free_handicap(stones, *network);
                 auto stonestring = game->board.get_stone_list();
                 gtp_print("%s", stonestring.c_str());
 
@@ -647,6 +756,187 @@ void GTP::run() {
                 }
             }
 
+        } else if (command.find("lz-benchmark") == 0) {
+            // lz-benchmark [iterations] [batch=1,8] [threads=1,2]
+            //              [json=file] [net=<blocks>x<filters>]
+            std::istringstream cmdstream(command);
+            std::string tmp;
+            int iterations = 1600;
+            auto options = Network::BenchmarkOptions{};
+            auto valid = true;
+
+            cmdstream >> tmp;   // eat lz-benchmark
+            while (cmdstream >> tmp) {
+                const auto eq = tmp.find('=');
+                if (eq == std::string::npos) {
+                    try {
+                        iterations = std::stoi(tmp);
+                    } catch (...) {
+                        valid = false;
+                    }
+                    continue;
+                }
+                const auto key = tmp.substr(0, eq);
+                const auto value = tmp.substr(eq + 1);
+                if (key == "json") {
+                    options.json_file = value;
+                    continue;
+                }
+                if (key == "net") {
+                    const auto x = value.find('x');
+                    try {
+                        options.random_blocks = std::stoi(value.substr(0, x));
+                        options.random_channels = std::stoi(value.substr(x + 1));
+                    } catch (...) {
+                        valid = false;
+                    }
+                    valid &= x != std::string::npos
+                             && options.random_blocks > 0
+                             && options.random_channels > 0;
+                    continue;
+                }
+                auto list = std::vector<int>{};
+                std::istringstream valuestream(value);
+                std::string item;
+                while (std::getline(valuestream, item, ',')) {
+                    try {
+                        list.emplace_back(std::stoi(item));
+                    } catch (...) {
+                        valid = false;
+                    }
+                    if (!list.empty() && list.back() <= 0) {
+                        valid = false;
+                    }
+                }
+                if (key == "batch") {
+                    options.batch_sizes = list;
+                } else if (key == "threads") {
+                    options.threads = list;
+                } else {
+                    valid = false;
+                }
+            }
+            if (!valid || iterations <= 0) {
+                gtp_fail("syntax not understood");
+            } else {
+                network->benchmark(game.get(), iterations, options);
+                gtp_print("");
+            }
+        } else if (command.find("lz-bench-search") == 0) {
+            // lz-bench-search [visits] [threads=1,2]
+            std::istringstream cmdstream(command);
+            std::string tmp;
+            auto visits = cfg_max_visits
+                          < std::numeric_limits<int>::max() ? cfg_max_visits
+                                                            : 1600;
+            // Doubling up to --threads by default
+            auto threads = std::vector<int>{};
+            for (auto t = 1; t < cfg_num_threads; t *= 2) {
+                threads.emplace_back(t);
+            }
+            threads.emplace_back(cfg_num_threads);
+            auto valid = true;
+
+            cmdstream >> tmp;   // eat lz-bench-search
+            while (cmdstream >> tmp) {
+                try {
+                    if (tmp.find("threads=") == 0) {
+                        threads.clear();
+                        std::istringstream valuestream(tmp.substr(8));
+                        std::string item;
+                        while (std::getline(valuestream, item, ',')) {
+                            threads.emplace_back(std::stoi(item));
+                            valid &= threads.back() > 0;
+                        }
+                    } else {
+                        visits = std::stoi(tmp);
+                    }
+                } catch (...) {
+                    valid = false;
+                }
+            }
+            if (!valid || visits <= 0 || threads.empty()) {
+                gtp_fail("syntax not understood");
+            } else {
+                Benchmark::search(*network, visits, threads);
+                gtp_print("");
+            }
+        } else if (command.find("lz-bench-board") == 0) {
+            std::istringstream cmdstream(command);
+            std::string tmp;
+            int games = 1000;
+
+            cmdstream >> tmp;   // eat lz-bench-board
+            cmdstream >> games;
+            if (cmdstream.fail()) {
+                games = 1000;
+            }
+            if (games <= 0) {
+                gtp_fail("syntax not understood");
+            } else {
+                Benchmark::board(board_size_, games);
+                gtp_print("");
+            }
+        } else if (command.find("lz-stats") == 0) {
+            // lz-stats [json]
+            std::istringstream cmdstream(command);
+            std::string tmp;
+
+            cmdstream >> tmp;   // eat lz-stats
+            const auto json = static_cast<bool>(cmdstream >> tmp);
+            if (json && tmp != "json") {
+                gtp_fail("syntax not understood");
+            } else {
+                auto& nncache = network->get_nncache();
+                auto report = Telemetry::snapshot();
+                const auto cache = nncache.get_stats();
+                report.emplace_back("nncache.lookups", cache.lookups);
+                report.emplace_back("nncache.hits", cache.hits);
+                report.emplace_back("nncache.misses",
+                                    cache.lookups - cache.hits);
+                report.emplace_back("nncache.inserts", cache.inserts);
+                report.emplace_back("nncache.evictions", cache.evictions);
+                report.emplace_back("nncache.entries", cache.entries);
+                gtp_print("%s", Telemetry::format(report, json).c_str());
+            }
+        } else if (command.find("lz-memory") == 0) {
+            // lz-memory [json]
+            std::istringstream cmdstream(command);
+            std::string tmp;
+
+            cmdstream >> tmp;   // eat lz-memory
+            if (cmdstream >> tmp && tmp != "json") {
+                gtp_fail("syntax not understood");
+            } else {
+                const auto report = search->memory_usage();
+                gtp_print("%s", Telemetry::format(report,
+                                                  tmp == "json").c_str());
+            }
+        } else if (command.find("lz-trace") == 0) {
+            // lz-trace on|off|clear|dump <file>
+            std::istringstream cmdstream(command);
+            std::string tmp, filename;
+
+            cmdstream >> tmp;   // eat lz-trace
+            cmdstream >> tmp;
+            if (tmp == "on" || tmp == "off") {
+                Trace::set_enabled(tmp == "on");
+                gtp_print("");
+            } else if (tmp == "clear") {
+                Trace::clear();
+                gtp_print("");
+            } else if (tmp == "dump" && cmdstream >> filename) {
+                std::ofstream out(filename);
+                const auto events = Trace::dump(out);
+                out.close();
+                if (out.fail()) {
+                    gtp_fail("cannot write %s", filename.c_str());
+                } else {
+                    gtp_print("%zu events", events);
+                }
+            } else {
+                gtp_fail("syntax not understood");
+            }
         } else {
             gtp_fail("unknown command");
         }
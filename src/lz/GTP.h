@@ -27,6 +27,7 @@
 #include <iostream>
 
 #include "GameState.h"
+#include "Network.h"
 #include "UCTSearch.h"
 #include "../safe_queue.hpp"
 #include "../gtp_agent.h"
@@ -36,6 +37,12 @@ using namespace std;
 extern bool cfg_gtp_mode;
 extern bool cfg_allow_pondering;
 extern int cfg_num_threads;
+extern int cfg_nn_threads;
+extern bool cfg_pin_threads;
+extern bool cfg_pin_nodes;
+extern bool cfg_numa_replicas;
+extern bool cfg_huge_pages;
+extern bool cfg_trace;
 extern int cfg_max_threads;
 extern int cfg_max_playouts;
 extern int cfg_max_visits;
@@ -52,16 +59,31 @@ extern bool cfg_tune_only;
 extern float cfg_puct;
 extern float cfg_softmax_temp;
 extern float cfg_fpu_reduction;
+extern bool cfg_root_average;
+extern Sgemm::backend_t cfg_cpu_sgemm;
+extern std::string cfg_cpu_conv;
+extern bool cfg_cpu_int8;
+extern bool cfg_cpu_fp16;
+extern std::string cfg_cpu_kernels;
+extern std::string cfg_nn_backend;
+extern int cfg_nn_latency;
+extern std::string cfg_nn_record;
+extern std::string cfg_nn_replay;
 extern std::string cfg_logfile;
 extern std::string cfg_weightsfile;
 extern FILE* cfg_logfile_handle;
 extern bool cfg_quiet;
 
+// Thread pools, hashing and the RNG, once the options are parsed.
+void init_global_objects();
+
 
 class GTP : public GtpState {
 
     static bool input_pending_;
 
+    std::string weightsfile_;
+    shared_ptr<Network> network;
     unique_ptr<GameState> game;
     unique_ptr<UCTSearch> search;
     std::thread th_;
@@ -87,7 +109,8 @@ public:
     bool support(const string& cmd);
     string version() const;
 
-    void execute() {
+    void execute(const string& weightsfile = cfg_weightsfile) {
+        weightsfile_ = weightsfile;
         ready_ = false;
         th_ = std::thread([this] {
             run();
@@ -173,6 +173,20 @@ int GameState::who_resigned() const {
     return m_resigned;
 }
 
+std::size_t GameState::get_history_bytes() const {
+    auto bytes = game_history.capacity() * sizeof(game_history[0]);
+    for (const auto& state : game_history) {
+        // make_shared keeps two counts next to the object
+        bytes += sizeof(KoState) + 2 * sizeof(int)
+                 + state->get_ko_hash_bytes();
+    }
+    return bytes;
+}
+
+std::size_t GameState::get_history_size() const {
+    return game_history.size();
+}
+
 bool GameState::has_resigned() const {
     return m_resigned != FastBoard::EMPTY;
 }
@@ -301,7 +315,7 @@ bool GameState::valid_handicap(int handicap) {
     return true;
 }
 
-void GameState::place_free_handicap(int stones) {
+void GameState::place_free_handicap(int stones, Network& network) {
     int limit = board.get_boardsize() * board.get_boardsize();
     if (stones > limit / 2) {
         stones = limit / 2;
@@ -317,7 +331,7 @@ void GameState::place_free_handicap(int stones) {
     stones -= set_fixed_handicap_2(stones);
 
     for (int i = 0; i < stones; i++) {
-        auto search = std::make_unique<UCTSearch>(*this);
+        auto search = std::make_unique<UCTSearch>(*this, network);
         auto move = search->think(FastBoard::BLACK, UCTSearch::NOPASS);
         play_move(FastBoard::BLACK, move);
     }
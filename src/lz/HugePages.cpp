@@ -0,0 +1,301 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "HugePages.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#include "Utils.h"
+
+using namespace Utils;
+
+namespace {
+
+enum kind_t { EXPLICIT, TRANSPARENT, NORMAL };
+
+struct Region {
+    std::size_t size;
+    kind_t kind;
+    const char* owner;
+};
+
+std::atomic<bool> s_enabled{false};
+std::mutex s_mutex;
+std::map<std::uintptr_t, Region> s_regions;
+
+std::size_t round_up(const std::size_t bytes) {
+    return (bytes + HugePages::HUGE_PAGE_SIZE - 1)
+           / HugePages::HUGE_PAGE_SIZE * HugePages::HUGE_PAGE_SIZE;
+}
+
+#ifdef __linux__
+void* map_region(const std::size_t size, kind_t& kind) {
+    const auto prot = PROT_READ | PROT_WRITE;
+    const auto flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    void* p = nullptr;
+#ifdef MAP_HUGETLB
+    // Fails right away unless enough huge pages are reserved.
+    p = mmap(nullptr, size, prot, flags | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+        kind = EXPLICIT;
+        return p;
+    }
+#endif
+    // Over-map and trim to a huge page boundary, transparent huge
+    // pages only cover aligned ranges.
+    const auto mapped = size + HugePages::HUGE_PAGE_SIZE;
+    p = mmap(nullptr, mapped, prot, flags, -1, 0);
+    if (p == MAP_FAILED) {
+        return nullptr;
+    }
+    const auto start = reinterpret_cast<std::uintptr_t>(p);
+    const auto aligned = (start + HugePages::HUGE_PAGE_SIZE - 1)
+                         & ~(HugePages::HUGE_PAGE_SIZE - 1);
+    if (aligned > start) {
+        munmap(p, aligned - start);
+    }
+    const auto tail = start + mapped - (aligned + size);
+    if (tail > 0) {
+        munmap(reinterpret_cast<void*>(aligned + size), tail);
+    }
+    p = reinterpret_cast<void*>(aligned);
+    kind = NORMAL;
+#ifdef MADV_HUGEPAGE
+    if (madvise(p, size, MADV_HUGEPAGE) == 0) {
+        kind = TRANSPARENT;
+    }
+#endif
+    return p;
+}
+
+// AnonHugePages of every mapping in /proc/self/smaps, by start address.
+std::map<std::uintptr_t, std::size_t> transparent_bytes() {
+    auto bytes = std::map<std::uintptr_t, std::size_t>{};
+    auto smaps = std::ifstream{"/proc/self/smaps"};
+    auto line = std::string{};
+    auto start = std::uintptr_t{0};
+    while (std::getline(smaps, line)) {
+        auto ss = std::istringstream{line};
+        auto field = std::string{};
+        ss >> field;
+        const auto dash = field.find('-');
+        if (dash != std::string::npos && field.back() != ':') {
+            start = std::stoull(field.substr(0, dash), nullptr, 16);
+        } else if (field == "AnonHugePages:") {
+            auto kb = std::size_t{0};
+            ss >> kb;
+            bytes[start] = kb * 1024;
+        }
+    }
+    return bytes;
+}
+#endif
+
+}
+
+void HugePages::set_enabled(const bool enabled) {
+    s_enabled = enabled;
+}
+
+bool HugePages::enabled() {
+    return s_enabled;
+}
+
+void* HugePages::allocate(const std::size_t bytes, const char* owner) {
+    if (!s_enabled || bytes < HUGE_PAGE_SIZE) {
+        return nullptr;
+    }
+#ifdef __linux__
+    const auto size = round_up(bytes);
+    auto kind = NORMAL;
+    const auto p = map_region(size, kind);
+    if (p) {
+        std::lock_guard<std::mutex> lock(s_mutex);
+        s_regions.emplace(reinterpret_cast<std::uintptr_t>(p),
+                          Region{size, kind, owner});
+    }
+    return p;
+#else
+    (void)owner;
+    return nullptr;
+#endif
+}
+
+bool HugePages::deallocate(void* p) {
+    if (!p) {
+        return false;
+    }
+    auto region = Region{};
+    {
+        std::lock_guard<std::mutex> lock(s_mutex);
+        const auto it = s_regions.find(reinterpret_cast<std::uintptr_t>(p));
+        if (it == end(s_regions)) {
+            return false;
+        }
+        region = it->second;
+        s_regions.erase(it);
+    }
+#ifdef __linux__
+    munmap(p, region.size);
+#endif
+    return true;
+}
+
+void HugePages::report() {
+    if (!s_enabled) {
+        return;
+    }
+#ifdef __linux__
+    struct Totals {
+        std::size_t mapped{0};
+        std::size_t explicit_pages{0};
+        std::size_t transparent{0};
+        std::size_t requested{0};
+    };
+    auto owners = std::map<std::string, Totals>{};
+    const auto backed = transparent_bytes();
+    {
+        std::lock_guard<std::mutex> lock(s_mutex);
+        for (const auto& region : s_regions) {
+            auto& totals = owners[region.second.owner];
+            totals.mapped += region.second.size;
+            if (region.second.kind == EXPLICIT) {
+                totals.explicit_pages += region.second.size;
+            } else if (region.second.kind == TRANSPARENT) {
+                totals.requested += region.second.size;
+                // The mappings starting inside the region. The kernel
+                // merges neighbouring ones, hence the clamp below.
+                const auto first = backed.lower_bound(region.first);
+                const auto last = backed.lower_bound(region.first
+                                                     + region.second.size);
+                for (auto it = first; it != last; ++it) {
+                    totals.transparent += it->second;
+                }
+            }
+        }
+    }
+    if (owners.empty()) {
+        myprintf("Huge pages: nothing big enough allocated yet.\n");
+    }
+    const auto MiB = 1024.0 * 1024.0;
+    for (const auto& owner : owners) {
+        const auto& totals = owner.second;
+        myprintf("Huge pages for the %s: %.1f MiB, %.1f MiB reserved "
+                 "huge pages, %.1f of %.1f MiB transparent huge pages.\n",
+                 owner.first.c_str(), totals.mapped / MiB,
+                 totals.explicit_pages / MiB,
+                 std::min(totals.transparent, totals.requested) / MiB,
+                 totals.requested / MiB);
+    }
+#else
+    myprintf("Huge pages are not supported on this system.\n");
+#endif
+}
+
+constexpr int HugePages::Pool::SHARDS;
+
+HugePages::Pool::Pool(const char* owner, const std::size_t block_size)
+    : m_owner(owner),
+      m_block_size((std::max(block_size, sizeof(void*))
+                    + alignof(std::max_align_t) - 1)
+                   / alignof(std::max_align_t) * alignof(std::max_align_t)) {
+    // If the first region can't be had, huge pages are not supported
+    // here, never mind.
+    if (const auto region = HugePages::allocate(HUGE_PAGE_SIZE, m_owner)) {
+        m_source = REGIONS;
+        add_region(m_shards[0], region);
+    }
+}
+
+HugePages::Pool::~Pool() {
+    for (const auto region : m_regions) {
+        HugePages::deallocate(region);
+    }
+}
+
+HugePages::Pool::Shard& HugePages::Pool::shard() {
+    static std::atomic<int> next{0};
+    thread_local auto index = next++ % SHARDS;
+    return m_shards[index];
+}
+
+void HugePages::Pool::add_region(Shard& shard, void* region) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_regions.emplace_back(region);
+    }
+    shard.next = static_cast<char*>(region);
+    shard.end = shard.next + HUGE_PAGE_SIZE;
+}
+
+void* HugePages::Pool::allocate() {
+    if (m_source == HEAP) {
+        return ::operator new(m_block_size);
+    }
+    auto& shard = this->shard();
+    {
+        LOCK(shard.mutex, lock);
+        if (shard.free) {
+            const auto p = shard.free;
+            shard.free = *static_cast<void**>(p);
+            return p;
+        }
+        if (shard.next + m_block_size <= shard.end) {
+            const auto p = shard.next;
+            shard.next += m_block_size;
+            return p;
+        }
+    }
+    // Mapping a region takes a while, not under the spin lock.
+    const auto region = HugePages::allocate(HUGE_PAGE_SIZE, m_owner);
+    if (!region) {
+        throw std::bad_alloc();
+    }
+    LOCK(shard.mutex, lock);
+    // The rest of the old region, less than a block, is left unused.
+    add_region(shard, region);
+    const auto p = shard.next;
+    shard.next += m_block_size;
+    return p;
+}
+
+void HugePages::Pool::deallocate(void* p) {
+    if (!p) {
+        return;
+    }
+    if (m_source == HEAP) {
+        ::operator delete(p);
+        return;
+    }
+    auto& shard = this->shard();
+    LOCK(shard.mutex, lock);
+    *static_cast<void**>(p) = shard.free;
+    shard.free = p;
+}
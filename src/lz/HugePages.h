@@ -0,0 +1,137 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef HUGEPAGES_H_INCLUDED
+#define HUGEPAGES_H_INCLUDED
+
+#include "config.h"
+
+#include <array>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "SMP.h"
+
+/*
+    Large long-lived memory on huge pages (--huge-pages), to save TLB
+    misses when the search walks the tree and the convolutions stream
+    the weights. A region is taken from the reserved huge pages
+    (MAP_HUGETLB) if there are enough of them, otherwise transparent huge
+    pages are requested with madvise, and failing that it is left on
+    normal pages. Without --huge-pages, or on other systems, everything
+    goes through operator new as usual.
+*/
+namespace HugePages {
+    constexpr auto HUGE_PAGE_SIZE = std::size_t{2} * 1024 * 1024;
+
+    void set_enabled(bool enabled);
+    bool enabled();
+
+    // A region of at least bytes for owner, nullptr if huge pages are
+    // off or the region is too small to be worth it.
+    void* allocate(std::size_t bytes, const char* owner);
+    // False if p was not allocated by allocate().
+    bool deallocate(void* p);
+
+    // Per owner: bytes mapped, bytes on reserved huge pages and bytes
+    // the kernel actually backs with transparent huge pages.
+    void report();
+
+    // For vectors that are big and stay, the network weights. Small ones
+    // still come from operator new.
+    template <typename T>
+    class Allocator {
+    public:
+        using value_type = T;
+
+        Allocator() = default;
+        template <typename U>
+        Allocator(const Allocator<U>&) {}
+
+        T* allocate(const std::size_t n) {
+            if (auto p = HugePages::allocate(n * sizeof(T), "weights")) {
+                return static_cast<T*>(p);
+            }
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        }
+        void deallocate(T* p, std::size_t) {
+            if (!HugePages::deallocate(p)) {
+                ::operator delete(p);
+            }
+        }
+    };
+    template <typename T, typename U>
+    bool operator==(const Allocator<T>&, const Allocator<U>&) {
+        return true;
+    }
+    template <typename T, typename U>
+    bool operator!=(const Allocator<T>&, const Allocator<U>&) {
+        return false;
+    }
+
+    template <typename T>
+    using vector = std::vector<T, Allocator<T>>;
+
+    // Fixed size blocks carved from huge page regions, for the many
+    // small objects of the tree and the NNCache. Freed blocks are kept
+    // for reuse, the regions are only returned when the pool goes.
+    // Whether huge pages are used is settled when the pool is built,
+    // without them blocks come straight from operator new. Threads
+    // allocate and free through their own shard, so that tree
+    // expansion on one thread does not wait for another.
+    class Pool {
+    public:
+        Pool(const char* owner, std::size_t block_size);
+        ~Pool();
+        Pool(const Pool&) = delete;
+        Pool& operator=(const Pool&) = delete;
+
+        void* allocate();
+        void deallocate(void* p);
+        std::size_t block_size() const { return m_block_size; }
+
+    private:
+        static constexpr auto SHARDS = 16;
+
+        struct Shard {
+            SMP::Mutex mutex;
+            // Freed blocks, linked through their first bytes
+            void* free{nullptr};
+            // Never used part of the newest region of the shard
+            char* next{nullptr};
+            char* end{nullptr};
+            // Keeps shards on separate cache lines
+            char padding[64];
+        };
+        Shard& shard();
+        // Makes region the one the shard carves blocks from.
+        void add_region(Shard& shard, void* region);
+
+        const char* m_owner;
+        std::size_t m_block_size;
+        enum { HEAP, REGIONS } m_source{HEAP};
+        std::array<Shard, SHARDS> m_shards;
+
+        std::mutex m_mutex;
+        std::vector<void*> m_regions;
+    };
+}
+
+#endif
@@ -0,0 +1,326 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "Int8.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define INT8_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+#include "CPUKernels.h"
+#include "Memory.h"
+
+namespace {
+
+/*
+    The convolution is a GEMM of the filters (outputs x channels * 9)
+    with the im2col of the input (channels * 9 x board squares). The
+    depth is grouped by 4, the unit of the dot-product instructions:
+    the im2col is stored as groups x columns x 4 bytes, and a panel of
+    MR filters as groups x MR x 4 bytes. Columns are padded to a multiple
+    of COLUMN_BLOCK, so the microkernels only ever see full blocks.
+
+    A microkernel computes one MR x NR block of 32-bit sums over all
+    groups, x points at the first column of the block and has a row
+    stride of x_stride bytes.
+*/
+using kernel_t = void (*)(const std::int8_t* w, const std::uint8_t* x,
+                          int x_stride, int groups,
+                          std::int32_t* c, int ldc);
+
+struct Microkernel {
+    kernel_t kernel;
+    int nr;
+};
+
+struct KernelSet {
+    int mr;
+    // Widest first, the narrowest one is COLUMN_BLOCK wide.
+    std::vector<Microkernel> kernels;
+    const char* name;
+};
+
+constexpr auto COLUMN_BLOCK = 16;
+
+std::int32_t load_group(const std::int8_t* w) {
+    auto group = std::int32_t{0};
+    std::memcpy(&group, w, sizeof(group));
+    return group;
+}
+
+template <int MR, int NR>
+void kernel_generic(const std::int8_t* w, const std::uint8_t* x,
+                    const int x_stride, const int groups,
+                    std::int32_t* c, const int ldc) {
+    std::int32_t acc[MR][NR] = {};
+    for (auto g = 0; g < groups; g++) {
+        const auto xg = x + g * x_stride;
+        const auto wg = w + g * MR * 4;
+        for (auto r = 0; r < MR; r++) {
+            for (auto j = 0; j < NR; j++) {
+                for (auto l = 0; l < 4; l++) {
+                    acc[r][j] += wg[r * 4 + l] * xg[j * 4 + l];
+                }
+            }
+        }
+    }
+    for (auto r = 0; r < MR; r++) {
+        std::copy(acc[r], acc[r] + NR, c + r * ldc);
+    }
+}
+
+#ifdef INT8_X86_KERNELS
+// MR x (8 * NV): u8 x s8 pairs summed to 16 bits, then to 32 bits.
+template <int MR, int NV>
+__attribute__((target("avx2")))
+void kernel_avx2(const std::int8_t* w, const std::uint8_t* x,
+                 const int x_stride, const int groups,
+                 std::int32_t* c, const int ldc) {
+    const auto ones = _mm256_set1_epi16(1);
+    __m256i acc[MR][NV];
+    for (auto r = 0; r < MR; r++) {
+        for (auto v = 0; v < NV; v++) {
+            acc[r][v] = _mm256_setzero_si256();
+        }
+    }
+    for (auto g = 0; g < groups; g++) {
+        __m256i xv[NV];
+        for (auto v = 0; v < NV; v++) {
+            xv[v] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(
+                x + g * x_stride + 32 * v));
+        }
+        for (auto r = 0; r < MR; r++) {
+            const auto wr = _mm256_set1_epi32(load_group(w + (g * MR + r) * 4));
+            for (auto v = 0; v < NV; v++) {
+                const auto pairs = _mm256_maddubs_epi16(xv[v], wr);
+                acc[r][v] = _mm256_add_epi32(
+                    acc[r][v], _mm256_madd_epi16(pairs, ones));
+            }
+        }
+    }
+    for (auto r = 0; r < MR; r++) {
+        for (auto v = 0; v < NV; v++) {
+            _mm256_storeu_si256(
+                reinterpret_cast<__m256i*>(c + r * ldc + 8 * v), acc[r][v]);
+        }
+    }
+}
+
+// MR x (16 * NV), one vpdpbusd per group does the whole dot product.
+template <int MR, int NV>
+__attribute__((target("avx512f,avx512vnni")))
+void kernel_vnni(const std::int8_t* w, const std::uint8_t* x,
+                 const int x_stride, const int groups,
+                 std::int32_t* c, const int ldc) {
+    __m512i acc[MR][NV];
+    for (auto r = 0; r < MR; r++) {
+        for (auto v = 0; v < NV; v++) {
+            acc[r][v] = _mm512_setzero_si512();
+        }
+    }
+    for (auto g = 0; g < groups; g++) {
+        __m512i xv[NV];
+        for (auto v = 0; v < NV; v++) {
+            xv[v] = _mm512_loadu_si512(x + g * x_stride + 64 * v);
+        }
+        for (auto r = 0; r < MR; r++) {
+            const auto wr = _mm512_set1_epi32(load_group(w + (g * MR + r) * 4));
+            for (auto v = 0; v < NV; v++) {
+                acc[r][v] = _mm512_dpbusd_epi32(acc[r][v], xv[v], wr);
+            }
+        }
+    }
+    for (auto r = 0; r < MR; r++) {
+        for (auto v = 0; v < NV; v++) {
+            _mm512_storeu_si512(c + r * ldc + 16 * v, acc[r][v]);
+        }
+    }
+}
+#endif
+
+KernelSet select_kernels() {
+#ifdef INT8_X86_KERNELS
+    __builtin_cpu_init();
+    if (CPUKernels::isa() >= CPUKernels::AVX512
+        && __builtin_cpu_supports("avx512vnni")) {
+        return {8, {{kernel_vnni<8, 2>, 32}, {kernel_vnni<8, 1>, 16}},
+                "AVX-512 VNNI 8x32"};
+    }
+    if (CPUKernels::isa() >= CPUKernels::AVX2) {
+        return {6, {{kernel_avx2<6, 2>, 16}}, "AVX2 6x16"};
+    }
+#endif
+    return {4, {{kernel_generic<4, 16>, 16}}, "generic 4x16"};
+}
+
+const KernelSet& kernel_set() {
+    static const auto kernels = select_kernels();
+    return kernels;
+}
+
+const Microkernel& pick_kernel(const KernelSet& set, const int n) {
+    for (const auto& uk : set.kernels) {
+        if (uk.nr <= n) {
+            return uk;
+        }
+    }
+    return set.kernels.back();
+}
+
+int padded_columns(const int columns) {
+    return (columns + COLUMN_BLOCK - 1) / COLUMN_BLOCK * COLUMN_BLOCK;
+}
+
+std::uint8_t quantize(const float val, const float inv_scale) {
+    if (!(val > 0.0f)) {
+        return 0;
+    }
+    const auto q = static_cast<int>(val * inv_scale + 0.5f);
+    return static_cast<std::uint8_t>(std::min(q, Int8::MAX_ACTIVATION));
+}
+
+}
+
+const char* Int8::kernel_name() {
+    return kernel_set().name;
+}
+
+Int8::Conv3 Int8::quantize_conv3(const std::vector<float>& weights,
+                                 const int outputs, const int channels) {
+    const auto depth = channels * 9;
+    assert(weights.size() == static_cast<size_t>(outputs) * depth);
+    const auto groups = (depth + 3) / 4;
+    const auto MR = kernel_set().mr;
+    const auto panels = (outputs + MR - 1) / MR;
+
+    auto conv = Conv3{};
+    conv.channels = channels;
+    conv.outputs = outputs;
+    conv.input_scale = 1.0f;
+    conv.scales.resize(outputs);
+    auto quantized = std::vector<std::int8_t>(weights.size());
+    for (auto o = 0; o < outputs; o++) {
+        const auto filter = begin(weights) + o * depth;
+        auto max_weight = 0.0f;
+        std::for_each(filter, filter + depth, [&max_weight](const float w) {
+            max_weight = std::max(max_weight, std::fabs(w));
+        });
+        const auto scale = max_weight > 0.0f ? max_weight / MAX_WEIGHT : 1.0f;
+        conv.scales[o] = scale;
+        for (auto d = 0; d < depth; d++) {
+            quantized[o * depth + d] = static_cast<std::int8_t>(
+                std::lround(filter[d] / scale));
+        }
+    }
+
+    // Per panel: groups x MR x 4, padded with zeroes.
+    conv.weights.resize(panels * groups * MR * 4);
+    auto out = begin(conv.weights);
+    for (auto p = 0; p < panels; p++) {
+        for (auto g = 0; g < groups; g++) {
+            for (auto r = 0; r < MR; r++) {
+                for (auto l = 0; l < 4; l++) {
+                    const auto o = p * MR + r;
+                    const auto d = g * 4 + l;
+                    *out++ = o < outputs && d < depth
+                             ? quantized[o * depth + d] : std::int8_t{0};
+                }
+            }
+        }
+    }
+    return conv;
+}
+
+float Int8::input_scale(const float max_input) {
+    return max_input > 0.0f ? max_input / MAX_ACTIVATION : 1.0f;
+}
+
+void Int8::convolve3(const Conv3& conv, const int board_size,
+                     const float* input, const float* biases,
+                     const float* residual, float* output) {
+    const auto& set = kernel_set();
+    const auto MR = set.mr;
+    const auto W = board_size;
+    const auto columns = W * W;
+    const auto P = padded_columns(columns);
+    const auto depth = conv.channels * 9;
+    const auto groups = (depth + 3) / 4;
+    const auto panels = (conv.outputs + MR - 1) / MR;
+
+    thread_local std::vector<std::uint8_t> planes;
+    thread_local std::vector<std::uint8_t> col;
+    thread_local std::vector<std::int32_t> acc;
+    Memory::resize_workspace(planes, conv.channels * columns);
+    Memory::resize_workspace(col, groups * P * 4);
+    std::fill(begin(col), end(col), 0);
+    Memory::resize_workspace(acc, panels * MR * P);
+
+    const auto inv_scale = 1.0f / conv.input_scale;
+    for (auto i = size_t{0}; i < planes.size(); i++) {
+        planes[i] = quantize(input[i], inv_scale);
+    }
+    // im2col straight into the grouped layout, the zero fill above
+    // takes care of the board edges and the padding.
+    for (auto c = 0; c < conv.channels; c++) {
+        const auto plane = &planes[c * columns];
+        for (auto k = 0; k < 9; k++) {
+            const auto d = c * 9 + k;
+            const auto dst = &col[(d / 4) * P * 4 + d % 4];
+            const auto dy = k / 3 - 1;
+            const auto dx = k % 3 - 1;
+            for (auto y = std::max(0, -dy); y < std::min(W, W - dy); y++) {
+                for (auto x = std::max(0, -dx); x < std::min(W, W - dx); x++) {
+                    dst[(y * W + x) * 4] = plane[(y + dy) * W + (x + dx)];
+                }
+            }
+        }
+    }
+
+    // A column block of the im2col stays in cache while every panel of
+    // filters streams past it.
+    for (auto p0 = 0; p0 < P; ) {
+        const auto& uk = pick_kernel(set, P - p0);
+        for (auto panel = 0; panel < panels; panel++) {
+            uk.kernel(&conv.weights[panel * groups * MR * 4], &col[p0 * 4],
+                      P * 4, groups, &acc[panel * MR * P + p0], P);
+        }
+        p0 += uk.nr;
+    }
+
+    for (auto o = 0; o < conv.outputs; o++) {
+        const auto scale = conv.scales[o] * conv.input_scale;
+        const auto bias = biases[o];
+        const auto sums = &acc[o * P];
+        const auto out = output + o * columns;
+        const auto res = residual ? residual + o * columns : nullptr;
+        for (auto i = 0; i < columns; i++) {
+            auto val = sums[i] * scale + bias;
+            if (res) {
+                val += res[i];
+            }
+            out[i] = val > 0.0f ? val : 0.0f;
+        }
+    }
+}
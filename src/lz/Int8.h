@@ -0,0 +1,69 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef INT8_H_INCLUDED
+#define INT8_H_INCLUDED
+
+#include "config.h"
+
+#include <cstdint>
+#include <vector>
+
+/*
+    8-bit integer 3x3 convolutions for the residual tower on the CPU.
+
+    Filters are quantized once at load time with one scale per output
+    channel. Inputs of the tower convolutions are ReLU outputs, so they
+    are quantized to unsigned values with one scale per layer, which is
+    calibrated on sample positions. The products are accumulated in 32
+    bits by VNNI or AVX2 dot-product kernels and scaled back to floats
+    together with the bias, residual add and ReLU.
+*/
+namespace Int8 {
+    // Activations only use 7 bits, so the pairwise 16-bit sums of the
+    // AVX2 kernel cannot saturate and every kernel gives the same result.
+    constexpr auto MAX_ACTIVATION = 127;
+    constexpr auto MAX_WEIGHT = 127;
+
+    struct Conv3 {
+        int channels;
+        int outputs;
+        // Packed for the microkernel picked for the running CPU
+        std::vector<std::int8_t> weights;
+        // Per output channel, weight = scale * quantized weight
+        std::vector<float> scales;
+        // Per layer, input = input_scale * quantized input
+        float input_scale;
+    };
+
+    // Name of the microkernel in use.
+    const char* kernel_name();
+
+    Conv3 quantize_conv3(const std::vector<float>& weights,
+                         int outputs, int channels);
+    // Scale that maps inputs up to max_input onto MAX_ACTIVATION.
+    float input_scale(float max_input);
+
+    // output = ReLU(conv(input) + biases + residual) for one position,
+    // residual may be nullptr.
+    void convolve3(const Conv3& conv, int board_size,
+                   const float* input, const float* biases,
+                   const float* residual, float* output);
+}
+
+#endif
@@ -45,6 +45,10 @@ bool KoState::superko(void) const {
     return (res != last);
 }
 
+std::size_t KoState::get_ko_hash_bytes() const {
+    return m_ko_hash_history.capacity() * sizeof(std::uint64_t);
+}
+
 void KoState::reset_game() {
     FastState::reset_game();
 
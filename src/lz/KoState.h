@@ -35,6 +35,9 @@ public:
     void play_move(int color, int vertex);
     void play_move(int vertex);
 
+    // Heap bytes of the position hashes kept for superko
+    std::size_t get_ko_hash_bytes() const;
+
 private:
     std::vector<std::uint64_t> m_ko_hash_history;
 };
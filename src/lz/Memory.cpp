@@ -0,0 +1,64 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "Memory.h"
+
+#include <array>
+#include <atomic>
+
+namespace {
+
+std::array<std::atomic<std::int64_t>, Memory::CATEGORIES> s_live{};
+std::array<std::atomic<std::int64_t>, Memory::CATEGORIES> s_peak{};
+
+// The thread_local workspaces die with their thread, and so does this.
+struct ThreadWorkspaces {
+    std::int64_t bytes{0};
+    ~ThreadWorkspaces() {
+        Memory::add(Memory::WORKSPACES, -bytes);
+    }
+};
+
+thread_local ThreadWorkspaces t_workspaces;
+
+}
+
+void Memory::add(const category_t category, const std::int64_t bytes) {
+    const auto live = s_live[category].fetch_add(bytes,
+                                                 std::memory_order_relaxed)
+                      + bytes;
+    auto peak = s_peak[category].load(std::memory_order_relaxed);
+    while (live > peak
+           && !s_peak[category].compare_exchange_weak(
+                  peak, live, std::memory_order_relaxed)) {
+    }
+}
+
+std::int64_t Memory::live(const category_t category) {
+    return s_live[category].load(std::memory_order_relaxed);
+}
+
+std::int64_t Memory::peak(const category_t category) {
+    return s_peak[category].load(std::memory_order_relaxed);
+}
+
+void Memory::add_thread_workspace(const std::int64_t bytes) {
+    t_workspaces.bytes += bytes;
+    add(WORKSPACES, bytes);
+}
@@ -0,0 +1,85 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MEMORY_H_INCLUDED
+#define MEMORY_H_INCLUDED
+
+#include "config.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+    Live bytes of what grows and shrinks with the search: tree nodes,
+    their child lists and the scratch buffers of the network
+    evaluations. These change too often to be walked for a report, so
+    they are counted where they are allocated and freed, for the whole
+    process: engines sharing it add to the same counts. The NNCache,
+    the game history and the weights are summed up per engine when a
+    report is asked for, see UCTSearch::memory_usage.
+*/
+namespace Memory {
+    enum category_t {
+        TREE_NODES,
+        TREE_CHILDREN,  // child vectors and pending (prior, move) lists
+        WORKSPACES,     // evaluation buffers, per call and per thread
+        CATEGORIES
+    };
+
+    void add(category_t category, std::int64_t bytes);
+    std::int64_t live(category_t category);
+    // Highest live bytes since startup.
+    std::int64_t peak(category_t category);
+
+    // Counts bytes while alive, for buffers local to a call.
+    class Scope {
+    public:
+        Scope(category_t category, std::size_t bytes)
+            : m_category(category),
+              m_bytes(static_cast<std::int64_t>(bytes)) {
+            add(m_category, m_bytes);
+        }
+        ~Scope() {
+            add(m_category, -m_bytes);
+        }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    private:
+        category_t m_category;
+        std::int64_t m_bytes;
+    };
+
+    // Counts workspace bytes of the calling thread, which are given
+    // back when the thread exits.
+    void add_thread_workspace(std::int64_t bytes);
+
+    // Resizes a thread_local buffer that is kept between calls and
+    // counts what it grows by.
+    template <typename T>
+    void resize_workspace(std::vector<T>& buffer, const std::size_t size) {
+        const auto capacity = buffer.capacity();
+        buffer.resize(size);
+        if (buffer.capacity() != capacity) {
+            add_thread_workspace(static_cast<std::int64_t>(
+                (buffer.capacity() - capacity) * sizeof(T)));
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,206 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "NNBackend.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#include "FastBoard.h"
+#include "Utils.h"
+
+using namespace Utils;
+
+namespace {
+
+// splitmix64 finalizer, spreads nearby inputs over all bits
+std::uint64_t mix(std::uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+// In [0, 1)
+float unit(const std::uint64_t x) {
+    return (x >> 40) * (1.0f / (1 << 24));
+}
+
+std::uint8_t rotation_mask(const std::vector<int>& rotations) {
+    auto mask = std::uint8_t{0};
+    for (const auto rotation : rotations) {
+        mask |= 1 << rotation;
+    }
+    return mask;
+}
+
+template <typename T>
+void write_raw(std::ostream& out, const T& value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+bool read_raw(std::istream& in, T& value) {
+    return bool(in.read(reinterpret_cast<char*>(&value), sizeof(value)));
+}
+
+}
+
+SyntheticBackend::SyntheticBackend(const int latency_us)
+    : m_latency_us(latency_us) {
+}
+
+Network::Netresult SyntheticBackend::evaluate(
+    const GameState* state, const std::vector<int>& /*rotations*/) {
+    if (m_latency_us > 0) {
+        std::this_thread::sleep_for(std::chrono::microseconds(m_latency_us));
+    }
+
+    const auto hash = state->board.get_hash();
+    const auto size = state->board.get_boardsize();
+    auto result = Network::Netresult{};
+    auto& moves = result.first;
+    auto sum = 0.0f;
+    for (auto idx = 0; idx < size * size; idx++) {
+        const auto vtx = state->board.get_vertex(idx % size, idx / size);
+        if (state->board.get_square(vtx) == FastBoard::EMPTY) {
+            // Cubed so a few moves stand out, like a real policy
+            const auto r = unit(mix(hash ^ mix(idx)));
+            moves.emplace_back(r * r * r, vtx);
+            sum += r * r * r;
+        }
+    }
+    moves.emplace_back(0.001f + 0.001f * sum, FastBoard::PASS);
+    sum += moves.back().first;
+    for (auto& move : moves) {
+        move.first /= sum;
+    }
+    // Mostly close games
+    result.second = 0.2f + 0.6f * unit(mix(hash));
+    return result;
+}
+
+constexpr std::uint32_t EvalRecorder::MAGIC;
+constexpr std::uint32_t EvalRecorder::VERSION;
+
+EvalRecorder::EvalRecorder(const std::string& filename)
+    : m_file(filename, std::ios::binary) {
+}
+
+bool EvalRecorder::good() const {
+    return m_file.good();
+}
+
+void EvalRecorder::record(const GameState* state,
+                          const std::vector<int>& rotations,
+                          const Network::Netresult& result) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_header_written) {
+        write_raw(m_file, MAGIC);
+        write_raw(m_file, VERSION);
+        write_raw(m_file, std::uint32_t(state->board.get_boardsize()));
+        m_header_written = true;
+    }
+    write_raw(m_file, state->board.get_hash());
+    write_raw(m_file, rotation_mask(rotations));
+    write_raw(m_file, result.second);
+    write_raw(m_file, std::uint16_t(result.first.size()));
+    for (const auto& move : result.first) {
+        write_raw(m_file, move.first);
+    }
+}
+
+ReplayBackend::~ReplayBackend() {
+    myprintf("Replayed %llu evaluations, %llu positions not in the log.\n",
+             static_cast<unsigned long long>(m_hits.load()),
+             static_cast<unsigned long long>(m_misses.load()));
+}
+
+int ReplayBackend::load(const std::string& filename) {
+    auto file = std::ifstream{filename, std::ios::binary};
+    auto magic = std::uint32_t{0};
+    auto version = std::uint32_t{0};
+    auto board_size = std::uint32_t{0};
+    if (!read_raw(file, magic) || !read_raw(file, version)
+        || !read_raw(file, board_size)
+        || magic != EvalRecorder::MAGIC
+        || version != EvalRecorder::VERSION) {
+        myprintf("%s is not an evaluation log.\n", filename.c_str());
+        return 0;
+    }
+
+    auto records = size_t{0};
+    auto hash = std::uint64_t{0};
+    while (read_raw(file, hash)) {
+        auto record = Record{};
+        auto count = std::uint16_t{0};
+        if (!read_raw(file, record.rotations) || !read_raw(file, record.value)
+            || !read_raw(file, count)) {
+            break;
+        }
+        record.policy.resize(count);
+        if (!file.read(reinterpret_cast<char*>(record.policy.data()),
+                       count * sizeof(float))) {
+            break;
+        }
+        m_records[hash].emplace_back(std::move(record));
+        records++;
+    }
+    myprintf("Replaying %zu evaluations of %zu positions from %s.\n",
+             records, m_records.size(), filename.c_str());
+    return board_size;
+}
+
+Network::Netresult ReplayBackend::evaluate(
+    const GameState* state, const std::vector<int>& rotations) {
+    const auto hash = state->board.get_hash();
+    const auto it = m_records.find(hash);
+    if (it == end(m_records)) {
+        m_misses++;
+        return m_fallback.evaluate(state, rotations);
+    }
+
+    // Other search threads or seeds may have picked other rotations
+    const auto mask = rotation_mask(rotations);
+    const auto& records = it->second;
+    auto record = std::find_if(begin(records), end(records),
+        [mask](const Record& r) { return r.rotations == mask; });
+    if (record == end(records)) {
+        record = begin(records);
+    }
+
+    auto result = Network::Netresult{};
+    const auto size = state->board.get_boardsize();
+    auto policy = begin(record->policy);
+    for (auto idx = 0; idx < size * size; idx++) {
+        const auto vtx = state->board.get_vertex(idx % size, idx / size);
+        if (state->board.get_square(vtx) == FastBoard::EMPTY
+            && policy != end(record->policy)) {
+            result.first.emplace_back(*policy++, vtx);
+        }
+    }
+    if (policy != end(record->policy)) {
+        result.first.emplace_back(*policy, FastBoard::PASS);
+    }
+    result.second = record->value;
+    m_hits++;
+    return result;
+}
@@ -0,0 +1,116 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef NNBACKEND_H_INCLUDED
+#define NNBACKEND_H_INCLUDED
+
+#include "config.h"
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "GameState.h"
+#include "Network.h"
+
+/*
+    Where Network::get_scored_moves gets evaluations from instead of the
+    loaded weights. The NNCache still sits in front of it.
+*/
+class NNBackend {
+public:
+    virtual ~NNBackend() = default;
+    // The position seen in the given symmetries, averaged.
+    virtual Network::Netresult evaluate(const GameState* state,
+                                        const std::vector<int>& rotations) = 0;
+};
+
+/*
+    Priors and value made up from the hash of the position, so the same
+    position always gets the same evaluation. Costs next to nothing but
+    the optional latency, which leaves the search overhead alone to be
+    measured.
+*/
+class SyntheticBackend : public NNBackend {
+public:
+    explicit SyntheticBackend(int latency_us);
+    Network::Netresult evaluate(const GameState* state,
+                                const std::vector<int>& rotations) override;
+
+private:
+    int m_latency_us;
+};
+
+/*
+    Binary log of the evaluations get_scored_moves hands out, so a search
+    can be replayed without the network. After a header of the magic,
+    version and board size, every record is
+
+        u64 hash, u8 mask of the rotations, f32 value, u16 count,
+        count x f32 policy
+
+    in host byte order. The policy follows the empty points in board
+    order and then pass, the same position gives the same points back.
+*/
+class EvalRecorder {
+public:
+    static constexpr std::uint32_t MAGIC = 0x524e5a4c; // "LZNR"
+    static constexpr std::uint32_t VERSION = 1;
+
+    explicit EvalRecorder(const std::string& filename);
+    bool good() const;
+    void record(const GameState* state, const std::vector<int>& rotations,
+                const Network::Netresult& result);
+
+private:
+    std::mutex m_mutex;
+    std::ofstream m_file;
+    bool m_header_written{false};
+};
+
+/*
+    Serves the evaluations of an EvalRecorder log by position hash,
+    preferring the record with the same rotations. Positions the log
+    doesn't have get synthetic evaluations and are counted as misses.
+*/
+class ReplayBackend : public NNBackend {
+public:
+    ~ReplayBackend();
+    // Board size of the log, 0 if it could not be read.
+    int load(const std::string& filename);
+    Network::Netresult evaluate(const GameState* state,
+                                const std::vector<int>& rotations) override;
+
+private:
+    struct Record {
+        std::uint8_t rotations;
+        float value;
+        std::vector<float> policy;
+    };
+
+    std::unordered_map<std::uint64_t, std::vector<Record>> m_records;
+    SyntheticBackend m_fallback{0};
+    std::atomic<std::uint64_t> m_hits{0};
+    std::atomic<std::uint64_t> m_misses{0};
+};
+
+#endif
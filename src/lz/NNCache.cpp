@@ -17,19 +17,26 @@
 */
 
 #include "config.h"
+#include <algorithm>
+#include <cassert>
 #include <functional>
 
 #include "NNCache.h"
+#include "Trace.h"
 #include "Utils.h"
 
+constexpr std::size_t NNCache::MAX_MOVES;
+
 NNCache::NNCache(int size) : m_size(size) {}
 
-NNCache& NNCache::get_NNCache(void) {
-    static NNCache cache;
-    return cache;
+NNCache::~NNCache() {
+    for (const auto& entry : m_cache) {
+        m_pool->deallocate(entry.second);
+    }
 }
 
 bool NNCache::lookup(std::uint64_t hash, Network::Netresult & result) {
+    Trace::Scope traced("NNCache::lookup", "nncache");
     std::lock_guard<std::mutex> lock(m_mutex);
     ++m_lookups;
 
@@ -38,38 +45,72 @@ bool NNCache::lookup(std::uint64_t hash, Network::Netresult & result) {
         return false;  // Not found.
     }
 
-    const auto& entry = iter->second;
+    const auto entry = iter->second;
 
     // Found it.
     ++m_hits;
-    result = entry->result;
+    result.first.assign(entry->policy(), entry->policy() + entry->moves);
+    result.second = entry->value;
     return true;
 }
 
 void NNCache::insert(std::uint64_t hash,
                      const Network::Netresult& result) {
+    Trace::Scope traced("NNCache::insert", "nncache");
     std::lock_guard<std::mutex> lock(m_mutex);
 
     if (m_cache.find(hash) != m_cache.end()) {
         return;  // Already in the cache.
     }
 
-    m_cache.emplace(hash, std::make_unique<Entry>(result));
+    const auto moves = result.first.size();
+    assert(moves <= MAX_MOVES);
+    if (!m_pool) {
+        create_pool();
+    }
+    const auto entry = static_cast<Entry*>(m_pool->allocate());
+    entry->value = result.second;
+    entry->moves = moves;
+    std::copy(begin(result.first), end(result.first), entry->policy());
+
+    m_cache.emplace(hash, entry);
     m_order.push_back(hash);
     ++m_inserts;
 
     // If the cache is too large, remove the oldest entry.
     if (m_order.size() > m_size) {
-        m_cache.erase(m_order.front());
-        m_order.pop_front();
+        erase_oldest();
+        ++m_evictions;
     }
 }
 
+void NNCache::erase_oldest() {
+    const auto iter = m_cache.find(m_order.front());
+    m_pool->deallocate(iter->second);
+    m_cache.erase(iter);
+    m_order.pop_front();
+}
+
 void NNCache::resize(int size) {
     m_size = size;
+    if (m_size > 0 && !m_pool) {
+        create_pool();
+    }
     while (m_order.size() > m_size) {
-        m_cache.erase(m_order.front());
-        m_order.pop_front();
+        erase_oldest();
+        ++m_evictions;
+    }
+}
+
+void NNCache::create_pool() {
+    m_pool = std::make_unique<HugePages::Pool>(
+        "NNCache", sizeof(Entry) + MAX_MOVES * sizeof(Network::scored_node));
+}
+
+void NNCache::clear() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    while (!m_order.empty()) {
+        erase_oldest();
     }
 }
 
@@ -78,7 +119,21 @@ void NNCache::set_size_from_playouts(int max_playouts) {
     // size based on playouts increases the hit rate while balancing memory
     // usage for low playout instances. 50'000 cache entries is ~250 MB
     auto max_size = std::min(50'000, std::max(6'000, 3 * max_playouts));
-    NNCache::get_NNCache().resize(max_size);
+    resize(max_size);
+}
+
+NNCache::Stats NNCache::get_stats() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return {m_hits, m_lookups, m_inserts, m_evictions, m_cache.size()};
+}
+
+std::size_t NNCache::get_memory() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const auto block = m_pool ? m_pool->block_size() : 0;
+    // A map node holds the hash, the entry and a link, m_order the hash
+    const auto index = 2 * sizeof(std::uint64_t) + 2 * sizeof(void*);
+    return m_cache.size() * (block + index)
+           + m_cache.bucket_count() * sizeof(void*);
 }
 
 void NNCache::dump_stats() {
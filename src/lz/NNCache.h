@@ -22,15 +22,17 @@
 #include "config.h"
 
 #include <deque>
+#include <memory>
 #include <mutex>
 #include <unordered_map>
 
+#include "HugePages.h"
 #include "Network.h"
 
 class NNCache {
 public:
-    // return the global NNCache
-    static NNCache& get_NNCache(void);
+    NNCache(int size = 50000);  // ~ 250MB
+    ~NNCache();
 
     // Set a reasonable size gives max number of playouts
     void set_size_from_playouts(int max_playouts);
@@ -38,6 +40,9 @@ public:
     // Resize NNCache
     void resize(int size);
 
+    // Drop all entries, keeping the size and the statistics.
+    void clear();
+
     // Try and find an existing entry.
     bool lookup(std::uint64_t hash, Network::Netresult & result);
 
@@ -50,11 +55,22 @@ public:
         return {m_hits, m_lookups};
     }
 
+    struct Stats {
+        int hits;
+        int lookups;
+        int inserts;
+        // Entries dropped to stay within the size
+        int evictions;
+        std::size_t entries;
+    };
+    Stats get_stats();
+
+    // Bytes of the entries and of the index over them.
+    std::size_t get_memory();
+
     void dump_stats();
 
 private:
-    NNCache(int size = 50000);  // ~ 250MB
-
     std::mutex m_mutex;
 
     size_t m_size;
@@ -63,15 +79,26 @@ private:
     int m_hits{0};
     int m_lookups{0};
     int m_inserts{0};
+    int m_evictions{0};
 
+    // One block of the pool: the value, then the policy (~ 3KB).
     struct Entry {
-        Entry( const Network::Netresult& r)
-            : result(r) {}
-        Network::Netresult result;  // ~ 3KB
+        float value;
+        std::size_t moves;
+        Network::scored_node* policy() {
+            return reinterpret_cast<Network::scored_node*>(this + 1);
+        }
     };
+    void erase_oldest();
+    void create_pool();
+
+    // The policy has the empty points and pass, blocks are sized for an
+    // empty board of the largest size.
+    static constexpr auto MAX_MOVES = std::size_t{BOARD_SQUARES + 1};
+    std::unique_ptr<HugePages::Pool> m_pool;
 
     // Map from hash to {features, result}
-    std::unordered_map<std::uint64_t, std::unique_ptr<const Entry>> m_cache;
+    std::unordered_map<std::uint64_t, Entry*> m_cache;
     // Order entries were added to the map.
     std::deque<size_t> m_order;
 };
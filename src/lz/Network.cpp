@@ -23,11 +23,16 @@
 #include <algorithm>
 #include <array>
 #include <cassert>
+#include <chrono>
 #include <cmath>
+#include <functional>
 #include <iterator>
 #include <memory>
+#include <random>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <type_traits>
 #include <boost/utility.hpp>
 #include <boost/format.hpp>
 #include <boost/spirit/home/x3.hpp>
@@ -46,52 +51,136 @@
 #include "UCTNode.h"
 #endif
 
+#include "CPUKernels.h"
 #include "FastBoard.h"
 #include "FastState.h"
 #include "FullBoard.h"
 #include "GameState.h"
 #include "GTP.h"
 #include "Im2Col.h"
+#include "Memory.h"
+#include "NNBackend.h"
 #include "NNCache.h"
+#include "Profiler.h"
 #include "Random.h"
+#include "SMP.h"
+#include "Telemetry.h"
 #include "ThreadPool.h"
 #include "Timing.h"
+#include "Trace.h"
 #include "Utils.h"
 
 namespace x3 = boost::spirit::x3;
 using namespace Utils;
 
-// Input + residual block tower
-static std::vector<std::vector<float>> conv_weights;
-static std::vector<std::vector<float>> conv_biases;
-static std::vector<std::vector<float>> batchnorm_means;
-static std::vector<std::vector<float>> batchnorm_stddivs;
+#if defined(USE_BLAS) && !defined(USE_OPENCL)
+static std::string json_escape(const std::string& str) {
+    auto escaped = std::string{};
+    for (const auto c : str) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+        }
+        escaped += c;
+    }
+    return escaped;
+}
+#endif
+
+template <typename Vector>
+static std::size_t vector_bytes(const Vector& vector) {
+    return vector.capacity() * sizeof(typename Vector::value_type);
+}
+
+template <typename Vector>
+static std::size_t nested_bytes(const std::vector<Vector>& vectors) {
+    auto bytes = vector_bytes(vectors);
+    for (const auto& vector : vectors) {
+        bytes += vector_bytes(vector);
+    }
+    return bytes;
+}
+
+Network::Network()
+    : m_nncache(std::make_unique<NNCache>()) {
+}
+
+Network::~Network() = default;
 
-// Policy head
-static std::vector<float> conv_pol_w;
-static std::vector<float> conv_pol_b;
-static std::array<float, 2> bn_pol_w1;
-static std::array<float, 2> bn_pol_w2;
+int Network::get_boardsize() const {
+    return m_boardsize;
+}
 
-static std::array<float, (BOARD_SQUARES + 1) * BOARD_SQUARES * 2> ip_pol_w;
-static std::array<float, BOARD_SQUARES + 1> ip_pol_b;
+NNCache& Network::get_nncache() {
+    return *m_nncache;
+}
 
-// Value head
-static std::vector<float> conv_val_w;
-static std::vector<float> conv_val_b;
-static std::array<float, 1> bn_val_w1;
-static std::array<float, 1> bn_val_w2;
+std::uint64_t Network::get_evaluations() const {
+    return m_evaluations;
+}
 
-static std::array<float, BOARD_SQUARES * 256> ip1_val_w;
-static std::array<float, 256> ip1_val_b;
+std::size_t Network::get_weight_bytes() const {
+    auto bytes = nested_bytes(m_conv_weights) + nested_bytes(m_conv_biases)
+                 + nested_bytes(m_conv_winograd)
+                 + nested_bytes(m_conv_winograd_packed)
+                 + nested_bytes(m_conv_winograd4)
+                 + nested_bytes(m_conv_winograd4_packed)
+                 + nested_bytes(m_conv_winograd_half)
+                 + nested_bytes(m_conv_winograd4_half)
+                 + nested_bytes(m_batchnorm_means)
+                 + nested_bytes(m_batchnorm_stddivs);
+    bytes += vector_bytes(m_conv_pol_w) + vector_bytes(m_conv_pol_b)
+             + vector_bytes(m_ip_pol_w) + vector_bytes(m_ip_pol_b)
+             + vector_bytes(m_conv_val_w) + vector_bytes(m_conv_val_b)
+             + vector_bytes(m_ip1_val_w) + vector_bytes(m_ip1_val_b)
+             + vector_bytes(m_ip2_val_w) + vector_bytes(m_ip2_val_b);
+    bytes += vector_bytes(m_conv_int8);
+    for (const auto& conv : m_conv_int8) {
+        bytes += vector_bytes(conv.weights) + vector_bytes(conv.scales);
+    }
+    for (const auto& replica : m_replicas) {
+        bytes += replica->get_weight_bytes();
+    }
+    return bytes;
+}
 
-static std::array<float, 256> ip2_val_w;
-static std::array<float, 1> ip2_val_b;
+std::size_t Network::get_device_weight_bytes() const {
+    auto bytes = size_t{0};
+#ifdef USE_OPENCL
+    if (m_opencl) {
+        for (const auto& opencl_net : m_opencl->get_networks()) {
+            bytes += opencl_net->get_weight_bytes();
+        }
+    }
+#endif
+    return bytes;
+}
 
-// Rotation helper
-static std::array<std::array<int, BOARD_SQUARES>, 8> rotate_nn_idx_table;
+bool Network::is_supported_boardsize(int size) {
+    return size == 9 || size == 13 || size == 19;
+}
 
 void Network::benchmark(const GameState * state, int iterations) {
+    benchmark(state, iterations, BenchmarkOptions{});
+}
+
+void Network::benchmark(const GameState * state, int iterations,
+                        const BenchmarkOptions& options) {
+    if (options.random_blocks > 0 && options.random_channels > 0) {
+        myprintf("Building a %dx%d network of random weights.\n",
+                 options.random_blocks, options.random_channels);
+        auto weights = std::stringstream{};
+        write_random_weights(weights, options.random_blocks,
+                             options.random_channels, m_boardsize);
+        auto network = std::make_unique<Network>();
+        if (network->initialize(weights)) {
+            auto network_options = options;
+            network_options.random_blocks = 0;
+            network_options.random_channels = 0;
+            network->benchmark(state, iterations, network_options);
+        }
+        return;
+    }
+
     int cpus = cfg_num_threads;
     int iters_per_thread = (iterations + (cpus - 1)) / cpus;
 
@@ -99,7 +188,7 @@ void Network::benchmark(const GameState * state, int iterations) {
 
     ThreadGroup tg(thread_pool);
     for (int i = 0; i < cpus; i++) {
-        tg.add_task([iters_per_thread, state]() {
+        tg.add_task([this, iters_per_thread, state]() {
             for (int loop = 0; loop < iters_per_thread; loop++) {
                 auto vec = get_scored_moves(state, Ensemble::RANDOM_ROTATION, -1, true);
             }
@@ -111,6 +200,144 @@ void Network::benchmark(const GameState * state, int iterations) {
     auto elapsed = Time::timediff_seconds(start,end);
     myprintf("%5d evaluations in %5.2f seconds -> %d n/s\n",
              iterations, elapsed, (int)(iterations / elapsed));
+
+#if defined(USE_BLAS) && !defined(USE_OPENCL)
+    // Where the time of the evaluations goes
+    if (m_backend) {
+        return;
+    }
+    auto batch_sizes = options.batch_sizes;
+    if (batch_sizes.empty()) {
+        batch_sizes.emplace_back(1);
+    }
+    auto thread_counts = options.threads;
+    if (thread_counts.empty()) {
+        thread_counts.emplace_back(cfg_nn_threads);
+    }
+    const auto passes = std::max(1, iterations / 16);
+
+    auto json = std::ostringstream{};
+    json << "{\"cpu\": \"" << json_escape(CPUTuner::get_cpu_name())
+         << "\", \"kernels\": \"" << CPUKernels::isa_name(CPUKernels::isa())
+         << "\", \"board_size\": " << m_boardsize
+         << ", \"filters\": " << m_conv_biases[0].size()
+         << ", \"residual_blocks\": " << (m_conv_weights.size() - 1) / 2
+         << ", \"runs\": [";
+
+    auto first_run = true;
+    for (const auto batch_size : batch_sizes) {
+        for (const auto requested_threads : thread_counts) {
+            // The NN thread pool is sized for --nn-threads
+            const auto threads = std::max(1, std::min(requested_threads,
+                                                      cfg_nn_threads));
+            auto rotations = std::vector<int>(batch_size);
+            for (auto i = 0; i < batch_size; i++) {
+                rotations[i] = i % 8;
+            }
+            evaluate(state, rotations);
+
+            ForwardProfile profile(threads);
+            Time profile_start;
+            for (auto pass = 0; pass < passes; pass++) {
+                evaluate(state, rotations);
+            }
+            Time profile_end;
+            const auto seconds = Time::timediff_seconds(profile_start,
+                                                        profile_end);
+            const auto evals = double(passes) * batch_size;
+            const auto ms_per_pass = [passes](const double secs) {
+                return 1000.0 * secs / passes;
+            };
+
+            myprintf("\nBatch %d, %d NN threads", batch_size, threads);
+            if (threads != requested_threads) {
+                myprintf(" (%d asked, see --nn-threads)", requested_threads);
+            }
+            myprintf(", %d passes -> %.1f evals/s\n", passes, evals / seconds);
+
+            // Stages summed over all layers
+            auto stage_totals = std::vector<ForwardProfile::Stage>{};
+            for (const auto& stage : profile.stages()) {
+                auto total = std::find_if(stage_totals.begin(),
+                                          stage_totals.end(),
+                    [&stage](const ForwardProfile::Stage& s) {
+                        return s.stage == stage.stage;
+                    });
+                if (total == stage_totals.end()) {
+                    stage_totals.push_back({"", stage.stage, 0.0, 0});
+                    total = stage_totals.end() - 1;
+                }
+                total->seconds += stage.seconds;
+                total->cache_misses += stage.cache_misses;
+            }
+            for (const auto& total : stage_totals) {
+                myprintf("  %-20s %8.3f ms %5.1f%%", total.stage.c_str(),
+                         ms_per_pass(total.seconds),
+                         100.0 * total.seconds / seconds);
+                if (profile.counts_cache_misses()) {
+                    myprintf(" %10.0f cache misses",
+                             double(total.cache_misses) / passes);
+                }
+                myprintf("\n");
+            }
+            for (const auto& layer : profile.layers()) {
+                myprintf("  %-20s %8.3f ms %8.2f GFLOP/s\n",
+                         layer.name.c_str(), ms_per_pass(layer.seconds),
+                         layer.seconds > 0.0
+                         ? layer.flops / layer.seconds * 1e-9 : 0.0);
+            }
+
+            json << (first_run ? "" : ", ")
+                 << "{\"batch_size\": " << batch_size
+                 << ", \"threads\": " << threads
+                 << ", \"passes\": " << passes
+                 << ", \"evals_per_second\": " << evals / seconds
+                 << ", \"stages\": [";
+            first_run = false;
+            auto first = true;
+            for (const auto& stage : profile.stages()) {
+                json << (first ? "" : ", ")
+                     << "{\"layer\": \"" << stage.layer
+                     << "\", \"stage\": \"" << stage.stage
+                     << "\", \"ms\": " << ms_per_pass(stage.seconds);
+                if (profile.counts_cache_misses()) {
+                    json << ", \"cache_misses\": "
+                         << double(stage.cache_misses) / passes;
+                }
+                json << "}";
+                first = false;
+            }
+            json << "], \"layers\": [";
+            first = true;
+            for (const auto& layer : profile.layers()) {
+                json << (first ? "" : ", ")
+                     << "{\"name\": \"" << layer.name
+                     << "\", \"ms\": " << ms_per_pass(layer.seconds)
+                     << ", \"gflops\": " << layer.flops / passes * 1e-9
+                     << ", \"gflops_per_second\": "
+                     << (layer.seconds > 0.0
+                         ? layer.flops / layer.seconds * 1e-9 : 0.0)
+                     << "}";
+                first = false;
+            }
+            json << "]}";
+        }
+    }
+    json << "]}\n";
+
+    if (options.json_file == "-") {
+        myprintf("%s", json.str().c_str());
+    } else if (!options.json_file.empty()) {
+        auto file = std::ofstream{options.json_file};
+        file << json.str();
+        if (file.fail()) {
+            myprintf("Could not write the profile to %s.\n",
+                     options.json_file.c_str());
+        }
+    }
+#else
+    (void)options;
+#endif
 }
 
 void Network::process_bn_var(std::vector<float>& weights, const float epsilon) {
@@ -119,13 +346,12 @@ void Network::process_bn_var(std::vector<float>& weights, const float epsilon) {
     }
 }
 
-std::vector<float> Network::winograd_transform_f(const std::vector<float>& f,
-                                                 const int outputs,
-                                                 const int channels) {
+HugePages::vector<float> Network::winograd_transform_f(
+    const std::vector<float>& f, const int outputs, const int channels) {
     // F(2x2, 3x3) Winograd filter transformation
     // transpose(G.dot(f).dot(G.transpose()))
     // U matrix is transposed for better memory layout in SGEMM
-    auto U = std::vector<float>(WINOGRAD_TILE * outputs * channels);
+    auto U = HugePages::vector<float>(WINOGRAD_TILE * outputs * channels);
     auto G = std::array<float, WINOGRAD_TILE>{ 1.0,  0.0,  0.0,
                                                0.5,  0.5,  0.5,
                                                0.5, -0.5,  0.5,
@@ -162,7 +388,54 @@ std::vector<float> Network::winograd_transform_f(const std::vector<float>& f,
     return U;
 }
 
-std::vector<float> Network::zeropad_U(const std::vector<float>& U,
+HugePages::vector<float> Network::winograd4_transform_f(
+    const std::vector<float>& f, const int outputs, const int channels) {
+    // F(4x4, 3x3) Winograd filter transformation, same layout as above
+    // with 6x6 tiles.
+    auto U = HugePages::vector<float>(WINOGRAD4_TILE * outputs * channels);
+    constexpr auto g0 = 1.0f / 4.0f;
+    constexpr auto g1 = 1.0f / 6.0f;
+    constexpr auto g2 = 1.0f / 12.0f;
+    constexpr auto g3 = 1.0f / 24.0f;
+    auto G = std::array<float, WINOGRAD4_ALPHA * 3>{  g0, 0.0f, 0.0f,
+                                                     -g1,  -g1,  -g1,
+                                                     -g1,   g1,  -g1,
+                                                      g3,   g2,   g1,
+                                                      g3,  -g2,   g1,
+                                                    0.0f, 0.0f, 1.0f};
+    auto temp = std::array<float, WINOGRAD4_ALPHA * 3>{};
+
+    for (auto o = 0; o < outputs; o++) {
+        for (auto c = 0; c < channels; c++) {
+            for (auto i = 0; i < WINOGRAD4_ALPHA; i++){
+                for (auto j = 0; j < 3; j++) {
+                    auto acc = 0.0f;
+                    for (auto k = 0; k < 3; k++) {
+                        acc += G[i*3 + k] * f[o*channels*9 + c*9 + k*3 + j];
+                    }
+                    temp[i*3 + j] = acc;
+                }
+            }
+
+            for (auto xi = 0; xi < WINOGRAD4_ALPHA; xi++) {
+                for (auto nu = 0; nu < WINOGRAD4_ALPHA; nu++) {
+                    auto acc = 0.0f;
+                    for (int k = 0; k < 3; k++) {
+                        acc += temp[xi*3 + k] * G[nu*3 + k];
+                    }
+                    U[xi * (WINOGRAD4_ALPHA * outputs * channels)
+                      + nu * (outputs * channels)
+                      + c * outputs
+                      + o] = acc;
+                }
+            }
+        }
+    }
+
+    return U;
+}
+
+std::vector<float> Network::zeropad_U(const HugePages::vector<float>& U,
                                       const int outputs, const int channels,
                                       const int outputs_pad,
                                       const int channels_pad) {
@@ -189,7 +462,68 @@ std::vector<float> Network::zeropad_U(const std::vector<float>& U,
     return Upad;
 }
 
-std::pair<int, int>  Network::load_v1_network(std::ifstream& wtfile) {
+void Network::write_random_weights(std::ostream& out,
+                                   const int residual_blocks,
+                                   const int channels, const int board_size,
+                                   const std::uint64_t seed) {
+    auto rng = Random{seed};
+    const auto squares = board_size * board_size;
+    auto line = [&out](const int count, const std::function<float()>& value) {
+        for (auto i = 0; i < count; i++) {
+            out << (i ? " " : "") << value();
+        }
+        out << "\n";
+    };
+    // He initialization keeps the variance through ReLU layers
+    auto normal = [&rng, &line](const int count, const float stddev) {
+        auto dist = std::normal_distribution<float>{0.0f, stddev};
+        line(count, [&]() { return dist(rng); });
+    };
+    auto constant = [&line](const int count, const float value) {
+        line(count, [value]() { return value; });
+    };
+    // Batchnorm means near 0 and variances near 1, the convolution
+    // outputs are about unit variance already.
+    auto batchnorm = [&rng, &normal, &line](const int count) {
+        normal(count, 0.05f);
+        auto dist = std::uniform_real_distribution<float>{0.8f, 1.2f};
+        line(count, [&]() { return dist(rng); });
+    };
+
+    out << FORMAT_VERSION << "\n";
+    normal(channels * INPUT_CHANNELS * 9,
+           std::sqrt(2.0f / (INPUT_CHANNELS * 9)));
+    constant(channels, 0.0f);
+    batchnorm(channels);
+    for (auto block = 0; block < residual_blocks; block++) {
+        // The second convolution of a block is scaled down, so the sum
+        // of the residual stream grows by a bounded factor over the tower.
+        for (const auto scale : {1.0f, 1.0f / std::sqrt(float(residual_blocks))}) {
+            normal(channels * channels * 9,
+                   scale * std::sqrt(2.0f / (channels * 9)));
+            constant(channels, 0.0f);
+            batchnorm(channels);
+        }
+    }
+    // Policy head
+    normal(OUTPUTS_POLICY * channels, std::sqrt(2.0f / channels));
+    constant(OUTPUTS_POLICY, 0.0f);
+    batchnorm(OUTPUTS_POLICY);
+    normal(OUTPUTS_POLICY * squares * (squares + 1),
+           std::sqrt(1.0f / (OUTPUTS_POLICY * squares)));
+    constant(squares + 1, 0.0f);
+    // Value head
+    normal(OUTPUTS_VALUE * channels, std::sqrt(2.0f / channels));
+    constant(OUTPUTS_VALUE, 0.0f);
+    batchnorm(OUTPUTS_VALUE);
+    normal(OUTPUTS_VALUE * squares * 256,
+           std::sqrt(2.0f / (OUTPUTS_VALUE * squares)));
+    constant(256, 0.0f);
+    normal(256, std::sqrt(1.0f / 256));
+    constant(1, 0.0f);
+}
+
+std::pair<int, int>  Network::load_v1_network(std::istream& wtfile) {
     // Count size of the network
     myprintf("Detecting residual layers...");
     // We are version 1
@@ -243,62 +577,68 @@ std::pair<int, int>  Network::load_v1_network(std::ifstream& wtfile) {
         }
         if (linecount < plain_conv_wts) {
             if (linecount % 4 == 0) {
-                conv_weights.emplace_back(weights);
+                m_conv_weights.emplace_back(weights);
             } else if (linecount % 4 == 1) {
                 // Redundant in our model, but they encode the
                 // number of outputs so we have to read them in.
-                conv_biases.emplace_back(weights);
+                m_conv_biases.emplace_back(weights);
             } else if (linecount % 4 == 2) {
-                batchnorm_means.emplace_back(weights);
+                m_batchnorm_means.emplace_back(weights);
             } else if (linecount % 4 == 3) {
                 process_bn_var(weights);
-                batchnorm_stddivs.emplace_back(weights);
+                m_batchnorm_stddivs.emplace_back(weights);
             }
         } else if (linecount == plain_conv_wts) {
-            conv_pol_w = std::move(weights);
+            m_conv_pol_w = std::move(weights);
         } else if (linecount == plain_conv_wts + 1) {
-            conv_pol_b = std::move(weights);
+            m_conv_pol_b = std::move(weights);
         } else if (linecount == plain_conv_wts + 2) {
-            std::copy(begin(weights), end(weights), begin(bn_pol_w1));
+            std::copy(begin(weights), end(weights), begin(m_bn_pol_w1));
         } else if (linecount == plain_conv_wts + 3) {
             process_bn_var(weights);
-            std::copy(begin(weights), end(weights), begin(bn_pol_w2));
+            std::copy(begin(weights), end(weights), begin(m_bn_pol_w2));
         } else if (linecount == plain_conv_wts + 4) {
-            std::copy(begin(weights), end(weights), begin(ip_pol_w));
+            m_ip_pol_w = std::move(weights);
         } else if (linecount == plain_conv_wts + 5) {
-            std::copy(begin(weights), end(weights), begin(ip_pol_b));
+            m_ip_pol_b = std::move(weights);
         } else if (linecount == plain_conv_wts + 6) {
-            conv_val_w = std::move(weights);
+            m_conv_val_w = std::move(weights);
         } else if (linecount == plain_conv_wts + 7) {
-            conv_val_b = std::move(weights);
+            m_conv_val_b = std::move(weights);
         } else if (linecount == plain_conv_wts + 8) {
-            std::copy(begin(weights), end(weights), begin(bn_val_w1));
+            std::copy(begin(weights), end(weights), begin(m_bn_val_w1));
         } else if (linecount == plain_conv_wts + 9) {
             process_bn_var(weights);
-            std::copy(begin(weights), end(weights), begin(bn_val_w2));
+            std::copy(begin(weights), end(weights), begin(m_bn_val_w2));
         } else if (linecount == plain_conv_wts + 10) {
-            std::copy(begin(weights), end(weights), begin(ip1_val_w));
+            m_ip1_val_w = std::move(weights);
         } else if (linecount == plain_conv_wts + 11) {
-            std::copy(begin(weights), end(weights), begin(ip1_val_b));
+            m_ip1_val_b = std::move(weights);
         } else if (linecount == plain_conv_wts + 12) {
-            std::copy(begin(weights), end(weights), begin(ip2_val_w));
+            m_ip2_val_w = std::move(weights);
         } else if (linecount == plain_conv_wts + 13) {
-            std::copy(begin(weights), end(weights), begin(ip2_val_b));
+            m_ip2_val_b = std::move(weights);
         }
         linecount++;
     }
-    wtfile.close();
 
-    return {channels, residual_blocks};
-}
-
-std::pair<int, int> Network::load_network_file(std::string filename) {
-    auto wtfile = std::ifstream{filename};
-    if (wtfile.fail()) {
-        myprintf("Could not open weights file: %s\n", filename.c_str());
+    // The policy head has one output per point plus pass, which
+    // tells us the board size the network was trained for.
+    auto board_size = static_cast<int>(std::sqrt(m_ip_pol_b.size() - 1));
+    if (m_ip_pol_b.size() != size_t(board_size * board_size + 1)
+        || !is_supported_boardsize(board_size)
+        || board_size > BOARD_SIZE) {
+        myprintf("Unsupported board size in weights file (%d outputs).\n",
+                 static_cast<int>(m_ip_pol_b.size()));
         return {0, 0};
     }
+    myprintf("Network is for %dx%d.\n", board_size, board_size);
+    m_boardsize = board_size;
+
+    return {channels, residual_blocks};
+}
 
+std::pair<int, int> Network::load_network(std::istream& wtfile) {
     // Read format version
     auto line = std::string{};
     auto format_version = -1;
@@ -318,63 +658,125 @@ std::pair<int, int> Network::load_network_file(std::string filename) {
     return {0, 0};
 }
 
-void Network::initialize(void) {
-    // Prepare rotation table
-    for(auto s = 0; s < 8; s++) {
-        for(auto v = 0; v < BOARD_SQUARES; v++) {
-            rotate_nn_idx_table[s][v] = rotate_nn_idx(v, s);
+bool Network::initialize(const std::string& weightsfile) {
+    if (!cfg_nn_record.empty()) {
+        m_recorder = std::make_unique<EvalRecorder>(cfg_nn_record);
+        if (!m_recorder->good()) {
+            myprintf("Could not open %s.\n", cfg_nn_record.c_str());
+            return false;
+        }
+        myprintf("Recording evaluations to %s.\n", cfg_nn_record.c_str());
+    }
+
+    if (cfg_nn_backend == "synthetic") {
+        m_boardsize = BOARD_SIZE;
+        m_backend = std::make_unique<SyntheticBackend>(cfg_nn_latency);
+        m_nncache->set_size_from_playouts(cfg_max_playouts);
+        myprintf("Synthetic evaluations for %dx%d, %d us latency.\n",
+                 m_boardsize, m_boardsize, cfg_nn_latency);
+        return true;
+    } else if (cfg_nn_backend == "replay") {
+        auto replay = std::make_unique<ReplayBackend>();
+        m_boardsize = replay->load(cfg_nn_replay);
+        if (!is_supported_boardsize(m_boardsize)) {
+            return false;
         }
+        m_backend = std::move(replay);
+        m_nncache->set_size_from_playouts(cfg_max_playouts);
+        return true;
+    }
+
+    auto wtfile = std::ifstream{weightsfile};
+    if (wtfile.fail()) {
+        myprintf("Could not open weights file: %s\n", weightsfile.c_str());
+        return false;
     }
+    return initialize(wtfile);
+}
 
-    // Load network from file
+bool Network::initialize(std::istream& weights) {
     size_t channels, residual_blocks;
-    std::tie(channels, residual_blocks) = load_network_file(cfg_weightsfile);
+    std::tie(channels, residual_blocks) = load_network(weights);
     if (channels == 0) {
-        exit(EXIT_FAILURE);
+        return false;
+    }
+
+    m_nncache->set_size_from_playouts(cfg_max_playouts);
+
+    // Prepare rotation table
+    const auto board_squares = m_boardsize * m_boardsize;
+    for(auto s = 0; s < 8; s++) {
+        for(auto v = 0; v < board_squares; v++) {
+            m_rotate_nn_idx_table[s][v] = rotate_nn_idx(v, s, m_boardsize);
+        }
+    }
+
+    // Fold the batchnorm layers into the convolutions in front of them:
+    // stddiv * (conv(x) + bias - mean) = conv'(x) + bias', where the
+    // filters of output o are scaled by stddiv[o] and
+    // bias'[o] = stddiv[o] * (bias[o] - mean[o]).
+    // Only bias + ReLU (+ residual) remain after each convolution.
+    for (auto i = size_t{0}; i < m_conv_weights.size(); i++) {
+        const auto outputs = m_conv_biases[i].size();
+        const auto filter_dim = m_conv_weights[i].size() / outputs;
+        for (auto o = size_t{0}; o < outputs; o++) {
+            const auto scale = m_batchnorm_stddivs[i][o];
+            for (auto j = size_t{0}; j < filter_dim; j++) {
+                m_conv_weights[i][o * filter_dim + j] *= scale;
+            }
+            m_conv_biases[i][o] =
+                scale * (m_conv_biases[i][o] - m_batchnorm_means[i][o]);
+        }
     }
+    m_batchnorm_means.clear();
+    m_batchnorm_stddivs.clear();
 
     auto weight_index = size_t{0};
     // Input convolution
     // Winograd transform convolution weights
-    conv_weights[weight_index] =
-        winograd_transform_f(conv_weights[weight_index],
-                             channels, INPUT_CHANNELS);
+    m_conv_winograd.emplace_back(
+        winograd_transform_f(m_conv_weights[weight_index],
+                             channels, INPUT_CHANNELS));
+#ifdef USE_BLAS
+    m_conv_winograd4.emplace_back(
+        winograd4_transform_f(m_conv_weights[weight_index],
+                              channels, INPUT_CHANNELS));
+#endif
     weight_index++;
 
     // Residual block convolutions
     for (auto i = size_t{0}; i < residual_blocks * 2; i++) {
-		conv_weights[weight_index] =
-            winograd_transform_f(conv_weights[weight_index],
-                                 channels, channels);
+        m_conv_winograd.emplace_back(
+            winograd_transform_f(m_conv_weights[weight_index],
+                                 channels, channels));
+#ifdef USE_BLAS
+        m_conv_winograd4.emplace_back(
+            winograd4_transform_f(m_conv_weights[weight_index],
+                                  channels, channels));
+#endif
         weight_index++;
     }
 
     // Biases are not calculated and are typically zero but some networks might
     // still have non-zero biases.
-    // Move biases to batchnorm means to make the output match without having
-    // to separately add the biases.
-    for (auto i = size_t{0}; i < conv_biases.size(); i++) {
-        for (auto j = size_t{0}; j < batchnorm_means[i].size(); j++) {
-            batchnorm_means[i][j] -= conv_biases[i][j];
-            conv_biases[i][j] = 0.0f;
-        }
+    // Move the head biases to batchnorm means to make the output match
+    // without having to separately add the biases.
+    for (auto i = size_t{0}; i < m_bn_val_w1.size(); i++) {
+        m_bn_val_w1[i] -= m_conv_val_b[i];
+        m_conv_val_b[i] = 0.0f;
     }
 
-    for (auto i = size_t{0}; i < bn_val_w1.size(); i++) {
-        bn_val_w1[i] -= conv_val_b[i];
-        conv_val_b[i] = 0.0f;
-    }
-
-    for (auto i = size_t{0}; i < bn_pol_w1.size(); i++) {
-        bn_pol_w1[i] -= conv_pol_b[i];
-        conv_pol_b[i] = 0.0f;
+    for (auto i = size_t{0}; i < m_bn_pol_w1.size(); i++) {
+        m_bn_pol_w1[i] -= m_conv_pol_b[i];
+        m_conv_pol_b[i] = 0.0f;
     }
 
 #ifdef USE_OPENCL
     myprintf("Initializing OpenCL.\n");
-    opencl.initialize(channels);
+    m_opencl = std::make_unique<OpenCLScheduler>();
+    m_opencl->initialize(channels, m_boardsize);
 
-    for(auto & opencl_net : opencl.get_networks()) {
+    for(auto & opencl_net : m_opencl->get_networks()) {
         auto tuners = opencl_net->getOpenCL().get_sgemm_tuners();
 
         auto mwg = tuners[0];
@@ -386,39 +788,45 @@ void Network::initialize(void) {
         size_t m_ceil = ceilMultiple(ceilMultiple(channels, mwg), vwm);
         size_t k_ceil = ceilMultiple(ceilMultiple(INPUT_CHANNELS, kwg), vwm);
 
-        auto Upad = zeropad_U(conv_weights[weight_index],
+        auto Upad = zeropad_U(m_conv_winograd[weight_index],
                               channels, INPUT_CHANNELS,
                               m_ceil, k_ceil);
 
         // Winograd filter transformation changes filter size to 4x4
         opencl_net->push_input_convolution(WINOGRAD_ALPHA, INPUT_CHANNELS, channels,
-                Upad, batchnorm_means[weight_index], batchnorm_stddivs[weight_index]);
+                Upad, m_conv_biases[weight_index]);
         weight_index++;
 
         // residual blocks
         for (auto i = size_t{0}; i < residual_blocks; i++) {
-            auto Upad1 = zeropad_U(conv_weights[weight_index],
+            auto Upad1 = zeropad_U(m_conv_winograd[weight_index],
                                    channels, channels,
                                    m_ceil, m_ceil);
-            auto Upad2 = zeropad_U(conv_weights[weight_index + 1],
+            auto Upad2 = zeropad_U(m_conv_winograd[weight_index + 1],
                                    channels, channels,
                                    m_ceil, m_ceil);
             opencl_net->push_residual(WINOGRAD_ALPHA, channels, channels,
                                       Upad1,
-                                      batchnorm_means[weight_index],
-                                      batchnorm_stddivs[weight_index],
+                                      m_conv_biases[weight_index],
                                       Upad2,
-                                      batchnorm_means[weight_index + 1],
-                                      batchnorm_stddivs[weight_index + 1]);
+                                      m_conv_biases[weight_index + 1]);
             weight_index += 2;
         }
 
         // Output head convolutions
-        opencl_net->push_convolve1(channels, OUTPUTS_POLICY, conv_pol_w);
-        opencl_net->push_convolve1(channels, OUTPUTS_VALUE, conv_val_w);
+        opencl_net->push_convolve1(channels, OUTPUTS_POLICY, m_conv_pol_w);
+        opencl_net->push_convolve1(channels, OUTPUTS_VALUE, m_conv_val_w);
     }
 #endif
 #ifdef USE_BLAS
+    auto isa = CPUKernels::isa_t{};
+    if (CPUKernels::isa_from_name(cfg_cpu_kernels, isa)
+        && !CPUKernels::select_isa(isa)) {
+        myprintf("This CPU cannot run the %s kernels.\n",
+                 CPUKernels::isa_name(isa));
+    }
+    myprintf("CPU kernels: %s%s\n", CPUKernels::isa_name(CPUKernels::isa()),
+             CPUKernels::isa() == CPUKernels::detect_isa() ? "" : " (forced)");
 #ifndef __APPLE__
 #ifdef USE_OPENBLAS
     openblas_set_num_threads(1);
@@ -432,206 +840,952 @@ void Network::initialize(void) {
     myprintf("BLAS core: MKL %s\n", Version.Processor);
 #endif
 #endif
+#if defined(USE_BLAS) && !defined(USE_OPENCL)
+    if (cfg_cpu_int8) {
+        quantize_tower();
+    }
+    tune_convolutions(channels);
+    if (cfg_cpu_int8) {
+        calibrate_int8();
+    }
+    if (cfg_numa_replicas) {
+        replicate_weights();
+    }
+#else
+    // The CPU only checks the OpenCL results here, not worth tuning.
+    m_conv_plan.fill({CPUTuner::DIRECT, CPUTuner::DIRECT});
+#endif
 #endif
+    return true;
+}
+
+#ifdef USE_BLAS
+// Largest error of an F(4x4, 3x3) or half precision layer we still use,
+// relative to the largest output of the layer.
+constexpr auto CONV_MAX_ERROR = 1e-2f;
+
+void Network::tune_convolutions(const int channels) {
+    auto candidates = std::vector<CPUTuner::algorithm_t>{};
+    const auto use_builtin = cfg_cpu_sgemm != Sgemm::BLAS
+                             || !Sgemm::have_blas();
+    const auto use_blas = cfg_cpu_sgemm != Sgemm::BUILTIN
+                          && Sgemm::have_blas();
+    if (use_builtin) {
+        candidates.emplace_back(CPUTuner::WINOGRAD_BUILTIN);
+        candidates.emplace_back(CPUTuner::WINOGRAD4_BUILTIN);
+    }
+    if (use_blas) {
+        candidates.emplace_back(CPUTuner::WINOGRAD_BLAS);
+        candidates.emplace_back(CPUTuner::WINOGRAD4_BLAS);
+    }
+    candidates.emplace_back(CPUTuner::IM2COL);
+    candidates.emplace_back(CPUTuner::DIRECT);
+    // Half precision filters are only tuned against each other, so the
+    // footprint is halved whichever wins.
+    const auto half_candidates = std::vector<CPUTuner::algorithm_t>{
+        CPUTuner::WINOGRAD_HALF, CPUTuner::WINOGRAD4_HALF};
+    if (cfg_cpu_fp16) {
+        candidates = half_candidates;
+    }
+
+    // A forced algorithm skips the tuning, as long as we can run it.
+    auto forced = CPUTuner::algorithm_t{};
+    if (cfg_cpu_conv != "auto"
+        && CPUTuner::algorithm_from_name(cfg_cpu_conv, forced)) {
+        if (std::find(begin(candidates), end(candidates), forced)
+            != end(candidates)
+            || std::find(begin(half_candidates), end(half_candidates),
+                         forced) != end(half_candidates)) {
+            candidates = {forced};
+        } else {
+            myprintf("CPU convolution %s is not available, tuning.\n",
+                     cfg_cpu_conv.c_str());
+        }
+    }
+    auto is_candidate = [&candidates](const CPUTuner::algorithm_t algorithm) {
+        return std::find(begin(candidates), end(candidates), algorithm)
+               != end(candidates);
+    };
+
+    // The built-in SGEMM wants U packed, the benchmarks need it too.
+    auto pack = [channels](const std::vector<HugePages::vector<float>>& U,
+                           const int tiles, const size_t layer) {
+        const auto inputs = layer == 0 ? INPUT_CHANNELS : channels;
+        return Sgemm::pack_winograd_U(U[layer], tiles, inputs, channels);
+    };
+    for (auto i = size_t{0}; i < m_conv_winograd.size(); i++) {
+        if (is_candidate(CPUTuner::WINOGRAD_BUILTIN)) {
+            m_conv_winograd_packed.emplace_back(
+                pack(m_conv_winograd, WINOGRAD_TILE, i));
+        }
+        if (is_candidate(CPUTuner::WINOGRAD4_BUILTIN)) {
+            m_conv_winograd4_packed.emplace_back(
+                pack(m_conv_winograd4, WINOGRAD4_TILE, i));
+        }
+        if (is_candidate(CPUTuner::WINOGRAD_HALF)) {
+            m_conv_winograd_half.emplace_back(
+                Sgemm::to_half(pack(m_conv_winograd, WINOGRAD_TILE, i)));
+        }
+        if (is_candidate(CPUTuner::WINOGRAD4_HALF)) {
+            m_conv_winograd4_half.emplace_back(
+                Sgemm::to_half(pack(m_conv_winograd4, WINOGRAD4_TILE, i)));
+        }
+    }
+
+    // F(4x4, 3x3) needs fewer multiplies but its transforms have larger
+    // constants, and half precision filters keep only 11 bits. Check
+    // them against the direct convolution before use. The built-in and
+    // BLAS F(4x4, 3x3) only differ in the order of the sums, so one
+    // check covers both.
+    const auto approximations =
+        std::vector<std::vector<CPUTuner::algorithm_t>>{
+            {CPUTuner::WINOGRAD4_BUILTIN, CPUTuner::WINOGRAD4_BLAS},
+            {CPUTuner::WINOGRAD_HALF},
+            {CPUTuner::WINOGRAD4_HALF}};
+    for (const auto& variants : approximations) {
+        const auto checked = std::find_if(begin(variants), end(variants),
+                                          is_candidate);
+        if (checked == end(variants)) {
+            continue;
+        }
+        auto max_error = 0.0f;
+        for (auto layer = size_t{0};
+             layer < std::min(m_conv_biases.size(), size_t{2}); layer++) {
+            auto error = 0.0f;
+            switch (m_boardsize) {
+            case 9:
+                error = convolve3_error<9>(*checked, layer);
+                break;
+            case 13:
+                error = convolve3_error<13>(*checked, layer);
+                break;
+            default:
+                error = convolve3_error<BOARD_SIZE>(*checked, layer);
+                break;
+            }
+            max_error = std::max(max_error, error);
+        }
+        myprintf("%s max relative error: %.3e\n",
+                 CPUTuner::algorithm_name(*checked), max_error);
+        if (max_error > CONV_MAX_ERROR && candidates.size() > 1) {
+            myprintf("Too large, not using it.\n");
+            candidates.erase(
+                std::remove_if(begin(candidates), end(candidates),
+                               [&variants](const CPUTuner::algorithm_t a) {
+                                   return std::find(begin(variants),
+                                                    end(variants), a)
+                                          != end(variants);
+                               }),
+                end(candidates));
+        }
+    }
+
+    // The convolutions run on the NN threads.
+    auto tuner = CPUTuner{cfg_nn_threads};
+    auto tune = [&](const size_t layer, const int batch_size) {
+        auto benchmark = [this, layer, batch_size](
+                             CPUTuner::algorithm_t algorithm) {
+            switch (m_boardsize) {
+            case 9:
+                return time_convolve3<9>(algorithm, layer, batch_size);
+            case 13:
+                return time_convolve3<13>(algorithm, layer, batch_size);
+            default:
+                return time_convolve3<BOARD_SIZE>(algorithm, layer,
+                                                  batch_size);
+            }
+        };
+        const auto inputs = layer == 0 ? INPUT_CHANNELS : channels;
+        return tuner.load_conv_plan(inputs, channels, m_boardsize,
+                                    batch_size, candidates, benchmark);
+    };
+    // Batches are only evaluated for the AVERAGE ensemble.
+    const auto layers = m_conv_biases.size() > 1 ? 2 : 1;
+    for (auto kind = 0; kind < 2; kind++) {
+        const auto layer = std::min(kind, layers - 1);
+        if (candidates.size() == 1) {
+            m_conv_plan[kind] = {candidates.front(), candidates.front()};
+        } else {
+            m_conv_plan[kind][0] = tune(layer, 1);
+            m_conv_plan[kind][1] = cfg_root_average
+                ? tune(layer, 8) : m_conv_plan[kind][0];
+        }
+        myprintf("CPU %s convolutions: %s, batched: %s\n",
+                 kind == 0 ? "input" : "residual",
+                 CPUTuner::algorithm_name(m_conv_plan[kind][0]),
+                 CPUTuner::algorithm_name(m_conv_plan[kind][1]));
+    }
+
+    // Only keep the filters the plan uses.
+    auto uses = [this](std::initializer_list<CPUTuner::algorithm_t> algos) {
+        for (const auto& kind : m_conv_plan) {
+            for (const auto algorithm : kind) {
+                for (const auto a : algos) {
+                    if (algorithm == a) {
+                        return true;
+                    }
+                }
+            }
+        }
+        return false;
+    };
+    auto release = [](auto& layers) {
+        for (auto& weights : layers) {
+            std::decay_t<decltype(weights)>().swap(weights);
+        }
+    };
+    if (uses({CPUTuner::WINOGRAD_BUILTIN, CPUTuner::WINOGRAD4_BUILTIN,
+              CPUTuner::WINOGRAD_HALF, CPUTuner::WINOGRAD4_HALF})) {
+        myprintf("Winograd SGEMM: built-in, %s kernel.\n",
+                 Sgemm::kernel_name());
+    }
+    if (!uses({CPUTuner::WINOGRAD_BUILTIN})) {
+        release(m_conv_winograd_packed);
+    }
+    if (!uses({CPUTuner::WINOGRAD4_BUILTIN})) {
+        release(m_conv_winograd4_packed);
+    }
+    if (!uses({CPUTuner::WINOGRAD_BLAS})) {
+        release(m_conv_winograd);
+    }
+    if (!uses({CPUTuner::WINOGRAD4_BLAS})) {
+        release(m_conv_winograd4);
+    }
+    if (!uses({CPUTuner::WINOGRAD_HALF})) {
+        release(m_conv_winograd_half);
+    }
+    if (!uses({CPUTuner::WINOGRAD4_HALF})) {
+        release(m_conv_winograd4_half);
+    }
+    if (!uses({CPUTuner::IM2COL, CPUTuner::DIRECT})) {
+        release(m_conv_weights);
+    }
+}
+
+CPUTuner::algorithm_t Network::conv_algorithm(const size_t layer,
+                                              const int batch_size) const {
+    return m_conv_plan[layer == 0 ? 0 : 1][batch_size == 1 ? 0 : 1];
+}
+
+void Network::quantize_tower() {
+    for (auto i = size_t{1}; i < m_conv_weights.size(); i++) {
+        const auto outputs = m_conv_biases[i].size();
+        m_conv_int8.emplace_back(
+            Int8::quantize_conv3(m_conv_weights[i], outputs, outputs));
+    }
+}
+
+std::vector<GameState> Network::sample_positions(
+    const int count, const std::uint64_t seed) const {
+    // Positions from random games, from the opening to most of a game in.
+    const auto board_squares = m_boardsize * m_boardsize;
+    auto rng = Random{seed};
+    auto positions = std::vector<GameState>{};
+    auto state = GameState{};
+    for (auto i = 0; i < count; i++) {
+        state.init_game(m_boardsize, 7.5f);
+        const auto moves = rng.randuint64(board_squares * 2 / 3);
+        for (auto m = size_t{0}; m < moves; m++) {
+            // A few random points, pass when none of them is legal
+            auto vertex = int{FastBoard::PASS};
+            for (auto tries = 0; tries < 8 && vertex == FastBoard::PASS;
+                 tries++) {
+                const auto idx = static_cast<int>(rng.randuint64(board_squares));
+                const auto candidate = state.board.get_vertex(
+                    idx % m_boardsize, idx / m_boardsize);
+                if (state.is_move_legal(state.get_to_move(), candidate)) {
+                    vertex = candidate;
+                }
+            }
+            state.play_move(vertex);
+        }
+        positions.emplace_back(state);
+    }
+    return positions;
+}
+
+void Network::calibrate_int8() {
+    constexpr auto CALIBRATION_POSITIONS = 64;
+    constexpr auto REPORT_POSITIONS = 100;
+
+    // Largest input of every tower layer over all symmetries of the
+    // sample, so the quantized activations never clip on it.
+    m_int8_calibration.assign(m_conv_int8.size(), 0.0f);
+    const auto all_symmetries = std::vector<int>{0, 1, 2, 3, 4, 5, 6, 7};
+    for (const auto& state : sample_positions(CALIBRATION_POSITIONS, 1)) {
+        evaluate(&state, all_symmetries);
+    }
+    for (auto i = size_t{0}; i < m_conv_int8.size(); i++) {
+        m_conv_int8[i].input_scale = Int8::input_scale(m_int8_calibration[i]);
+    }
+    m_int8_calibration.clear();
+
+    // Compare with the FP32 tower on other positions.
+    auto agree = 0;
+    auto value_se = 0.0;
+    for (const auto& state : sample_positions(REPORT_POSITIONS, 2)) {
+        auto best_move = [](const Netresult& result) {
+            return std::max_element(begin(result.first), end(result.first))
+                ->second;
+        };
+        m_use_int8 = false;
+        const auto ref = evaluate(&state, {0});
+        m_use_int8 = true;
+        const auto result = evaluate(&state, {0});
+        if (best_move(result) == best_move(ref)) {
+            agree++;
+        }
+        value_se += (result.second - ref.second) * (result.second - ref.second);
+    }
+    myprintf("INT8 residual tower, %s kernel.\n", Int8::kernel_name());
+    myprintf("INT8 vs FP32 over %d positions: policy top-1 agreement "
+             "%.1f%%, value MSE %.3e\n", REPORT_POSITIONS,
+             100.0 * agree / REPORT_POSITIONS, value_se / REPORT_POSITIONS);
 }
 
+void Network::copy_weights(const Network& other) {
+    // What forward_cpu reads, the fully connected layers of the heads
+    // stay with the primary.
+    m_primary = other.m_primary;
+    m_boardsize = other.m_boardsize;
+    m_conv_weights = other.m_conv_weights;
+    m_conv_biases = other.m_conv_biases;
+    m_conv_winograd = other.m_conv_winograd;
+    m_conv_winograd_packed = other.m_conv_winograd_packed;
+    m_conv_winograd4 = other.m_conv_winograd4;
+    m_conv_winograd4_packed = other.m_conv_winograd4_packed;
+    m_conv_winograd_half = other.m_conv_winograd_half;
+    m_conv_winograd4_half = other.m_conv_winograd4_half;
+    m_conv_pol_w = other.m_conv_pol_w;
+    m_conv_pol_b = other.m_conv_pol_b;
+    m_conv_val_w = other.m_conv_val_w;
+    m_conv_val_b = other.m_conv_val_b;
+    m_conv_int8 = other.m_conv_int8;
+    m_use_int8 = other.m_use_int8;
+    m_conv_plan = other.m_conv_plan;
+}
+
+void Network::replicate_weights() {
+    const auto& nodes = SMP::get_numa_nodes();
+    if (nodes.size() < 2) {
+        myprintf("One NUMA node, the weights are not replicated.\n");
+        return;
+    }
+    m_replicas.resize(nodes.size());
+    for (auto node = size_t{0}; node < nodes.size(); node++) {
+        // Allocated and written by a thread on the node, so the pages
+        // are first touched there.
+        std::thread([this, node] {
+            SMP::pin_to_node(static_cast<int>(node));
+            auto replica = std::make_unique<Network>();
+            replica->copy_weights(*this);
+            m_replicas[node] = std::move(replica);
+        }).join();
+
+        // Where the first page of every array really is
+        const auto& replica = *m_replicas[node];
+        auto bytes = size_t{0};
+        auto local = 0;
+        auto sampled = 0;
+        auto count = [&](const void* data, const size_t size) {
+            bytes += size;
+            if (size > 0) {
+                sampled++;
+                local += SMP::node_of_address(data) == nodes[node].id;
+            }
+        };
+        for (auto i = size_t{0}; i < replica.m_conv_weights.size(); i++) {
+            count(replica.m_conv_weights[i].data(),
+                  replica.m_conv_weights[i].size() * sizeof(float));
+        }
+        for (const auto layers : {&replica.m_conv_winograd,
+                                  &replica.m_conv_winograd_packed,
+                                  &replica.m_conv_winograd4,
+                                  &replica.m_conv_winograd4_packed}) {
+            for (const auto& layer : *layers) {
+                count(layer.data(), layer.size() * sizeof(float));
+            }
+        }
+        for (const auto layers : {&replica.m_conv_winograd_half,
+                                  &replica.m_conv_winograd4_half}) {
+            for (const auto& layer : *layers) {
+                count(layer.data(), layer.size() * sizeof(Sgemm::half_t));
+            }
+        }
+        for (const auto& conv : replica.m_conv_int8) {
+            count(conv.weights.data(), conv.weights.size());
+        }
+        myprintf("NUMA node %d: weight replica of %.1f MiB, %d of %d "
+                 "arrays on the node.\n", nodes[node].id,
+                 bytes / (1024.0 * 1024.0), local, sampled);
+    }
+}
+
+Network& Network::local_replica() {
+    const auto node = SMP::current_node();
+    if (node >= 0 && static_cast<size_t>(node) < m_replicas.size()) {
+        return *m_replicas[node];
+    }
+    return *this;
+}
+#endif
+
 #ifdef USE_BLAS
+template <int BoardSize>
 void Network::winograd_transform_in(const std::vector<float>& in,
                                     std::vector<float>& V,
-                                    const int C) {
-    constexpr auto W = BOARD_SIZE;
-    constexpr auto H = BOARD_SIZE;
+                                    const int C, const int batch_size,
+                                    const int c_begin, const int c_end) {
+    constexpr auto W = BoardSize;
+    constexpr auto H = BoardSize;
     constexpr auto wtiles = (W + 1) / 2;
     constexpr auto P = wtiles * wtiles;
+    // Tiles of all positions in the batch are laid out side by side
+    const auto PB = P * batch_size;
+
+    CPUKernels::dispatch([&]() KERNEL_INLINE {
+        for (auto n = 0; n < batch_size; n++) {
+            const auto in_offset = n * C * (W*H);
+            for (auto ch = c_begin; ch < c_end; ch++) {
+                for (auto block_y = 0; block_y < wtiles; block_y++) {
+                    for (auto block_x = 0; block_x < wtiles; block_x++) {
+
+                        // Tiles overlap by 2
+                        const auto yin = 2 * block_y - 1;
+                        const auto xin = 2 * block_x - 1;
+
+                        // Cache input tile and handle zero padding
+                        using WinogradTile =
+                            std::array<std::array<float, WINOGRAD_ALPHA>, WINOGRAD_ALPHA>;
+                        WinogradTile x;
+
+                        for (auto i = 0; i < WINOGRAD_ALPHA; i++) {
+                            for (auto j = 0; j < WINOGRAD_ALPHA; j++) {
+                                if ((yin + i) >= 0 && (xin + j) >= 0
+                                    && (yin + i) < H && (xin + j) < W) {
+                                    x[i][j] = in[in_offset + ch*(W*H) + (yin+i)*W + (xin+j)];
+                                } else {
+                                    x[i][j] = 0.0f;
+                                }
+                            }
+                        }
 
-    for (auto ch = 0; ch < C; ch++) {
-        for (auto block_y = 0; block_y < wtiles; block_y++) {
-            for (auto block_x = 0; block_x < wtiles; block_x++) {
-
-                // Tiles overlap by 2
-                const auto yin = 2 * block_y - 1;
-                const auto xin = 2 * block_x - 1;
-
-                // Cache input tile and handle zero padding
-                using WinogradTile =
-                    std::array<std::array<float, WINOGRAD_ALPHA>, WINOGRAD_ALPHA>;
-                WinogradTile x;
-
-                for (auto i = 0; i < WINOGRAD_ALPHA; i++) {
-                    for (auto j = 0; j < WINOGRAD_ALPHA; j++) {
-                        if ((yin + i) >= 0 && (xin + j) >= 0
-                            && (yin + i) < H && (xin + j) < W) {
-                            x[i][j] = in[ch*(W*H) + (yin+i)*W + (xin+j)];
-                        } else {
-                            x[i][j] = 0.0f;
+                        const auto offset = ch*PB + n*P + block_y*wtiles + block_x;
+
+                        // Calculates transpose(B).x.B
+                        // B = [[ 1.0,  0.0,  0.0,  0.0],
+                        //      [ 0.0,  1.0, -1.0,  1.0],
+                        //      [-1.0,  1.0,  1.0,  0.0],
+                        //      [ 0.0,  0.0,  0.0, -1.0]]
+
+                        WinogradTile T1, T2;
+
+                        // Whole rows at a time, so they vectorize
+                        for (auto j = 0; j < WINOGRAD_ALPHA; j++) {
+                            T1[0][j] = x[0][j] - x[2][j];
+                            T1[1][j] = x[1][j] + x[2][j];
+                            T1[2][j] = x[2][j] - x[1][j];
+                            T1[3][j] = x[1][j] - x[3][j];
+                        }
+                        for (auto i = 0; i < WINOGRAD_ALPHA; i++) {
+                            T2[i][0] = T1[i][0] - T1[i][2];
+                            T2[i][1] = T1[i][1] + T1[i][2];
+                            T2[i][2] = T1[i][2] - T1[i][1];
+                            T2[i][3] = T1[i][1] - T1[i][3];
                         }
-                    }
-                }
 
-                const auto offset = ch*P + block_y*wtiles + block_x;
-
-                // Calculates transpose(B).x.B
-                // B = [[ 1.0,  0.0,  0.0,  0.0],
-                //      [ 0.0,  1.0, -1.0,  1.0],
-                //      [-1.0,  1.0,  1.0,  0.0],
-                //      [ 0.0,  0.0,  0.0, -1.0]]
-
-                WinogradTile T1, T2;
-
-                T1[0][0] = x[0][0] - x[2][0];
-                T1[0][1] = x[0][1] - x[2][1];
-                T1[0][2] = x[0][2] - x[2][2];
-                T1[0][3] = x[0][3] - x[2][3];
-                T1[1][0] = x[1][0] + x[2][0];
-                T1[1][1] = x[1][1] + x[2][1];
-                T1[1][2] = x[1][2] + x[2][2];
-                T1[1][3] = x[1][3] + x[2][3];
-                T1[2][0] = x[2][0] - x[1][0];
-                T1[2][1] = x[2][1] - x[1][1];
-                T1[2][2] = x[2][2] - x[1][2];
-                T1[2][3] = x[2][3] - x[1][3];
-                T1[3][0] = x[1][0] - x[3][0];
-                T1[3][1] = x[1][1] - x[3][1];
-                T1[3][2] = x[1][2] - x[3][2];
-                T1[3][3] = x[1][3] - x[3][3];
-
-                T2[0][0] = T1[0][0] - T1[0][2];
-                T2[0][1] = T1[0][1] + T1[0][2];
-                T2[0][2] = T1[0][2] - T1[0][1];
-                T2[0][3] = T1[0][1] - T1[0][3];
-                T2[1][0] = T1[1][0] - T1[1][2];
-                T2[1][1] = T1[1][1] + T1[1][2];
-                T2[1][2] = T1[1][2] - T1[1][1];
-                T2[1][3] = T1[1][1] - T1[1][3];
-                T2[2][0] = T1[2][0] - T1[2][2];
-                T2[2][1] = T1[2][1] + T1[2][2];
-                T2[2][2] = T1[2][2] - T1[2][1];
-                T2[2][3] = T1[2][1] - T1[2][3];
-                T2[3][0] = T1[3][0] - T1[3][2];
-                T2[3][1] = T1[3][1] + T1[3][2];
-                T2[3][2] = T1[3][2] - T1[3][1];
-                T2[3][3] = T1[3][1] - T1[3][3];
-
-                for (auto i = 0; i < WINOGRAD_ALPHA; i++) {
-                    for (auto j = 0; j < WINOGRAD_ALPHA; j++) {
-                        V[(i*WINOGRAD_ALPHA + j)*C*P + offset] = T2[i][j];
+                        for (auto i = 0; i < WINOGRAD_ALPHA; i++) {
+                            for (auto j = 0; j < WINOGRAD_ALPHA; j++) {
+                                V[(i*WINOGRAD_ALPHA + j)*C*PB + offset] = T2[i][j];
+                            }
+                        }
                     }
                 }
             }
         }
-    }
+    });
 }
 
-void Network::winograd_sgemm(const std::vector<float>& U,
-                             std::vector<float>& V,
-                             std::vector<float>& M,
-                             const int C, const int K) {
-    constexpr auto P = (BOARD_SIZE + 1) * (BOARD_SIZE + 1) / WINOGRAD_ALPHA;
+void Network::winograd_sgemm(const Sgemm::backend_t backend,
+                             const HugePages::vector<float>& U,
+                             const std::vector<float>& V,
+                             std::vector<float>& M, const int tiles,
+                             const int C, const int K, const int P,
+                             const int first_tile, const int last_tile) {
+    if (backend == Sgemm::BUILTIN) {
+        Sgemm::winograd_sgemm(U, V.data(), M.data(), tiles, C, K, P,
+                              first_tile, last_tile);
+        return;
+    }
 
-    for (auto b = 0; b < WINOGRAD_TILE; b++) {
+    for (auto b = first_tile; b < last_tile; b++) {
         auto offset_u = b * K * C;
         auto offset_v = b * C * P;
         auto offset_m = b * K * P;
 
-        cblas_sgemm(CblasRowMajor, CblasTrans, CblasNoTrans,
-                    K, P, C,
-                    1.0f,
-                    &U[offset_u], K,
-                    &V[offset_v], P,
-                    0.0f,
-                    &M[offset_m], P);
+        Sgemm::sgemm(true, K, P, C,
+                     &U[offset_u], K,
+                     &V[offset_v], P,
+                     &M[offset_m], P);
     }
 }
 
+void Network::winograd_sgemm(const Sgemm::backend_t backend,
+                             const HugePages::vector<Sgemm::half_t>& U,
+                             const std::vector<float>& V,
+                             std::vector<float>& M, const int tiles,
+                             const int C, const int K, const int P,
+                             const int first_tile, const int last_tile) {
+    // Only the built-in SGEMM unpacks half precision filters
+    assert(backend == Sgemm::BUILTIN);
+    (void)backend;
+    Sgemm::winograd_sgemm(U, V.data(), M.data(), tiles, C, K, P,
+                          first_tile, last_tile);
+}
+
+template <int BoardSize>
 void Network::winograd_transform_out(const std::vector<float>& M,
                                      std::vector<float>& Y,
-                                     const int K) {
-    constexpr auto W = BOARD_SIZE;
-    constexpr auto H = BOARD_SIZE;
+                                     const int K, const int batch_size,
+                                     const std::vector<float>& biases,
+                                     const float* residual,
+                                     const int k_begin, const int k_end) {
+    constexpr auto W = BoardSize;
+    constexpr auto H = BoardSize;
     constexpr auto wtiles = (W + 1) / 2;
     constexpr auto P = wtiles * wtiles;
+    const auto PB = P * batch_size;
+
+    CPUKernels::dispatch([&]() KERNEL_INLINE {
+        for (auto n = 0; n < batch_size; n++) {
+            const auto out_offset = n * K * (W*H);
+            for (auto k = k_begin; k < k_end; k++) {
+                for (auto block_x = 0; block_x < wtiles; block_x++) {
+                    for (auto block_y = 0; block_y < wtiles; block_y++) {
+
+                        const auto x = 2 * block_x;
+                        const auto y = 2 * block_y;
+
+                        const auto b = n * P + block_y * wtiles + block_x;
+                        std::array<float, WINOGRAD_TILE> temp_m;
+                        for (auto xi = 0; xi < WINOGRAD_ALPHA; xi++) {
+                            for (auto nu = 0; nu < WINOGRAD_ALPHA; nu++) {
+                                temp_m[xi*WINOGRAD_ALPHA + nu] =
+                                    M[xi*(WINOGRAD_ALPHA*K*PB) + nu*(K*PB)+ k*PB + b];
+                            }
+                        }
 
-    for (auto k = 0; k < K; k++) {
-        for (auto block_x = 0; block_x < wtiles; block_x++) {
-            for (auto block_y = 0; block_y < wtiles; block_y++) {
+                        // Calculates transpose(A).temp_m.A
+                        //    A = [1.0,  0.0],
+                        //        [1.0,  1.0],
+                        //        [1.0, -1.0],
+                        //        [0.0, -1.0]]
+
+                        auto o11 =
+                            temp_m[0*4 + 0] + temp_m[0*4 + 1] + temp_m[0*4 + 2] +
+                            temp_m[1*4 + 0] + temp_m[1*4 + 1] + temp_m[1*4 + 2] +
+                            temp_m[2*4 + 0] + temp_m[2*4 + 1] + temp_m[2*4 + 2];
+
+                        auto o12 =
+                            temp_m[0*4 + 1] - temp_m[0*4 + 2] - temp_m[0*4 + 3] +
+                            temp_m[1*4 + 1] - temp_m[1*4 + 2] - temp_m[1*4 + 3] +
+                            temp_m[2*4 + 1] - temp_m[2*4 + 2] - temp_m[2*4 + 3];
+
+                        auto o21 =
+                            temp_m[1*4 + 0] + temp_m[1*4 + 1] + temp_m[1*4 + 2] -
+                            temp_m[2*4 + 0] - temp_m[2*4 + 1] - temp_m[2*4 + 2] -
+                            temp_m[3*4 + 0] - temp_m[3*4 + 1] - temp_m[3*4 + 2];
+
+                        auto o22 =
+                            temp_m[1*4 + 1] - temp_m[1*4 + 2] - temp_m[1*4 + 3] -
+                            temp_m[2*4 + 1] + temp_m[2*4 + 2] + temp_m[2*4 + 3] -
+                            temp_m[3*4 + 1] + temp_m[3*4 + 2] + temp_m[3*4 + 3];
+
+                        // Bias, residual add and ReLU fused into the output
+                        const auto bias = biases[k];
+                        const auto y_offset = out_offset + k*(H*W);
+                        const auto store = [&](const int idx, const float val) {
+                            auto o = val + bias;
+                            if (residual) {
+                                o += residual[y_offset + idx];
+                            }
+                            Y[y_offset + idx] = o > 0.0f ? o : 0.0f;
+                        };
+                        store((y)*W + (x), o11);
+                        if (x + 1 < W) {
+                            store((y)*W + (x+1), o12);
+                        }
+                        if (y + 1 < H) {
+                            store((y+1)*W + (x), o21);
+                            if (x + 1 < W) {
+                                store((y+1)*W + (x+1), o22);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    });
+}
 
-                const auto x = 2 * block_x;
-                const auto y = 2 * block_y;
+template <int BoardSize, typename T>
+void Network::winograd_convolve3(const Sgemm::backend_t backend,
+                                 const int outputs,
+                                 const std::vector<float>& input,
+                                 const HugePages::vector<T>& U,
+                                 const std::vector<float>& biases,
+                                 std::vector<float>& V,
+                                 std::vector<float>& M,
+                                 std::vector<float>& output,
+                                 const int batch_size,
+                                 const float* residual,
+                                 const int threads) {
+
+    constexpr auto P_one = (BoardSize + 1) * (BoardSize + 1) / WINOGRAD_ALPHA;
+    const auto input_channels = backend == Sgemm::BUILTIN
+        ? Sgemm::packed_channels(U.size(), WINOGRAD_TILE, outputs)
+        : static_cast<int>(U.size() / (outputs * WINOGRAD_TILE));
+
+    // Every stage splits into independent ranges: input channels, the
+    // tiles of the transformed domain and output channels.
+    {
+        ForwardProfile::Scope scope("input transform");
+        parallel_for(nn_thread_pool, threads, input_channels,
+                     [&](const int begin, const int end) {
+            winograd_transform_in<BoardSize>(input, V, input_channels,
+                                             batch_size, begin, end);
+        });
+    }
+    {
+        ForwardProfile::Scope scope("gemm");
+        parallel_for(nn_thread_pool, threads, WINOGRAD_TILE,
+                     [&](const int begin, const int end) {
+            winograd_sgemm(backend, U, V, M, WINOGRAD_TILE, input_channels,
+                           outputs, P_one * batch_size, begin, end);
+        });
+    }
+    {
+        ForwardProfile::Scope scope("output transform");
+        parallel_for(nn_thread_pool, threads, outputs,
+                     [&](const int begin, const int end) {
+            winograd_transform_out<BoardSize>(M, output, outputs, batch_size,
+                                              biases, residual, begin, end);
+        });
+    }
+}
+
+template <int BoardSize>
+void Network::winograd4_transform_in(const std::vector<float>& in,
+                                     std::vector<float>& V,
+                                     const int C, const int batch_size,
+                                     const int c_begin, const int c_end) {
+    constexpr auto W = BoardSize;
+    constexpr auto H = BoardSize;
+    constexpr auto wtiles = (W + 3) / 4;
+    constexpr auto P = wtiles * wtiles;
+    const auto PB = P * batch_size;
+
+    // Calculates transpose(B).x.B, one dimension at a time
+    // transpose(B) = [[4.0,  0.0, -5.0,  0.0, 1.0, 0.0],
+    //                 [0.0, -4.0, -4.0,  1.0, 1.0, 0.0],
+    //                 [0.0,  4.0, -4.0, -1.0, 1.0, 0.0],
+    //                 [0.0, -2.0, -1.0,  2.0, 1.0, 0.0],
+    //                 [0.0,  2.0, -1.0, -2.0, 1.0, 0.0],
+    //                 [0.0,  4.0,  0.0, -5.0, 0.0, 1.0]]
+    const auto transform = [](const float* d, const int stride, float* t,
+                              const int t_stride) {
+        const auto d0 = d[0 * stride];
+        const auto d1 = d[1 * stride];
+        const auto d2 = d[2 * stride];
+        const auto d3 = d[3 * stride];
+        const auto d4 = d[4 * stride];
+        const auto d5 = d[5 * stride];
+        t[0 * t_stride] = 4.0f * d0 - 5.0f * d2 + d4;
+        t[1 * t_stride] = -4.0f * (d1 + d2) + d3 + d4;
+        t[2 * t_stride] = 4.0f * (d1 - d2) - d3 + d4;
+        t[3 * t_stride] = 2.0f * (d3 - d1) - d2 + d4;
+        t[4 * t_stride] = 2.0f * (d1 - d3) - d2 + d4;
+        t[5 * t_stride] = 4.0f * d1 - 5.0f * d3 + d5;
+    };
+
+    CPUKernels::dispatch([&]() KERNEL_INLINE {
+        for (auto n = 0; n < batch_size; n++) {
+            const auto in_offset = n * C * (W*H);
+            for (auto ch = c_begin; ch < c_end; ch++) {
+                for (auto block_y = 0; block_y < wtiles; block_y++) {
+                    for (auto block_x = 0; block_x < wtiles; block_x++) {
+
+                        // Tiles overlap by 2
+                        const auto yin = 4 * block_y - 1;
+                        const auto xin = 4 * block_x - 1;
+
+                        // Cache input tile and handle zero padding
+                        std::array<float, WINOGRAD4_TILE> x;
+                        for (auto i = 0; i < WINOGRAD4_ALPHA; i++) {
+                            for (auto j = 0; j < WINOGRAD4_ALPHA; j++) {
+                                if ((yin + i) >= 0 && (xin + j) >= 0
+                                    && (yin + i) < H && (xin + j) < W) {
+                                    x[i*WINOGRAD4_ALPHA + j] =
+                                        in[in_offset + ch*(W*H) + (yin+i)*W + (xin+j)];
+                                } else {
+                                    x[i*WINOGRAD4_ALPHA + j] = 0.0f;
+                                }
+                            }
+                        }
 
-                const auto b = block_y * wtiles + block_x;
-                std::array<float, WINOGRAD_TILE> temp_m;
-                for (auto xi = 0; xi < WINOGRAD_ALPHA; xi++) {
-                    for (auto nu = 0; nu < WINOGRAD_ALPHA; nu++) {
-                        temp_m[xi*WINOGRAD_ALPHA + nu] =
-                            M[xi*(WINOGRAD_ALPHA*K*P) + nu*(K*P)+ k*P + b];
+                        std::array<float, WINOGRAD4_TILE> T1, T2;
+                        for (auto j = 0; j < WINOGRAD4_ALPHA; j++) {
+                            transform(&x[j], WINOGRAD4_ALPHA,
+                                      &T1[j], WINOGRAD4_ALPHA);
+                        }
+                        for (auto i = 0; i < WINOGRAD4_ALPHA; i++) {
+                            transform(&T1[i*WINOGRAD4_ALPHA], 1,
+                                      &T2[i*WINOGRAD4_ALPHA], 1);
+                        }
+
+                        const auto offset = ch*PB + n*P + block_y*wtiles + block_x;
+                        for (auto i = 0; i < WINOGRAD4_TILE; i++) {
+                            V[i*C*PB + offset] = T2[i];
+                        }
                     }
                 }
+            }
+        }
+    });
+}
 
-                // Calculates transpose(A).temp_m.A
-                //    A = [1.0,  0.0],
-                //        [1.0,  1.0],
-                //        [1.0, -1.0],
-                //        [0.0, -1.0]]
-
-                auto o11 =
-                    temp_m[0*4 + 0] + temp_m[0*4 + 1] + temp_m[0*4 + 2] +
-                    temp_m[1*4 + 0] + temp_m[1*4 + 1] + temp_m[1*4 + 2] +
-                    temp_m[2*4 + 0] + temp_m[2*4 + 1] + temp_m[2*4 + 2];
-
-                auto o12 =
-                    temp_m[0*4 + 1] - temp_m[0*4 + 2] - temp_m[0*4 + 3] +
-                    temp_m[1*4 + 1] - temp_m[1*4 + 2] - temp_m[1*4 + 3] +
-                    temp_m[2*4 + 1] - temp_m[2*4 + 2] - temp_m[2*4 + 3];
-
-                auto o21 =
-                    temp_m[1*4 + 0] + temp_m[1*4 + 1] + temp_m[1*4 + 2] -
-                    temp_m[2*4 + 0] - temp_m[2*4 + 1] - temp_m[2*4 + 2] -
-                    temp_m[3*4 + 0] - temp_m[3*4 + 1] - temp_m[3*4 + 2];
-
-                auto o22 =
-                    temp_m[1*4 + 1] - temp_m[1*4 + 2] - temp_m[1*4 + 3] -
-                    temp_m[2*4 + 1] + temp_m[2*4 + 2] + temp_m[2*4 + 3] -
-                    temp_m[3*4 + 1] + temp_m[3*4 + 2] + temp_m[3*4 + 3];
-
-                Y[k*(H*W) + (y)*W + (x)] = o11;
-                if (x + 1 < W) {
-                    Y[k*(H*W) + (y)*W + (x+1)] = o12;
-                }
-                if (y + 1 < H) {
-                    Y[k*(H*W) + (y+1)*W + (x)] = o21;
-                    if (x + 1 < W) {
-                        Y[k*(H*W) + (y+1)*W + (x+1)] = o22;
+template <int BoardSize>
+void Network::winograd4_transform_out(const std::vector<float>& M,
+                                      std::vector<float>& Y,
+                                      const int K, const int batch_size,
+                                      const std::vector<float>& biases,
+                                      const float* residual,
+                                      const int k_begin, const int k_end) {
+    constexpr auto W = BoardSize;
+    constexpr auto H = BoardSize;
+    constexpr auto wtiles = (W + 3) / 4;
+    constexpr auto P = wtiles * wtiles;
+    const auto PB = P * batch_size;
+
+    // Calculates transpose(A).temp_m.A, one dimension at a time
+    // transpose(A) = [[1.0, 1.0,  1.0, 1.0,  1.0, 0.0],
+    //                 [0.0, 1.0, -1.0, 2.0, -2.0, 0.0],
+    //                 [0.0, 1.0,  1.0, 4.0,  4.0, 0.0],
+    //                 [0.0, 1.0, -1.0, 8.0, -8.0, 1.0]]
+    const auto transform = [](const float* m, const int stride, float* t,
+                              const int t_stride) {
+        const auto m0 = m[0 * stride];
+        const auto m1 = m[1 * stride];
+        const auto m2 = m[2 * stride];
+        const auto m3 = m[3 * stride];
+        const auto m4 = m[4 * stride];
+        const auto m5 = m[5 * stride];
+        const auto a12 = m1 + m2;
+        const auto s12 = m1 - m2;
+        const auto a34 = m3 + m4;
+        const auto s34 = m3 - m4;
+        t[0 * t_stride] = m0 + a12 + a34;
+        t[1 * t_stride] = s12 + 2.0f * s34;
+        t[2 * t_stride] = a12 + 4.0f * a34;
+        t[3 * t_stride] = s12 + 8.0f * s34 + m5;
+    };
+
+    CPUKernels::dispatch([&]() KERNEL_INLINE {
+        for (auto n = 0; n < batch_size; n++) {
+            const auto out_offset = n * K * (W*H);
+            for (auto k = k_begin; k < k_end; k++) {
+                for (auto block_y = 0; block_y < wtiles; block_y++) {
+                    for (auto block_x = 0; block_x < wtiles; block_x++) {
+
+                        const auto x = 4 * block_x;
+                        const auto y = 4 * block_y;
+
+                        const auto b = n * P + block_y * wtiles + block_x;
+                        std::array<float, WINOGRAD4_TILE> temp_m;
+                        for (auto i = 0; i < WINOGRAD4_TILE; i++) {
+                            temp_m[i] = M[i*(K*PB) + k*PB + b];
+                        }
+
+                        std::array<float, 4 * WINOGRAD4_ALPHA> T1;
+                        std::array<float, 4 * 4> o;
+                        for (auto j = 0; j < WINOGRAD4_ALPHA; j++) {
+                            transform(&temp_m[j], WINOGRAD4_ALPHA,
+                                      &T1[j], WINOGRAD4_ALPHA);
+                        }
+                        for (auto i = 0; i < 4; i++) {
+                            transform(&T1[i*WINOGRAD4_ALPHA], 1, &o[i*4], 1);
+                        }
+
+                        // Bias, residual add and ReLU fused into the output,
+                        // the last tiles hang over the board edge.
+                        const auto bias = biases[k];
+                        const auto y_offset = out_offset + k*(H*W);
+                        for (auto i = 0; i < 4 && y + i < H; i++) {
+                            for (auto j = 0; j < 4 && x + j < W; j++) {
+                                const auto idx = (y + i)*W + (x + j);
+                                auto val = o[i*4 + j] + bias;
+                                if (residual) {
+                                    val += residual[y_offset + idx];
+                                }
+                                Y[y_offset + idx] = val > 0.0f ? val : 0.0f;
+                            }
+                        }
                     }
                 }
             }
         }
+    });
+}
+
+template <int BoardSize, typename T>
+void Network::winograd4_convolve3(const Sgemm::backend_t backend,
+                                  const int outputs,
+                                  const std::vector<float>& input,
+                                  const HugePages::vector<T>& U,
+                                  const std::vector<float>& biases,
+                                  std::vector<float>& V,
+                                  std::vector<float>& M,
+                                  std::vector<float>& output,
+                                  const int batch_size,
+                                  const float* residual,
+                                  const int threads) {
+
+    constexpr auto wtiles = (BoardSize + 3) / 4;
+    constexpr auto P_one = wtiles * wtiles;
+    const auto input_channels = backend == Sgemm::BUILTIN
+        ? Sgemm::packed_channels(U.size(), WINOGRAD4_TILE, outputs)
+        : static_cast<int>(U.size() / (outputs * WINOGRAD4_TILE));
+
+    // Every stage splits into independent ranges: input channels, the
+    // tiles of the transformed domain and output channels.
+    {
+        ForwardProfile::Scope scope("input transform");
+        parallel_for(nn_thread_pool, threads, input_channels,
+                     [&](const int begin, const int end) {
+            winograd4_transform_in<BoardSize>(input, V, input_channels,
+                                              batch_size, begin, end);
+        });
+    }
+    {
+        ForwardProfile::Scope scope("gemm");
+        parallel_for(nn_thread_pool, threads, WINOGRAD4_TILE,
+                     [&](const int begin, const int end) {
+            winograd_sgemm(backend, U, V, M, WINOGRAD4_TILE, input_channels,
+                           outputs, P_one * batch_size, begin, end);
+        });
+    }
+    {
+        ForwardProfile::Scope scope("output transform");
+        parallel_for(nn_thread_pool, threads, outputs,
+                     [&](const int begin, const int end) {
+            winograd4_transform_out<BoardSize>(M, output, outputs, batch_size,
+                                               biases, residual, begin, end);
+        });
     }
 }
 
-void Network::winograd_convolve3(const int outputs,
-                                 const std::vector<float>& input,
-                                 const std::vector<float>& U,
-                                 std::vector<float>& V,
-                                 std::vector<float>& M,
-                                 std::vector<float>& output) {
+template <int BoardSize, bool F4, typename T>
+void Network::winograd_residual_block(const Sgemm::backend_t backend,
+                                      const int outputs,
+                                      const std::vector<float>& input,
+                                      const HugePages::vector<T>& U1,
+                                      const std::vector<float>& biases1,
+                                      const HugePages::vector<T>& U2,
+                                      const std::vector<float>& biases2,
+                                      std::vector<float>& V,
+                                      std::vector<float>& M,
+                                      std::vector<float>& mid,
+                                      std::vector<float>& output,
+                                      const int batch_size,
+                                      const int threads) {
+    constexpr auto tiles = F4 ? WINOGRAD4_TILE : WINOGRAD_TILE;
+    constexpr auto wtiles = F4 ? (BoardSize + 3) / 4 : (BoardSize + 1) / 2;
+    constexpr auto P_one = wtiles * wtiles;
+    // Output channels converted between the two convolutions at a time
+    constexpr auto CHANNEL_BLOCK = 8;
+
+    const auto transform_in = [&](const std::vector<float>& in,
+                                  const int begin, const int end) {
+        if (F4) {
+            winograd4_transform_in<BoardSize>(in, V, outputs, batch_size,
+                                              begin, end);
+        } else {
+            winograd_transform_in<BoardSize>(in, V, outputs, batch_size,
+                                             begin, end);
+        }
+    };
+    const auto transform_out = [&](std::vector<float>& out,
+                                   const std::vector<float>& biases,
+                                   const float* residual,
+                                   const int begin, const int end) {
+        if (F4) {
+            winograd4_transform_out<BoardSize>(M, out, outputs, batch_size,
+                                               biases, residual, begin, end);
+        } else {
+            winograd_transform_out<BoardSize>(M, out, outputs, batch_size,
+                                              biases, residual, begin, end);
+        }
+    };
+    const auto multiply = [&](const HugePages::vector<T>& U) {
+        ForwardProfile::Scope scope("gemm");
+        parallel_for(nn_thread_pool, threads, tiles,
+                     [&](const int begin, const int end) {
+            winograd_sgemm(backend, U, V, M, tiles, outputs, outputs,
+                           P_one * batch_size, begin, end);
+        });
+    };
 
-    constexpr unsigned int filter_len = WINOGRAD_ALPHA * WINOGRAD_ALPHA;
-    const auto input_channels = U.size() / (outputs * filter_len);
+    {
+        ForwardProfile::Scope scope("input transform");
+        parallel_for(nn_thread_pool, threads, outputs,
+                     [&](const int begin, const int end) {
+            transform_in(input, begin, end);
+        });
+    }
+    multiply(U1);
+    // A few planes of the first convolution's output at a time go
+    // straight back into V while they are still in cache.
+    {
+        ForwardProfile::Scope scope("fused transform");
+        parallel_for(nn_thread_pool, threads, outputs,
+                     [&](const int begin, const int end) {
+            for (auto c = begin; c < end; c += CHANNEL_BLOCK) {
+                const auto c_end = std::min(c + CHANNEL_BLOCK, end);
+                transform_out(mid, biases1, nullptr, c, c_end);
+                transform_in(mid, c, c_end);
+            }
+        });
+    }
+    multiply(U2);
+    // The block input is the residual, so it needs no copy.
+    {
+        ForwardProfile::Scope scope("output transform");
+        parallel_for(nn_thread_pool, threads, outputs,
+                     [&](const int begin, const int end) {
+            transform_out(output, biases2, input.data(), begin, end);
+        });
+    }
+}
 
-    winograd_transform_in(input, V, input_channels);
-    winograd_sgemm(U, V, M, input_channels, outputs);
-    winograd_transform_out(M, output, outputs);
+template <int BoardSize>
+size_t Network::winograd_scratch_size(const int channels,
+                                      const int batch_size) {
+    // Room for the V or M matrices of either Winograd variant
+    constexpr auto tiles = (BoardSize + 1) * (BoardSize + 1) / 4;
+    constexpr auto tiles4 = ((BoardSize + 3) / 4) * ((BoardSize + 3) / 4);
+    return std::max(WINOGRAD_TILE * tiles, WINOGRAD4_TILE * tiles4)
+           * channels * batch_size;
 }
 
-template<unsigned int filter_size>
+template<unsigned int filter_size, unsigned int board_size>
 void convolve(size_t outputs,
               const std::vector<net_t>& input,
               const std::vector<float>& weights,
               const std::vector<float>& biases,
               std::vector<float>& output) {
-    // The size of the board is defined at compile time
-    constexpr unsigned int width = BOARD_SIZE;
-    constexpr unsigned int height = BOARD_SIZE;
+    // The size of the board is a template parameter
+    constexpr unsigned int width = board_size;
+    constexpr unsigned int height = board_size;
     constexpr unsigned int board_squares = width * height;
     constexpr unsigned int filter_len = filter_size * filter_size;
     const auto input_channels = weights.size() / (biases.size() * filter_len);
@@ -639,7 +1793,7 @@ void convolve(size_t outputs,
     assert(outputs * board_squares == output.size());
 
     std::vector<float> col(filter_dim * width * height);
-    im2col<filter_size>(input_channels, input, col);
+    im2col<filter_size, board_size>(input_channels, input, col);
 
     // Weight shape (output, input, filter_size, filter_size)
     // 96 18 3 3
@@ -653,12 +1807,12 @@ void convolve(size_t outputs,
     //    cblas_sgemm(CblasRowMajor, TransA, TransB, M, N, K, alpha, A, lda, B,
     //                ldb, beta, C, N);
 
-    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans,
-                // M        N            K
-                outputs, board_squares, filter_dim,
-                1.0f, &weights[0], filter_dim,
-                &col[0], board_squares,
-                0.0f, &output[0], board_squares);
+    Sgemm::sgemm(false,
+                 // M        N            K
+                 outputs, board_squares, filter_dim,
+                 &weights[0], filter_dim,
+                 &col[0], board_squares,
+                 &output[0], board_squares);
 
     for (unsigned int o = 0; o < outputs; o++) {
         for (unsigned int b = 0; b < board_squares; b++) {
@@ -668,32 +1822,324 @@ void convolve(size_t outputs,
     }
 }
 
-template<unsigned int inputs,
-         unsigned int outputs,
-         size_t W, size_t B>
-void innerproduct(const std::vector<float>& input,
-                  const std::array<float, W>& weights,
-                  const std::array<float, B>& biases,
+// output = ReLU(output + residual), the bias is already in.
+static void residual_relu(const size_t size, float* output,
+                          const float* residual) {
+    CPUKernels::dispatch([&]() KERNEL_INLINE {
+        for (auto i = size_t{0}; i < size; i++) {
+            const auto val = output[i] + (residual ? residual[i] : 0.0f);
+            output[i] = val > 0.0f ? val : 0.0f;
+        }
+    });
+}
+
+template <int BoardSize>
+void Network::im2col_convolve3(const int outputs,
+                               const std::vector<float>& input,
+                               const std::vector<float>& weights,
+                               const std::vector<float>& biases,
+                               std::vector<float>& output,
+                               const int batch_size,
+                               const float* residual) {
+    constexpr auto board_squares = BoardSize * BoardSize;
+    const auto channels = weights.size() / (outputs * 9);
+    const auto in_size = channels * board_squares;
+    const auto out_size = outputs * board_squares;
+
+    auto in = std::vector<float>(in_size);
+    auto out = std::vector<float>(out_size);
+    for (auto n = 0; n < batch_size; n++) {
+        std::copy(begin(input) + n * in_size,
+                  begin(input) + (n + 1) * in_size, begin(in));
+        convolve<3, BoardSize>(outputs, in, weights, biases, out);
+        std::copy(begin(out), end(out), begin(output) + n * out_size);
+        residual_relu(out_size, &output[n * out_size],
+                      residual ? residual + n * out_size : nullptr);
+    }
+}
+
+template <int BoardSize>
+void Network::direct_convolve3(const int outputs,
+                               const std::vector<float>& input,
+                               const std::vector<float>& weights,
+                               const std::vector<float>& biases,
+                               std::vector<float>& output,
+                               const int batch_size,
+                               const float* residual,
+                               const int threads) {
+    constexpr auto W = BoardSize;
+    constexpr auto board_squares = W * W;
+    const auto channels = weights.size() / (outputs * 9);
+
+    for (auto n = 0; n < batch_size; n++) {
+        const auto in = &input[n * channels * board_squares];
+        const auto out = &output[n * outputs * board_squares];
+        const auto res = residual ? residual + n * outputs * board_squares
+                                  : nullptr;
+        parallel_for(nn_thread_pool, threads, outputs,
+                     [&](const int begin, const int end) {
+            CPUKernels::dispatch([&]() KERNEL_INLINE {
+                for (auto o = begin; o < end; o++) {
+                    const auto acc = out + o * board_squares;
+                    std::fill(acc, acc + board_squares, biases[o]);
+                    for (auto c = size_t{0}; c < channels; c++) {
+                        const auto plane = in + c * board_squares;
+                        const auto filter = &weights[(o * channels + c) * 9];
+                        for (auto ky = 0; ky < 3; ky++) {
+                            const auto dy = ky - 1;
+                            const auto y0 = std::max(0, -dy);
+                            const auto y1 = std::min(W, W - dy);
+                            for (auto kx = 0; kx < 3; kx++) {
+                                const auto dx = kx - 1;
+                                const auto x0 = std::max(0, -dx);
+                                const auto x1 = std::min(W, W - dx);
+                                const auto w = filter[ky * 3 + kx];
+                                for (auto y = y0; y < y1; y++) {
+                                    const auto src = plane + (y + dy) * W + dx;
+                                    const auto dst = acc + y * W;
+                                    for (auto x = x0; x < x1; x++) {
+                                        dst[x] += w * src[x];
+                                    }
+                                }
+                            }
+                        }
+                    }
+                }
+            });
+            residual_relu((end - begin) * board_squares,
+                          out + begin * board_squares,
+                          res ? res + begin * board_squares : nullptr);
+        });
+    }
+}
+
+template <int BoardSize>
+void Network::convolve3(const CPUTuner::algorithm_t algorithm,
+                        const size_t layer,
+                        const std::vector<float>& input,
+                        std::vector<float>& V,
+                        std::vector<float>& M,
+                        std::vector<float>& output,
+                        const int batch_size,
+                        const float* residual,
+                        const int threads) {
+    const auto outputs = m_conv_biases[layer].size();
+    switch (algorithm) {
+    case CPUTuner::WINOGRAD_BUILTIN:
+        winograd_convolve3<BoardSize>(Sgemm::BUILTIN, outputs, input,
+                                      m_conv_winograd_packed[layer],
+                                      m_conv_biases[layer], V, M, output,
+                                      batch_size, residual, threads);
+        break;
+    case CPUTuner::WINOGRAD_BLAS:
+        winograd_convolve3<BoardSize>(Sgemm::BLAS, outputs, input,
+                                      m_conv_winograd[layer],
+                                      m_conv_biases[layer], V, M, output,
+                                      batch_size, residual, threads);
+        break;
+    case CPUTuner::WINOGRAD4_BUILTIN:
+        winograd4_convolve3<BoardSize>(Sgemm::BUILTIN, outputs, input,
+                                       m_conv_winograd4_packed[layer],
+                                       m_conv_biases[layer], V, M, output,
+                                       batch_size, residual, threads);
+        break;
+    case CPUTuner::WINOGRAD4_BLAS:
+        winograd4_convolve3<BoardSize>(Sgemm::BLAS, outputs, input,
+                                       m_conv_winograd4[layer],
+                                       m_conv_biases[layer], V, M, output,
+                                       batch_size, residual, threads);
+        break;
+    case CPUTuner::WINOGRAD_HALF:
+        winograd_convolve3<BoardSize>(Sgemm::BUILTIN, outputs, input,
+                                      m_conv_winograd_half[layer],
+                                      m_conv_biases[layer], V, M, output,
+                                      batch_size, residual, threads);
+        break;
+    case CPUTuner::WINOGRAD4_HALF:
+        winograd4_convolve3<BoardSize>(Sgemm::BUILTIN, outputs, input,
+                                       m_conv_winograd4_half[layer],
+                                       m_conv_biases[layer], V, M, output,
+                                       batch_size, residual, threads);
+        break;
+    case CPUTuner::IM2COL: {
+        ForwardProfile::Scope scope("im2col convolution");
+        im2col_convolve3<BoardSize>(outputs, input, m_conv_weights[layer],
+                                    m_conv_biases[layer], output,
+                                    batch_size, residual);
+        break;
+    }
+    case CPUTuner::DIRECT: {
+        ForwardProfile::Scope scope("direct convolution");
+        direct_convolve3<BoardSize>(outputs, input, m_conv_weights[layer],
+                                    m_conv_biases[layer], output,
+                                    batch_size, residual, threads);
+        break;
+    }
+    }
+}
+
+template <int BoardSize>
+void Network::int8_convolve3(const size_t layer,
+                             const std::vector<float>& input,
+                             std::vector<float>& output,
+                             const int batch_size,
+                             const float* residual) {
+    constexpr auto board_squares = BoardSize * BoardSize;
+    const auto& conv = m_conv_int8[layer - 1];
+    const auto in_size = conv.channels * board_squares;
+    const auto out_size = conv.outputs * board_squares;
+    for (auto n = 0; n < batch_size; n++) {
+        Int8::convolve3(conv, BoardSize, &input[n * in_size],
+                        m_conv_biases[layer].data(),
+                        residual ? residual + n * out_size : nullptr,
+                        &output[n * out_size]);
+    }
+}
+
+template <int BoardSize>
+void Network::residual_block(const CPUTuner::algorithm_t algorithm,
+                             const size_t layer,
+                             const std::vector<float>& input,
+                             std::vector<float>& V,
+                             std::vector<float>& M,
+                             std::vector<float>& mid,
+                             std::vector<float>& output,
+                             const int batch_size,
+                             const int threads) {
+    // Largest inputs of the tower layers while calibrating the int8 one
+    const auto calibrate = [this](const size_t layer,
+                                  const std::vector<float>& in) {
+        if (!m_int8_calibration.empty()) {
+            auto& max_input = m_int8_calibration[layer - 1];
+            max_input = std::max(max_input,
+                                 *std::max_element(begin(in), end(in)));
+        }
+    };
+    calibrate(layer, input);
+
+    const auto outputs = m_conv_biases[layer].size();
+    ForwardProfile::set_layer("block", (layer + 1) / 2);
+    ForwardProfile::add_flops(2 * 2.0 * 9 * outputs * outputs
+                              * BoardSize * BoardSize * batch_size);
+    const auto& biases1 = m_conv_biases[layer];
+    const auto& biases2 = m_conv_biases[layer + 1];
+    if (m_use_int8) {
+        ForwardProfile::Scope scope("int8 convolution");
+        int8_convolve3<BoardSize>(layer, input, mid, batch_size);
+        int8_convolve3<BoardSize>(layer + 1, mid, output, batch_size,
+                                  input.data());
+    } else {
+        switch (algorithm) {
+        case CPUTuner::WINOGRAD_BUILTIN:
+            winograd_residual_block<BoardSize, false>(
+                Sgemm::BUILTIN, outputs, input,
+                m_conv_winograd_packed[layer], biases1,
+                m_conv_winograd_packed[layer + 1], biases2,
+                V, M, mid, output, batch_size, threads);
+            break;
+        case CPUTuner::WINOGRAD_BLAS:
+            winograd_residual_block<BoardSize, false>(
+                Sgemm::BLAS, outputs, input,
+                m_conv_winograd[layer], biases1,
+                m_conv_winograd[layer + 1], biases2,
+                V, M, mid, output, batch_size, threads);
+            break;
+        case CPUTuner::WINOGRAD4_BUILTIN:
+            winograd_residual_block<BoardSize, true>(
+                Sgemm::BUILTIN, outputs, input,
+                m_conv_winograd4_packed[layer], biases1,
+                m_conv_winograd4_packed[layer + 1], biases2,
+                V, M, mid, output, batch_size, threads);
+            break;
+        case CPUTuner::WINOGRAD4_BLAS:
+            winograd_residual_block<BoardSize, true>(
+                Sgemm::BLAS, outputs, input,
+                m_conv_winograd4[layer], biases1,
+                m_conv_winograd4[layer + 1], biases2,
+                V, M, mid, output, batch_size, threads);
+            break;
+        case CPUTuner::WINOGRAD_HALF:
+            winograd_residual_block<BoardSize, false>(
+                Sgemm::BUILTIN, outputs, input,
+                m_conv_winograd_half[layer], biases1,
+                m_conv_winograd_half[layer + 1], biases2,
+                V, M, mid, output, batch_size, threads);
+            break;
+        case CPUTuner::WINOGRAD4_HALF:
+            winograd_residual_block<BoardSize, true>(
+                Sgemm::BUILTIN, outputs, input,
+                m_conv_winograd4_half[layer], biases1,
+                m_conv_winograd4_half[layer + 1], biases2,
+                V, M, mid, output, batch_size, threads);
+            break;
+        case CPUTuner::IM2COL:
+        case CPUTuner::DIRECT:
+            convolve3<BoardSize>(algorithm, layer, input, V, M, mid,
+                                 batch_size, nullptr, threads);
+            convolve3<BoardSize>(algorithm, layer + 1, mid, V, M, output,
+                                 batch_size, input.data(), threads);
+            break;
+        }
+    }
+    calibrate(layer + 1, mid);
+}
+
+template <int BoardSize>
+double Network::time_convolve3(const CPUTuner::algorithm_t algorithm,
+                               const size_t layer, const int batch_size) {
+    constexpr auto board_squares = BoardSize * BoardSize;
+    const auto outputs = m_conv_biases[layer].size();
+    const auto channels = layer == 0 ? size_t{INPUT_CHANNELS} : outputs;
+
+    auto input = std::vector<float>(channels * board_squares * batch_size);
+    auto residual = std::vector<float>(outputs * board_squares * batch_size);
+    auto output = std::vector<float>(outputs * board_squares * batch_size);
+    auto V = std::vector<float>(
+        winograd_scratch_size<BoardSize>(channels, batch_size));
+    auto M = std::vector<float>(
+        winograd_scratch_size<BoardSize>(outputs, batch_size));
+    auto rng = Random{0};
+    for (auto& val : input) {
+        val = static_cast<float>(rng.randfix<1000>()) / 1000.0f;
+    }
+    const auto res = layer % 2 == 0 ? residual.data() : nullptr;
+
+    convolve3<BoardSize>(algorithm, layer, input, V, M, output,
+                         batch_size, res);
+    const auto start = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::duration<double>::zero();
+    auto runs = 0;
+    do {
+        convolve3<BoardSize>(algorithm, layer, input, V, M, output,
+                             batch_size, res);
+        runs++;
+        elapsed = std::chrono::steady_clock::now() - start;
+    } while (runs < 3 || elapsed.count() < 0.05);
+    return 1000.0 * elapsed.count() / runs;
+}
+
+void innerproduct(const size_t inputs, const size_t outputs,
+                  const std::vector<float>& input,
+                  const std::vector<float>& weights,
+                  const std::vector<float>& biases,
                   std::vector<float>& output) {
-    assert(B == outputs);
+    assert(weights.size() == inputs * outputs);
+    assert(biases.size() == outputs);
 
-    cblas_sgemv(CblasRowMajor, CblasNoTrans,
-                // M     K
-                outputs, inputs,
-                1.0f, &weights[0], inputs,
-                &input[0], 1,
-                0.0f, &output[0], 1);
+    Sgemm::sgemv(outputs, inputs, &weights[0], &input[0], &output[0]);
 
     auto lambda_ReLU = [](float val) { return (val > 0.0f) ?
                                        val : 0.0f; };
 
-    for (unsigned int o = 0; o < outputs; o++) {
-        float val = biases[o] + output[o];
-        if (outputs == 256) {
-            val = lambda_ReLU(val);
+    CPUKernels::dispatch([&]() KERNEL_INLINE {
+        for (auto o = size_t{0}; o < outputs; o++) {
+            float val = biases[o] + output[o];
+            if (outputs == 256) {
+                val = lambda_ReLU(val);
+            }
+            output[o] = val;
         }
-        output[o] = val;
-    }
+    });
 }
 
 template <size_t spatial_size>
@@ -706,77 +2152,118 @@ void batchnorm(size_t channels,
     auto lambda_ReLU = [](float val) { return (val > 0.0f) ?
                                        val : 0.0f; };
 
-    for (auto c = size_t{0}; c < channels; ++c) {
-        auto mean = means[c];
-        auto scale_stddiv = stddivs[c];
+    CPUKernels::dispatch([&]() KERNEL_INLINE {
+        for (auto c = size_t{0}; c < channels; ++c) {
+            auto mean = means[c];
+            auto scale_stddiv = stddivs[c];
 
-        if (eltwise == nullptr) {
-            // Classical BN
-            auto arr = &data[c * spatial_size];
-            for (auto b = size_t{0}; b < spatial_size; b++) {
-                arr[b] = lambda_ReLU(scale_stddiv * (arr[b] - mean));
-            }
-        } else {
-            // BN + residual add
-            auto arr = &data[c * spatial_size];
-            auto res = &eltwise[c * spatial_size];
-            for (auto b = size_t{0}; b < spatial_size; b++) {
-                arr[b] = lambda_ReLU(res[b] +
-                                     (scale_stddiv * (arr[b] - mean)));
+            if (eltwise == nullptr) {
+                // Classical BN
+                auto arr = &data[c * spatial_size];
+                for (auto b = size_t{0}; b < spatial_size; b++) {
+                    arr[b] = lambda_ReLU(scale_stddiv * (arr[b] - mean));
+                }
+            } else {
+                // BN + residual add
+                auto arr = &data[c * spatial_size];
+                auto res = &eltwise[c * spatial_size];
+                for (auto b = size_t{0}; b < spatial_size; b++) {
+                    arr[b] = lambda_ReLU(res[b] +
+                                         (scale_stddiv * (arr[b] - mean)));
+                }
             }
         }
-    }
+    });
 }
 
+template <int BoardSize>
 void Network::forward_cpu(std::vector<float>& input,
                           std::vector<float>& output_pol,
-                          std::vector<float>& output_val) {
+                          std::vector<float>& output_val,
+                          const int batch_size) {
+    Trace::Scope traced("forward_cpu", "nn");
     // Input convolution
-    constexpr int width = BOARD_SIZE;
-    constexpr int height = BOARD_SIZE;
-    constexpr int tiles = (width + 1) * (height + 1) / 4;
+    constexpr int width = BoardSize;
+    constexpr int height = BoardSize;
+    constexpr int board_squares = width * height;
     // Calculate output channels
-    const auto output_channels = conv_biases[0].size();
+    const auto output_channels = m_conv_biases[0].size();
     //input_channels is the maximum number of input channels of any convolution.
     //Residual blocks are identical, but the first convolution might be bigger
     //when the network has very few filters
     const auto input_channels = std::max(
             static_cast<size_t>(output_channels),
             static_cast<size_t>(INPUT_CHANNELS));
-    auto conv_out = std::vector<float>(output_channels * width * height);
-
-    auto V = std::vector<float>(WINOGRAD_TILE * input_channels * tiles);
-    auto M = std::vector<float>(WINOGRAD_TILE * output_channels * tiles);
-
-    winograd_convolve3(output_channels, input, conv_weights[0], V, M, conv_out);
-    batchnorm<BOARD_SQUARES>(output_channels, conv_out,
-                             batchnorm_means[0].data(),
-                             batchnorm_stddivs[0].data());
-
-    // Residual tower
-    auto conv_in = std::vector<float>(output_channels * width * height);
-    auto res = std::vector<float>(output_channels * width * height);
-    for (auto i = size_t{1}; i < conv_weights.size(); i += 2) {
-        auto output_channels = conv_biases[i].size();
-        std::swap(conv_out, conv_in);
-        std::copy(begin(conv_in), end(conv_in), begin(res));
-        winograd_convolve3(output_channels, conv_in,
-	                       conv_weights[i], V, M, conv_out);
-        batchnorm<BOARD_SQUARES>(output_channels, conv_out,
-                                 batchnorm_means[i].data(),
-                                 batchnorm_stddivs[i].data());
-
-        output_channels = conv_biases[i + 1].size();
-        std::swap(conv_out, conv_in);
-        winograd_convolve3(output_channels, conv_in,
-			               conv_weights[i + 1], V, M, conv_out);
-        batchnorm<BOARD_SQUARES>(output_channels, conv_out,
-                                 batchnorm_means[i + 1].data(),
-                                 batchnorm_stddivs[i + 1].data(),
-                                 res.data());
-    }
-    convolve<1>(OUTPUTS_POLICY, conv_out, conv_pol_w, conv_pol_b, output_pol);
-    convolve<1>(OUTPUTS_VALUE, conv_out, conv_val_w, conv_val_b, output_val);
+    const auto planes = output_channels * batch_size;
+    auto conv_out = std::vector<float>(planes * width * height);
+
+    auto V = std::vector<float>(
+        winograd_scratch_size<BoardSize>(input_channels, batch_size));
+    auto M = std::vector<float>(
+        winograd_scratch_size<BoardSize>(output_channels, batch_size));
+    // With mid and block_out below
+    Memory::Scope workspace(Memory::WORKSPACES,
+        (3 * conv_out.size() + V.size() + M.size()) * sizeof(float));
+
+    // Latency mode when this is the only evaluation running: the
+    // convolutions are split over the NN threads. Otherwise the other
+    // search threads' evaluations keep the cores busy (throughput mode).
+    struct InFlight {
+        std::atomic<int>& m_count;
+        int m_value;
+        explicit InFlight(std::atomic<int>& count)
+            : m_count(count), m_value(++count) {}
+        ~InFlight() { --m_count; }
+    } in_flight{m_primary->m_forwards};
+    auto threads = in_flight.m_value == 1 ? cfg_nn_threads : 1;
+    if (const auto profile = ForwardProfile::active()) {
+        threads = profile->threads();
+    }
+
+    ForwardProfile::set_layer("input");
+    ForwardProfile::add_flops(2.0 * 9 * INPUT_CHANNELS * output_channels
+                              * board_squares * batch_size);
+    convolve3<BoardSize>(conv_algorithm(0, batch_size), 0, input,
+                         V, M, conv_out, batch_size, nullptr, threads);
+
+    // Residual tower, ping-ponging between the block input and output
+    const auto algorithm = conv_algorithm(1, batch_size);
+    auto mid = std::vector<float>(planes * width * height);
+    auto block_out = std::vector<float>(planes * width * height);
+    for (auto i = size_t{1}; i < m_conv_biases.size(); i += 2) {
+        residual_block<BoardSize>(algorithm, i, conv_out, V, M, mid,
+                                  block_out, batch_size, threads);
+        std::swap(conv_out, block_out);
+    }
+
+    // The 1x1 head convolutions are cheap, run them per position
+    ForwardProfile::set_layer("heads");
+    const auto tower_size = output_channels * board_squares;
+    auto head_in = std::vector<float>(tower_size);
+    auto head_pol = std::vector<float>(OUTPUTS_POLICY * board_squares);
+    auto head_val = std::vector<float>(OUTPUTS_VALUE * board_squares);
+    for (auto n = 0; n < batch_size; n++) {
+        std::copy(begin(conv_out) + n * tower_size,
+                  begin(conv_out) + (n + 1) * tower_size,
+                  begin(head_in));
+        {
+            ForwardProfile::Scope scope("policy conv");
+            convolve<1, BoardSize>(OUTPUTS_POLICY, head_in,
+                                   m_conv_pol_w, m_conv_pol_b, head_pol);
+        }
+        {
+            ForwardProfile::Scope scope("value conv");
+            convolve<1, BoardSize>(OUTPUTS_VALUE, head_in,
+                                   m_conv_val_w, m_conv_val_b, head_val);
+        }
+        std::copy(begin(head_pol), end(head_pol),
+                  begin(output_pol) + n * head_pol.size());
+        std::copy(begin(head_val), end(head_val),
+                  begin(output_val) + n * head_val.size());
+    }
+    ForwardProfile::add_flops(2.0 * (OUTPUTS_POLICY + OUTPUTS_VALUE)
+                              * output_channels * board_squares
+                              * batch_size);
 }
 
 template<typename T>
@@ -820,6 +2307,41 @@ void compare_net_outputs(std::vector<float>& data,
         }
     }
 }
+
+template <int BoardSize>
+float Network::convolve3_error(const CPUTuner::algorithm_t algorithm,
+                               const size_t layer) {
+    // Largest difference to the direct convolution on random input,
+    // relative to the largest output. Single outputs can cancel out to
+    // almost zero, so unlike compare_net_outputs we do not compare them
+    // one by one.
+    constexpr auto board_squares = BoardSize * BoardSize;
+    const auto outputs = m_conv_biases[layer].size();
+    const auto channels = layer == 0 ? size_t{INPUT_CHANNELS} : outputs;
+
+    auto input = std::vector<float>(channels * board_squares);
+    auto output = std::vector<float>(outputs * board_squares);
+    auto ref = std::vector<float>(outputs * board_squares);
+    auto V = std::vector<float>(winograd_scratch_size<BoardSize>(channels, 1));
+    auto M = std::vector<float>(winograd_scratch_size<BoardSize>(outputs, 1));
+    auto rng = Random{0};
+    for (auto& val : input) {
+        val = static_cast<float>(rng.randfix<1000>()) / 1000.0f;
+    }
+
+    convolve3<BoardSize>(algorithm, layer, input, V, M, output, 1);
+    convolve3<BoardSize>(CPUTuner::DIRECT, layer, input, V, M, ref, 1);
+    auto max_error = 0.0f;
+    auto max_output = 0.0f;
+    for (auto idx = size_t{0}; idx < output.size(); idx++) {
+        if (std::isnan(output[idx])) {
+            return std::numeric_limits<float>::max();
+        }
+        max_error = std::max(max_error, std::fabs(output[idx] - ref[idx]));
+        max_output = std::max(max_output, std::fabs(ref[idx]));
+    }
+    return max_output > 0.0f ? max_error / max_output : max_error;
+}
 #endif
 
 void Network::softmax(const std::vector<float>& input,
@@ -827,84 +2349,128 @@ void Network::softmax(const std::vector<float>& input,
                       float temperature) {
     assert(&input != &output);
 
-    auto alpha = *std::max_element(begin(input),
-                                   begin(input) + output.size());
-    alpha /= temperature;
-
-    auto denom = 0.0f;
-    auto helper = std::vector<float>(output.size());
-    for (auto i = size_t{0}; i < output.size(); i++) {
-        auto val   = std::exp((input[i]/temperature) - alpha);
-        helper[i]  = val;
-        denom     += val;
-    }
-    for (auto i = size_t{0}; i < output.size(); i++) {
-        output[i] = helper[i] / denom;
-    }
+    CPUKernels::dispatch([&]() KERNEL_INLINE {
+        auto alpha = *std::max_element(begin(input),
+                                       begin(input) + output.size());
+        alpha /= temperature;
+
+        auto denom = 0.0f;
+        auto helper = std::vector<float>(output.size());
+        for (auto i = size_t{0}; i < output.size(); i++) {
+            auto val   = std::exp((input[i]/temperature) - alpha);
+            helper[i]  = val;
+            denom     += val;
+        }
+        for (auto i = size_t{0}; i < output.size(); i++) {
+            output[i] = helper[i] / denom;
+        }
+    });
 }
 
 Network::Netresult Network::get_scored_moves(
     const GameState* state, Ensemble ensemble, int rotation, bool skip_cache) {
     Netresult result;
-    if (state->board.get_boardsize() != BOARD_SIZE) {
+    if (state->board.get_boardsize() != m_boardsize) {
         return result;
     }
 
-    // See if we already have this in the cache.
-    if (!skip_cache) {
-      if (NNCache::get_NNCache().lookup(state->board.get_hash(), result)) {
+    // See if we already have this in the cache. An average over all
+    // symmetries is better than what random rotations left there.
+    if (!skip_cache && ensemble != AVERAGE) {
+      if (m_nncache->lookup(state->board.get_hash(), result)) {
         return result;
       }
     }
 
-    NNPlanes planes;
-    gather_features(state, planes);
-
+    std::vector<int> rotations;
     if (ensemble == DIRECT) {
         assert(rotation >= 0 && rotation <= 7);
-        result = get_scored_moves_internal(state, planes, rotation);
+        rotations.emplace_back(rotation);
+    } else if (ensemble == RANDOM_ROTATION) {
+        assert(rotation == -1);
+        rotations.emplace_back(Random::get_Rng().randfix<8>());
     } else {
-        assert(ensemble == RANDOM_ROTATION);
+        assert(ensemble == AVERAGE);
         assert(rotation == -1);
-        auto rand_rot = Random::get_Rng().randfix<8>();
-        result = get_scored_moves_internal(state, planes, rand_rot);
+        for (auto r = 0; r < 8; r++) {
+            rotations.emplace_back(r);
+        }
+    }
+
+    const auto started = std::chrono::steady_clock::now();
+    if (m_backend) {
+        result = m_backend->evaluate(state, rotations);
+    } else {
+        result = evaluate(state, rotations);
+    }
+    m_evaluations++;
+    Telemetry::nn_eval(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - started).count());
+    if (m_recorder) {
+        m_recorder->record(state, rotations, result);
     }
 
     // Insert result into cache.
-    NNCache::get_NNCache().insert(state->board.get_hash(), result);
+    m_nncache->insert(state->board.get_hash(), result);
 
     return result;
 }
 
+Network::Netresult Network::evaluate(const GameState* state,
+                                     const std::vector<int>& rotations) {
+    NNPlanes planes;
+    {
+        ForwardProfile::set_layer("input");
+        ForwardProfile::Scope scope("feature gather");
+        gather_features(state, planes);
+    }
+
+    // Dispatch to the kernels compiled for this board size
+    switch (m_boardsize) {
+    case 9:
+        return get_scored_moves_internal<9>(state, planes, rotations);
+    case 13:
+        return get_scored_moves_internal<13>(state, planes, rotations);
+    default:
+        assert(m_boardsize == 19);
+        return get_scored_moves_internal<19>(state, planes, rotations);
+    }
+}
+
+template <int BoardSize>
 Network::Netresult Network::get_scored_moves_internal(
-    const GameState* state, NNPlanes & planes, int rotation) {
-    assert(rotation >= 0 && rotation <= 7);
+    const GameState* state, NNPlanes & planes,
+    const std::vector<int>& rotations) {
     assert(INPUT_CHANNELS == planes.size());
-    constexpr int width = BOARD_SIZE;
-    constexpr int height = BOARD_SIZE;
-    const auto convolve_channels = conv_pol_w.size() / conv_pol_b.size();
+    constexpr int width = BoardSize;
+    constexpr int height = BoardSize;
+    constexpr int board_squares = width * height;
+    // All symmetries go through the network as one batch
+    const auto batch_size = static_cast<int>(rotations.size());
     std::vector<net_t> input_data;
-    std::vector<net_t> output_data(convolve_channels * width * height);
-    std::vector<float> policy_data(OUTPUTS_POLICY * width * height);
-    std::vector<float> value_data(OUTPUTS_VALUE * width * height);
-    std::vector<float> policy_out((width * height) + 1);
-    std::vector<float> softmax_data((width * height) + 1);
-    std::vector<float> winrate_data(256);
-    std::vector<float> winrate_out(1);
-    // Data layout is input_data[(c * height + h) * width + w]
-    input_data.reserve(INPUT_CHANNELS * width * height);
-    for (int c = 0; c < INPUT_CHANNELS; ++c) {
-        for (int h = 0; h < height; ++h) {
-            for (int w = 0; w < width; ++w) {
-                auto rot_idx = rotate_nn_idx_table[rotation][h * BOARD_SIZE + w];
-                input_data.emplace_back(net_t(planes[c][rot_idx]));
+    std::vector<float> policy_data(batch_size * OUTPUTS_POLICY * width * height);
+    std::vector<float> value_data(batch_size * OUTPUTS_VALUE * width * height);
+    // Data layout is input_data[((n * c) * height + h) * width + w]
+    input_data.reserve(batch_size * INPUT_CHANNELS * width * height);
+    {
+        ForwardProfile::Scope scope("feature gather");
+        for (auto rotation : rotations) {
+            assert(rotation >= 0 && rotation <= 7);
+            for (int c = 0; c < INPUT_CHANNELS; ++c) {
+                for (int h = 0; h < height; ++h) {
+                    for (int w = 0; w < width; ++w) {
+                        auto rot_idx = m_rotate_nn_idx_table[rotation][h * width + w];
+                        input_data.emplace_back(net_t(planes[c][rot_idx]));
+                    }
+                }
             }
         }
     }
 #ifdef USE_OPENCL
-    opencl.forward(input_data, policy_data, value_data);
+    m_opencl->forward(input_data, policy_data, value_data, batch_size);
 #elif defined(USE_BLAS) && !defined(USE_OPENCL)
-    forward_cpu(input_data, policy_data, value_data);
+    local_replica().forward_cpu<BoardSize>(input_data, policy_data,
+                                           value_data, batch_size);
 #endif
 #ifdef USE_OPENCL_SELFCHECK
     // Both implementations are available, self-check the OpenCL driver by
@@ -912,41 +2478,83 @@ Network::Netresult Network::get_scored_moves_internal(
     if (Random::get_Rng().randfix<SELFCHECK_PROBABILITY>() == 0) {
         auto cpu_policy_data = std::vector<float>(policy_data.size());
         auto cpu_value_data = std::vector<float>(value_data.size());
-        forward_cpu(input_data, cpu_policy_data, cpu_value_data);
+        forward_cpu<BoardSize>(input_data, cpu_policy_data, cpu_value_data,
+                               batch_size);
         compare_net_outputs(policy_data, cpu_policy_data);
         compare_net_outputs(value_data, cpu_value_data);
     }
 #endif
 
-    // Get the moves
-    batchnorm<BOARD_SQUARES>(OUTPUTS_POLICY, policy_data, bn_pol_w1.data(), bn_pol_w2.data());
-    innerproduct<OUTPUTS_POLICY * BOARD_SQUARES, BOARD_SQUARES + 1>(policy_data, ip_pol_w, ip_pol_b, policy_out);
-    softmax(policy_out, softmax_data, cfg_softmax_temp);
-    std::vector<float>& outputs = softmax_data;
+    // Policy per board point (unrotated) plus pass, averaged over the batch
+    std::vector<float> outputs(board_squares + 1);
+    auto winrate_sig = 0.0f;
 
-    // Now get the score
-    batchnorm<BOARD_SQUARES>(OUTPUTS_VALUE, value_data, bn_val_w1.data(), bn_val_w2.data());
-    innerproduct<BOARD_SQUARES, 256>(value_data, ip1_val_w, ip1_val_b, winrate_data);
-    innerproduct<256, 1>(winrate_data, ip2_val_w, ip2_val_b, winrate_out);
+    std::vector<float> head_pol(OUTPUTS_POLICY * board_squares);
+    std::vector<float> head_val(OUTPUTS_VALUE * board_squares);
+    std::vector<float> policy_out(board_squares + 1);
+    std::vector<float> softmax_data(board_squares + 1);
+    std::vector<float> winrate_data(256);
+    std::vector<float> winrate_out(1);
+    ForwardProfile::set_layer("heads");
+    ForwardProfile::add_flops(2.0 * batch_size
+        * (OUTPUTS_POLICY * board_squares * (board_squares + 1)
+           + board_squares * 256 + 256));
+    for (auto n = 0; n < batch_size; n++) {
+        const auto rotation = rotations[n];
+        std::copy(begin(policy_data) + n * head_pol.size(),
+                  begin(policy_data) + (n + 1) * head_pol.size(),
+                  begin(head_pol));
+        std::copy(begin(value_data) + n * head_val.size(),
+                  begin(value_data) + (n + 1) * head_val.size(),
+                  begin(head_val));
+
+        // Get the moves
+        {
+            ForwardProfile::Scope scope("bn");
+            batchnorm<board_squares>(OUTPUTS_POLICY, head_pol, m_bn_pol_w1.data(), m_bn_pol_w2.data());
+        }
+        {
+            ForwardProfile::Scope scope("policy head");
+            innerproduct(OUTPUTS_POLICY * board_squares, board_squares + 1,
+                         head_pol, m_ip_pol_w, m_ip_pol_b, policy_out);
+        }
+        {
+            ForwardProfile::Scope scope("softmax");
+            softmax(policy_out, softmax_data, cfg_softmax_temp);
+        }
 
-    // Sigmoid
-    auto winrate_sig = (1.0f + std::tanh(winrate_out[0])) / 2.0f;
+        for (auto idx = 0; idx < board_squares; idx++) {
+            auto rot_idx = m_rotate_nn_idx_table[rotation][idx];
+            outputs[rot_idx] += softmax_data[idx] / batch_size;
+        }
+        outputs[board_squares] += softmax_data[board_squares] / batch_size;
+
+        // Now get the score
+        {
+            ForwardProfile::Scope scope("bn");
+            batchnorm<board_squares>(OUTPUTS_VALUE, head_val, m_bn_val_w1.data(), m_bn_val_w2.data());
+        }
+        {
+            ForwardProfile::Scope scope("value head");
+            innerproduct(board_squares, 256,
+                         head_val, m_ip1_val_w, m_ip1_val_b, winrate_data);
+            innerproduct(256, 1, winrate_data, m_ip2_val_w, m_ip2_val_b, winrate_out);
+        }
+
+        // Sigmoid
+        winrate_sig += (1.0f + std::tanh(winrate_out[0])) / 2.0f / batch_size;
+    }
 
     std::vector<scored_node> result;
-    for (auto idx = size_t{0}; idx < outputs.size(); idx++) {
-        if (idx < BOARD_SQUARES) {
-            auto val = outputs[idx];
-            auto rot_idx = rotate_nn_idx_table[rotation][idx];
-            auto x = rot_idx % BOARD_SIZE;
-            auto y = rot_idx / BOARD_SIZE;
-            auto rot_vtx = state->board.get_vertex(x, y);
-            if (state->board.get_square(rot_vtx) == FastBoard::EMPTY) {
-                result.emplace_back(val, rot_vtx);
-            }
-        } else {
-            result.emplace_back(outputs[idx], FastBoard::PASS);
+    for (auto idx = 0; idx < board_squares; idx++) {
+        auto x = idx % width;
+        auto y = idx / width;
+        auto vtx = state->board.get_vertex(x, y);
+        if (state->board.get_square(vtx) == FastBoard::EMPTY) {
+            result.emplace_back(outputs[idx], vtx);
         }
     }
+    result.emplace_back(outputs[board_squares], FastBoard::PASS);
 
     return std::make_pair(result, winrate_sig);
 }
@@ -956,8 +2564,9 @@ void Network::show_heatmap(const FastState * state, Netresult& result, bool topm
     std::vector<std::string> display_map;
     std::string line;
 
-    for (unsigned int y = 0; y < BOARD_SIZE; y++) {
-        for (unsigned int x = 0; x < BOARD_SIZE; x++) {
+    const auto board_size = state->board.get_boardsize();
+    for (auto y = 0; y < board_size; y++) {
+        for (auto x = 0; x < board_size; x++) {
             int vtx = state->board.get_vertex(x, y);
 
             auto item = std::find_if(moves.cbegin(), moves.cend(),
@@ -973,7 +2582,7 @@ void Network::show_heatmap(const FastState * state, Netresult& result, bool topm
             }
 
             line += boost::str(boost::format("%3d ") % int(score * 1000));
-            if (x == BOARD_SIZE - 1) {
+            if (x == board_size - 1) {
                 display_map.push_back(line);
                 line.clear();
             }
@@ -1007,8 +2616,9 @@ void Network::show_heatmap(const FastState * state, Netresult& result, bool topm
 void Network::fill_input_plane_pair(const FullBoard& board,
                                     BoardPlane& black, BoardPlane& white) {
     auto idx = 0;
-    for (int j = 0; j < BOARD_SIZE; j++) {
-        for(int i = 0; i < BOARD_SIZE; i++) {
+    const auto board_size = board.get_boardsize();
+    for (int j = 0; j < board_size; j++) {
+        for(int i = 0; i < board_size; i++) {
             int vtx = board.get_vertex(i, j);
             auto color = board.get_square(vtx);
             if (color != FastBoard::EMPTY) {
@@ -1050,11 +2660,12 @@ void Network::gather_features(const GameState* state, NNPlanes & planes) {
     }
 }
 
-int Network::rotate_nn_idx(const int vertex, int symmetry) {
-    assert(vertex >= 0 && vertex < BOARD_SQUARES);
+int Network::rotate_nn_idx(const int vertex, int symmetry,
+                           const int board_size) {
+    assert(vertex >= 0 && vertex < board_size * board_size);
     assert(symmetry >= 0 && symmetry < 8);
-    int x = vertex % BOARD_SIZE;
-    int y = vertex / BOARD_SIZE;
+    int x = vertex % board_size;
+    int y = vertex / board_size;
     int newx;
     int newy;
 
@@ -1068,17 +2679,17 @@ int Network::rotate_nn_idx(const int vertex, int symmetry) {
         newy = y;
     } else if (symmetry == 1) {
         newx = x;
-        newy = BOARD_SIZE - y - 1;
+        newy = board_size - y - 1;
     } else if (symmetry == 2) {
-        newx = BOARD_SIZE - x - 1;
+        newx = board_size - x - 1;
         newy = y;
     } else {
         assert(symmetry == 3);
-        newx = BOARD_SIZE - x - 1;
-        newy = BOARD_SIZE - y - 1;
+        newx = board_size - x - 1;
+        newy = board_size - y - 1;
     }
 
-    int newvtx = (newy * BOARD_SIZE) + newx;
-    assert(newvtx >= 0 && newvtx < BOARD_SQUARES);
+    int newvtx = (newy * board_size) + newx;
+    assert(newvtx >= 0 && newvtx < board_size * board_size);
     return newvtx;
 }
@@ -22,7 +22,9 @@
 #include "config.h"
 
 #include <array>
+#include <atomic>
 #include <bitset>
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <utility>
@@ -30,22 +32,34 @@
 #include <fstream>
 
 #include "FastState.h"
+#include "CPUTuner.h"
 #include "GameState.h"
+#include "HugePages.h"
+#include "Int8.h"
+#include "Sgemm.h"
+
+class EvalRecorder;
+class NNBackend;
+class NNCache;
+class OpenCLScheduler;
 
 class Network {
 public:
     enum Ensemble {
-        DIRECT, RANDOM_ROTATION
+        DIRECT, RANDOM_ROTATION, AVERAGE
     };
     using BoardPlane = std::bitset<BOARD_SQUARES>;
     using NNPlanes = std::vector<BoardPlane>;
     using scored_node = std::pair<float, int>;
     using Netresult = std::pair<std::vector<scored_node>, float>;
 
-    static Netresult get_scored_moves(const GameState* state,
-                                      Ensemble ensemble,
-                                      int rotation = -1,
-                                      bool skip_cache = false);
+    Network();
+    ~Network();
+
+    Netresult get_scored_moves(const GameState* state,
+                               Ensemble ensemble,
+                               int rotation = -1,
+                               bool skip_cache = false);
     // File format version
     static constexpr auto FORMAT_VERSION = 1;
     static constexpr auto INPUT_MOVES = 8;
@@ -56,9 +70,45 @@ public:
     // Winograd filter transformation changes 3x3 filters to 4x4
     static constexpr auto WINOGRAD_ALPHA = 4;
     static constexpr auto WINOGRAD_TILE = WINOGRAD_ALPHA * WINOGRAD_ALPHA;
+    // and to 6x6 for F(4x4, 3x3)
+    static constexpr auto WINOGRAD4_ALPHA = 6;
+    static constexpr auto WINOGRAD4_TILE = WINOGRAD4_ALPHA * WINOGRAD4_ALPHA;
 
-    static void initialize();
-    static void benchmark(const GameState * state, int iterations = 1600);
+    // Load the weights file, returns false if it could not be used.
+    bool initialize(const std::string& weightsfile);
+    // Load weights in the file format from a stream, e.g. in memory.
+    bool initialize(std::istream& weights);
+    // Weights in the v1 file format for a network of the given shape,
+    // random but with activations that stay in range through the tower.
+    static void write_random_weights(std::ostream& out, int residual_blocks,
+                                     int channels, int board_size,
+                                     std::uint64_t seed = 0);
+    struct BenchmarkOptions {
+        // Profile evaluations of these batch sizes with these numbers of
+        // NN threads, by default single positions with --nn-threads.
+        std::vector<int> batch_sizes;
+        std::vector<int> threads;
+        // Also write the profiles there as JSON if not empty, "-" is
+        // the log.
+        std::string json_file;
+        // Profile a network of random weights of this shape instead,
+        // built in memory, if not 0.
+        int random_blocks{0};
+        int random_channels{0};
+    };
+    void benchmark(const GameState * state, int iterations = 1600);
+    void benchmark(const GameState * state, int iterations,
+                   const BenchmarkOptions& options);
+    // Board size of the loaded network, taken from the weights file.
+    int get_boardsize() const;
+    NNCache& get_nncache();
+    // Positions run through the network by get_scored_moves so far.
+    std::uint64_t get_evaluations() const;
+    // Bytes of the weights in host memory, replicas included, and on
+    // the OpenCL devices.
+    std::size_t get_weight_bytes() const;
+    std::size_t get_device_weight_bytes() const;
+    static bool is_supported_boardsize(int size);
     static void show_heatmap(const FastState * state, Netresult & netres,
                              bool topmoves);
     static void softmax(const std::vector<float>& input,
@@ -67,41 +117,242 @@ public:
 
     static void gather_features(const GameState* state, NNPlanes& planes);
 private:
-    static std::pair<int, int> load_v1_network(std::ifstream& wtfile);
-    static std::pair<int, int> load_network_file(std::string filename);
+    std::pair<int, int> load_v1_network(std::istream& wtfile);
+    std::pair<int, int> load_network(std::istream& wtfile);
     static void process_bn_var(std::vector<float>& weights,
                                const float epsilon=1e-5f);
 
-    static std::vector<float> winograd_transform_f(const std::vector<float>& f,
-        const int outputs, const int channels);
-    static std::vector<float> zeropad_U(const std::vector<float>& U,
+    static HugePages::vector<float> winograd_transform_f(
+        const std::vector<float>& f, const int outputs, const int channels);
+    static std::vector<float> zeropad_U(const HugePages::vector<float>& U,
         const int outputs, const int channels,
         const int outputs_pad, const int channels_pad);
+    template <int BoardSize>
     static void winograd_transform_in(const std::vector<float>& in,
                                       std::vector<float>& V,
-                                      const int C);
+                                      const int C, const int batch_size,
+                                      const int c_begin, const int c_end);
+    template <int BoardSize>
     static void winograd_transform_out(const std::vector<float>& M,
                                        std::vector<float>& Y,
-                                       const int K);
-    static void winograd_convolve3(const int outputs,
+                                       const int K, const int batch_size,
+                                       const std::vector<float>& biases,
+                                       const float* residual,
+                                       const int k_begin, const int k_end);
+    template <int BoardSize, typename T>
+    static void winograd_convolve3(Sgemm::backend_t backend,
+                                   const int outputs,
                                    const std::vector<float>& input,
-                                   const std::vector<float>& U,
+                                   const HugePages::vector<T>& U,
+                                   const std::vector<float>& biases,
                                    std::vector<float>& V,
                                    std::vector<float>& M,
-                                   std::vector<float>& output);
-    static void winograd_sgemm(const std::vector<float>& U,
-                               std::vector<float>& V,
-                               std::vector<float>& M, const int C, const int K);
-    static int rotate_nn_idx(const int vertex, int symmetry);
+                                   std::vector<float>& output,
+                                   const int batch_size,
+                                   const float* residual = nullptr,
+                                   const int threads = 1);
+    static void winograd_sgemm(Sgemm::backend_t backend,
+                               const HugePages::vector<float>& U,
+                               const std::vector<float>& V,
+                               std::vector<float>& M, const int tiles,
+                               const int C, const int K, const int P,
+                               const int first_tile, const int last_tile);
+    static void winograd_sgemm(Sgemm::backend_t backend,
+                               const HugePages::vector<Sgemm::half_t>& U,
+                               const std::vector<float>& V,
+                               std::vector<float>& M, const int tiles,
+                               const int C, const int K, const int P,
+                               const int first_tile, const int last_tile);
+    static HugePages::vector<float> winograd4_transform_f(
+        const std::vector<float>& f, const int outputs, const int channels);
+    template <int BoardSize>
+    static void winograd4_transform_in(const std::vector<float>& in,
+                                       std::vector<float>& V,
+                                       const int C, const int batch_size,
+                                       const int c_begin, const int c_end);
+    template <int BoardSize>
+    static void winograd4_transform_out(const std::vector<float>& M,
+                                        std::vector<float>& Y,
+                                        const int K, const int batch_size,
+                                        const std::vector<float>& biases,
+                                        const float* residual,
+                                        const int k_begin, const int k_end);
+    template <int BoardSize, typename T>
+    static void winograd4_convolve3(Sgemm::backend_t backend,
+                                    const int outputs,
+                                    const std::vector<float>& input,
+                                    const HugePages::vector<T>& U,
+                                    const std::vector<float>& biases,
+                                    std::vector<float>& V,
+                                    std::vector<float>& M,
+                                    std::vector<float>& output,
+                                    const int batch_size,
+                                    const float* residual = nullptr,
+                                    const int threads = 1);
+    template <int BoardSize, bool F4, typename T>
+    static void winograd_residual_block(Sgemm::backend_t backend,
+                                        const int outputs,
+                                        const std::vector<float>& input,
+                                        const HugePages::vector<T>& U1,
+                                        const std::vector<float>& biases1,
+                                        const HugePages::vector<T>& U2,
+                                        const std::vector<float>& biases2,
+                                        std::vector<float>& V,
+                                        std::vector<float>& M,
+                                        std::vector<float>& mid,
+                                        std::vector<float>& output,
+                                        const int batch_size,
+                                        const int threads);
+    template <int BoardSize>
+    static size_t winograd_scratch_size(const int channels,
+                                        const int batch_size);
+    template <int BoardSize>
+    static void im2col_convolve3(const int outputs,
+                                 const std::vector<float>& input,
+                                 const std::vector<float>& weights,
+                                 const std::vector<float>& biases,
+                                 std::vector<float>& output,
+                                 const int batch_size,
+                                 const float* residual = nullptr);
+    template <int BoardSize>
+    static void direct_convolve3(const int outputs,
+                                 const std::vector<float>& input,
+                                 const std::vector<float>& weights,
+                                 const std::vector<float>& biases,
+                                 std::vector<float>& output,
+                                 const int batch_size,
+                                 const float* residual = nullptr,
+                                 const int threads = 1);
+    template <int BoardSize>
+    void convolve3(CPUTuner::algorithm_t algorithm, const size_t layer,
+                   const std::vector<float>& input,
+                   std::vector<float>& V,
+                   std::vector<float>& M,
+                   std::vector<float>& output,
+                   const int batch_size,
+                   const float* residual = nullptr,
+                   const int threads = 1);
+    template <int BoardSize>
+    double time_convolve3(CPUTuner::algorithm_t algorithm,
+                          const size_t layer, const int batch_size);
+    template <int BoardSize>
+    float convolve3_error(CPUTuner::algorithm_t algorithm,
+                          const size_t layer);
+    void tune_convolutions(const int channels);
+    CPUTuner::algorithm_t conv_algorithm(const size_t layer,
+                                         const int batch_size) const;
+    static int rotate_nn_idx(const int vertex, int symmetry,
+                             const int board_size);
     static void fill_input_plane_pair(
       const FullBoard& board, BoardPlane& black, BoardPlane& white);
-    static Netresult get_scored_moves_internal(
-      const GameState* state, NNPlanes & planes, int rotation);
+    Netresult evaluate(const GameState* state,
+                       const std::vector<int>& rotations);
+    template <int BoardSize>
+    Netresult get_scored_moves_internal(
+      const GameState* state, NNPlanes & planes,
+      const std::vector<int>& rotations);
 #if defined(USE_BLAS)
-    static void forward_cpu(std::vector<float>& input,
-                            std::vector<float>& output_pol,
-                            std::vector<float>& output_val);
+    template <int BoardSize>
+    void forward_cpu(std::vector<float>& input,
+                     std::vector<float>& output_pol,
+                     std::vector<float>& output_val,
+                     const int batch_size);
+    template <int BoardSize>
+    void residual_block(CPUTuner::algorithm_t algorithm, const size_t layer,
+                        const std::vector<float>& input,
+                        std::vector<float>& V,
+                        std::vector<float>& M,
+                        std::vector<float>& mid,
+                        std::vector<float>& output,
+                        const int batch_size,
+                        const int threads);
+    template <int BoardSize>
+    void int8_convolve3(const size_t layer,
+                        const std::vector<float>& input,
+                        std::vector<float>& output,
+                        const int batch_size,
+                        const float* residual = nullptr);
+    std::vector<GameState> sample_positions(const int count,
+                                            const std::uint64_t seed) const;
+    void quantize_tower();
+    void calibrate_int8();
+    // One copy of the weights per NUMA node, each built by a thread on
+    // its node so that its pages are local.
+    void replicate_weights();
+    void copy_weights(const Network& other);
+    // The replica of the node of the calling thread, or this network.
+    Network& local_replica();
+#endif
+
+    // Input + residual block tower, batchnorm is folded into the filters
+    std::vector<std::vector<float>> m_conv_weights;
+    std::vector<std::vector<float>> m_conv_biases;
+    // Winograd transformed filters, and packed for the built-in SGEMM
+    std::vector<HugePages::vector<float>> m_conv_winograd;
+    std::vector<HugePages::vector<float>> m_conv_winograd_packed;
+    // The same for F(4x4, 3x3)
+    std::vector<HugePages::vector<float>> m_conv_winograd4;
+    std::vector<HugePages::vector<float>> m_conv_winograd4_packed;
+    // Packed in half precision
+    std::vector<HugePages::vector<Sgemm::half_t>> m_conv_winograd_half;
+    std::vector<HugePages::vector<Sgemm::half_t>> m_conv_winograd4_half;
+    std::vector<std::vector<float>> m_batchnorm_means;
+    std::vector<std::vector<float>> m_batchnorm_stddivs;
+
+    // Policy head
+    std::vector<float> m_conv_pol_w;
+    std::vector<float> m_conv_pol_b;
+    std::array<float, 2> m_bn_pol_w1;
+    std::array<float, 2> m_bn_pol_w2;
+
+    std::vector<float> m_ip_pol_w;
+    std::vector<float> m_ip_pol_b;
+
+    // Value head
+    std::vector<float> m_conv_val_w;
+    std::vector<float> m_conv_val_b;
+    std::array<float, 1> m_bn_val_w1;
+    std::array<float, 1> m_bn_val_w2;
+
+    std::vector<float> m_ip1_val_w;
+    std::vector<float> m_ip1_val_b;
+
+    std::vector<float> m_ip2_val_w;
+    std::vector<float> m_ip2_val_b;
+
+    // Board size the weights were trained for
+    int m_boardsize{BOARD_SIZE};
+
+    // 8-bit residual tower, m_conv_int8[i] is layer i + 1
+    std::vector<Int8::Conv3> m_conv_int8;
+    bool m_use_int8{false};
+    // Largest input of every layer of it while calibrating
+    std::vector<float> m_int8_calibration;
+
+    // Tuned CPU convolution algorithm for the input and the residual
+    // layers, for single positions and for batches.
+    std::array<std::array<CPUTuner::algorithm_t, 2>, 2> m_conv_plan;
+
+    // Forward passes in flight. A lone one splits its convolutions over
+    // the NN threads, concurrent ones already keep the cores busy.
+    std::atomic<int> m_forwards{0};
+    // Replicas count in the network they copy
+    Network* m_primary{this};
+    std::vector<std::unique_ptr<Network>> m_replicas;
+    std::atomic<std::uint64_t> m_evaluations{0};
+
+    // Evaluates instead of the weights if set (--nn-backend)
+    std::unique_ptr<NNBackend> m_backend;
+    // Logs the evaluations if set (--nn-record)
+    std::unique_ptr<EvalRecorder> m_recorder;
+
+    // Rotation helper
+    std::array<std::array<int, BOARD_SQUARES>, 8> m_rotate_nn_idx_table;
 
+    // Evaluations are cached per network, positions alone don't identify them.
+    std::unique_ptr<NNCache> m_nncache;
+#ifdef USE_OPENCL
+    std::unique_ptr<OpenCLScheduler> m_opencl;
 #endif
 };
 
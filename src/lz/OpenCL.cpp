@@ -37,6 +37,7 @@
 
 #include "Network.h"
 #include "GTP.h"
+#include "Trace.h"
 #include "Utils.h"
 #include "Tuner.h"
 
@@ -49,8 +50,7 @@ static std::string sourceCode_config = R"(
     typedef float net_t;
     #define vload_net_t(offset,p) ((p)[(offset)])
     #define vstore_net_t(data,offset,p) (((p)[(offset)])=(data))
-    #define BOARD_SIZE )" + std::to_string(BOARD_SIZE) +
-    "\n    #define BOARD_SQUARES " + std::to_string(BOARD_SQUARES);
+)";
 
 static std::string sourceCode_convolve1 = R"(
     __kernel
@@ -261,8 +261,7 @@ __kernel void out_transform_fused_bn(__global const float * restrict M,
                                      const int K,
                                      const int Kpad, const int Ppad,
                                      __global const net_t * restrict residual,
-                                     __constant const net_t * restrict means,
-                                     __constant const net_t * restrict stddivs) {
+                                     __constant const net_t * restrict biases) {
     const int W = BOARD_SIZE;
     const int H = BOARD_SIZE;
     const int WTILES = (W + 1) / 2;
@@ -282,8 +281,7 @@ __kernel void out_transform_fused_bn(__global const float * restrict M,
         float o[4];
         __out_transform_eq(M, o, Kpad, Ppad, block_x, block_y);
 
-        const float mean = vload_net_t(k, means);
-        const float scale_stddiv = vload_net_t(k, stddivs);
+        const float bias = vload_net_t(k, biases);
 
         const bool pred[4] = { 1, x+1 < W, y+1 < H, x+1 < W & y+1 < H};
 
@@ -291,7 +289,7 @@ __kernel void out_transform_fused_bn(__global const float * restrict M,
 
         for (int i = 0; i < 4; i++) {
             if (pred[i]) {
-                o[i] = scale_stddiv * (o[i] - mean);
+                o[i] = o[i] + bias;
                 if (residual) {
                     o[i] += vload_net_t(kHW + a[i], residual);
                 }
@@ -309,8 +307,7 @@ __kernel void out_transform_fused_bn_in(
                                      const int K,
                                      const int Kpad, const int Ppad, const int Cpad,
                                      __global const net_t * restrict residual,
-                                     __constant const net_t * restrict means,
-                                     __constant const net_t * restrict stddivs,
+                                     __constant const net_t * restrict biases,
                                      __local float * ybuf) {
     const int W = BOARD_SIZE;
     const int H = BOARD_SIZE;
@@ -343,12 +340,11 @@ __kernel void out_transform_fused_bn_in(
         float o[4];
         __out_transform_eq(M, o, Kpad, Ppad, block_x, block_y);
 
-        const float mean = vload_net_t(k, means);
-        const float scale_stddiv = vload_net_t(k, stddivs);
+        const float bias = vload_net_t(k, biases);
 
         for (int i = 0; i < 4; i++) {
             if (pred[i]) {
-                o[i] = scale_stddiv * (o[i] - mean);
+                o[i] = o[i] + bias;
                 if (residual) {
                     o[i] += vload_net_t(kHW + a[i], residual);
                 }
@@ -429,6 +425,7 @@ void OpenCL_Network::add_weights(size_t layer,
     }
 
     auto weightSize = size * sizeof(decltype(converted_weights)::value_type);
+    m_weight_bytes += weightSize;
     m_layers.back().weights.emplace_back(
         m_opencl.m_context,
         CL_MEM_COPY_HOST_PTR | CL_MEM_READ_ONLY,
@@ -439,10 +436,11 @@ void OpenCL_Network::add_weights(size_t layer,
 void OpenCL_Network::forward(const std::vector<net_t>& input,
                              std::vector<net_t>& output_pol,
                              std::vector<net_t>& output_val) {
-    constexpr auto width = BOARD_SIZE;
-    constexpr auto height = BOARD_SIZE;
-    constexpr auto tiles = WINOGRAD_P;
-    constexpr auto one_plane = width * height * sizeof(net_t);
+    Trace::Scope traced("OpenCL_Network::forward", "nn");
+    const auto width = m_opencl.m_board_size;
+    const auto height = m_opencl.m_board_size;
+    const auto tiles = m_opencl.get_winograd_p();
+    const auto one_plane = width * height * sizeof(net_t);
     const auto finalSize_pol = m_layers[m_layers.size()-2].outputs * one_plane;
     const auto finalSize_val = m_layers.back().outputs * one_plane;
 
@@ -511,7 +509,7 @@ void OpenCL_Network::forward(const std::vector<net_t>& input,
         if (layer.is_input_convolution) {
             assert(niter != cend(m_layers));
             auto conv_weights = begin(layer.weights);
-            auto bn_weights = begin(layer.weights) + 1;
+            auto biases = begin(layer.weights) + 1;
             auto skip_next_in_trans = false;
             if (niter->is_residual_block) {
                 skip_next_in_trans = true;
@@ -524,16 +522,16 @@ void OpenCL_Network::forward(const std::vector<net_t>& input,
                      MBuffer,
                      conv_weights,
                      nullptr,
-                     bn_weights,
+                     biases,
                      skip_in_trans, skip_next_in_trans, true);
             skip_in_trans = skip_next_in_trans;
         } else if (layer.is_residual_block) {
             assert(layer.channels == layer.outputs);
             assert(niter != cend(m_layers));
             auto conv1_weights = begin(layer.weights);
-            auto bn1_weights   = begin(layer.weights) + 1;
-            auto conv2_weights = begin(layer.weights) + 3;
-            auto bn2_weights   = begin(layer.weights) + 4;
+            auto conv1_biases  = begin(layer.weights) + 1;
+            auto conv2_weights = begin(layer.weights) + 2;
+            auto conv2_biases  = begin(layer.weights) + 3;
             convolve3(layer.channels,
                       layer.outputs,
                       inBuffer,
@@ -542,7 +540,7 @@ void OpenCL_Network::forward(const std::vector<net_t>& input,
                       MBuffer,
                       conv1_weights,
                       nullptr,
-                      bn1_weights,
+                      conv1_biases,
                       skip_in_trans, true, false);
 
             auto skip_next_in_trans = false;
@@ -557,7 +555,7 @@ void OpenCL_Network::forward(const std::vector<net_t>& input,
                       MBuffer,
                       conv2_weights,
                       &inBuffer,
-                      bn2_weights,
+                      conv2_biases,
                       true, skip_next_in_trans, true);
             skip_in_trans = skip_next_in_trans;
         } else {
@@ -610,7 +608,7 @@ void OpenCL_Network::convolve3(int channels, int outputs,
                               cl::Buffer& bufferM,
                               weight_slice_t weights,
                               cl::Buffer* bufferResidual,
-                              weight_slice_t bn_weights,
+                              weight_slice_t biases,
                               bool skip_in_transform,
                               bool fuse_in_transform,
                               bool store_inout) {
@@ -640,9 +638,9 @@ void OpenCL_Network::convolve3(int channels, int outputs,
     assert(vwn != 0);
     assert(wavefront_size != 0);
 
-    constexpr auto tiles = WINOGRAD_P;
-    constexpr auto width = BOARD_SIZE;
-    constexpr auto height = BOARD_SIZE;
+    const auto tiles = m_opencl.get_winograd_p();
+    const auto width = m_opencl.m_board_size;
+    const auto height = m_opencl.m_board_size;
 
     auto wgs = ceilMultiple(tiles, wavefront_size);
     auto m_ceil = int(ceilMultiple(ceilMultiple(outputs, mwg), vwm));
@@ -712,9 +710,8 @@ void OpenCL_Network::convolve3(int channels, int outputs,
             } else {
                 out_transform_bn_in_kernel.setArg(7, nullptr);
             }
-            out_transform_bn_in_kernel.setArg(8, bn_weights[0]);
-            out_transform_bn_in_kernel.setArg(9, bn_weights[1]);
-            out_transform_bn_in_kernel.setArg(10,
+            out_transform_bn_in_kernel.setArg(8, biases[0]);
+            out_transform_bn_in_kernel.setArg(9,
                 cl::Local(dim_size * width * height * sizeof(float)));
 
             queue.enqueueNDRangeKernel(out_transform_bn_in_kernel,
@@ -732,8 +729,7 @@ void OpenCL_Network::convolve3(int channels, int outputs,
             } else {
                 out_transform_bn_kernel.setArg(5, nullptr);
             }
-            out_transform_bn_kernel.setArg(6, bn_weights[0]);
-            out_transform_bn_kernel.setArg(7, bn_weights[1]);
+            out_transform_bn_kernel.setArg(6, biases[0]);
 
             queue.enqueueNDRangeKernel(out_transform_bn_kernel, cl::NullRange,
                                        cl::NDRange(outputs, wgs));
@@ -750,10 +746,10 @@ void OpenCL_Network::convolve1(int channels, int outputs,
                               cl::Buffer& bufferOutput,
                               cl::Buffer& bufferMerge,
                               weight_slice_t weights) {
-    // The size of the board is defined at compile time
-    constexpr int width = BOARD_SIZE;
-    constexpr int boardsize = BOARD_SQUARES;
-    constexpr int rowTiles = BOARD_SIZE;
+    // The size of the board is taken from the network
+    const int width = m_opencl.m_board_size;
+    const int boardsize = width * width;
+    const int rowTiles = width;
 
     // Input channel grouping in multiples of 8
     constexpr int channelGroup = 8;
@@ -806,7 +802,7 @@ void OpenCL_Network::convolve1(int channels, int outputs,
 
         queue.enqueueNDRangeKernel(merge_kernel, cl::NullRange,
                                    cl::NDRange(outputs, boardsize),
-                                   cl::NDRange(std::min(8, outputs), BOARD_SIZE));
+                                   cl::NDRange(std::min(8, outputs), rowTiles));
     } catch (const cl::Error &e) {
         std::cerr << "Error in merge: " << e.what() << ": "
                   << e.err() << std::endl;
@@ -923,8 +919,10 @@ std::vector<size_t> OpenCL::get_sgemm_tuners(void) {
     return tuners;
 }
 
-void OpenCL::initialize(const int channels, const std::vector<int> & gpus,
-                        bool silent) {
+void OpenCL::initialize(const int channels, const int board_size,
+                        const std::vector<int> & gpus, bool silent) {
+    m_board_size = board_size;
+
     std::vector<cl::Platform> platforms;
     try {
         cl::Platform::get(&platforms);
@@ -1050,11 +1048,14 @@ void OpenCL::initialize(const int channels, const std::vector<int> & gpus,
         throw std::runtime_error("Error getting OpenCL kernels.");
     }
 
-    m_cl_args = cl_args;
+    // The kernels are specialized on the board size of the network.
+    m_cl_args = cl_args
+        + " -DBOARD_SIZE=" + std::to_string(m_board_size)
+        + " -DBOARD_SQUARES=" + std::to_string(m_board_size * m_board_size);
 
     auto t = Tuner(*this, m_context, m_device);
     auto sgemm_tuners =
-        t.load_sgemm_tuners(channels, WINOGRAD_P, channels, WINOGRAD_TILE);
+        t.load_sgemm_tuners(channels, get_winograd_p(), channels, WINOGRAD_TILE);
 
     // Exit immediately after tuning. Some NVIDIA drivers are buggy
     // and will fail to compile the rest of the kernels after a tuning
@@ -1065,7 +1066,7 @@ void OpenCL::initialize(const int channels, const std::vector<int> & gpus,
 
     // Build program for these specific devices
     try {
-        std::string args = cl_args;
+        std::string args = m_cl_args;
         args += sgemm_tuners;
         m_program.build(args.c_str());
     } catch (const cl::Error&) {
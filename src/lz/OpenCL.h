@@ -33,7 +33,6 @@
 
 #include "Tuner.h"
 
-static constexpr auto WINOGRAD_P = (BOARD_SIZE + 1) * (BOARD_SIZE + 1) / 4;
 static constexpr auto WINOGRAD_TILE = 4 * 4;
 
 class OpenCL;
@@ -82,12 +81,10 @@ public:
                        unsigned int channels,
                        unsigned int outputs,
                        const std::vector<float>& weights,
-                       const std::vector<float>& means,
-                       const std::vector<float>& variances) {
+                       const std::vector<float>& biases) {
         size_t layer = get_layer_count();
         push_weights(layer, weights);
-        push_weights(layer, means);
-        push_weights(layer, variances);
+        push_weights(layer, biases);
         m_layers[layer].is_input_convolution = true;
         m_layers[layer].outputs = outputs;
         m_layers[layer].filter_size = filter_size;
@@ -98,18 +95,14 @@ public:
                        unsigned int channels,
                        unsigned int outputs,
                        const std::vector<float>& weights_1,
-                       const std::vector<float>& means_1,
-                       const std::vector<float>& variances_1,
+                       const std::vector<float>& biases_1,
                        const std::vector<float>& weights_2,
-                       const std::vector<float>& means_2,
-                       const std::vector<float>& variances_2) {
+                       const std::vector<float>& biases_2) {
         size_t layer = get_layer_count();
         push_weights(layer, weights_1);
-        push_weights(layer, means_1);
-        push_weights(layer, variances_1);
+        push_weights(layer, biases_1);
         push_weights(layer, weights_2);
-        push_weights(layer, means_2);
-        push_weights(layer, variances_2);
+        push_weights(layer, biases_2);
         m_layers[layer].is_residual_block = true;
         m_layers[layer].outputs = outputs;
         m_layers[layer].filter_size = filter_size;
@@ -130,6 +123,11 @@ public:
         return m_layers.size();
     }
 
+    // Bytes of the weight buffers on the device
+    size_t get_weight_bytes() const {
+        return m_weight_bytes;
+    }
+
     void forward(const std::vector<net_t>& input,
             std::vector<net_t>& output_pol,
             std::vector<net_t>& output_val);
@@ -148,7 +146,7 @@ private:
                     cl::Buffer& bufferV,
                     cl::Buffer& bufferM, weight_slice_t weights,
                     cl::Buffer* bufferResidual,
-                    weight_slice_t bn_weights,
+                    weight_slice_t biases,
                     bool skip_in_transform,
                     bool fuse_in_transform, bool store_inout);
 
@@ -166,19 +164,25 @@ private:
     // isn't busy wait so it should be better.
     std::mutex m_queue_finish_mutex;
     std::vector<Layer> m_layers;
+    size_t m_weight_bytes{0};
 };
 
 class OpenCL {
     friend class OpenCL_Network;
     friend class Tuner;
 public:
-    void initialize(const int channels, const std::vector<int> & gpus,
-                    bool silent = false);
+    void initialize(const int channels, const int board_size,
+                    const std::vector<int> & gpus, bool silent = false);
     void ensure_thread_initialized(void);
     std::string get_device_name();
 
     std::vector<size_t> get_sgemm_tuners(void);
 
+    // Number of Winograd tiles covering the board
+    int get_winograd_p() const {
+        return (m_board_size + 1) * (m_board_size + 1) / 4;
+    }
+
     cl::Device m_device;
     cl::Context m_context;
 private:
@@ -187,6 +191,7 @@ private:
 
     cl::Program m_program;
     std::string m_cl_args;
+    int m_board_size{BOARD_SIZE};
 
     struct sgemm_tuners {
         size_t mwg, nwg, kwg;
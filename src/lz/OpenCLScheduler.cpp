@@ -18,21 +18,22 @@
 #include "config.h"
 
 #ifdef USE_OPENCL
+#include <algorithm>
+
 #include "GTP.h"
 #include "Random.h"
 #include "OpenCLScheduler.h"
 
 thread_local auto current_thread_gpu_num = size_t{0};
-OpenCLScheduler opencl;
 
-void OpenCLScheduler::initialize(const int channels) {
+void OpenCLScheduler::initialize(const int channels, const int board_size) {
     // multi-gpu?
     if (!cfg_gpus.empty()) {
         auto silent{false};
         for(auto gpu : cfg_gpus) {
             auto opencl = std::make_unique<OpenCL>();
             auto net = std::make_unique<OpenCL_Network>(*opencl);
-            opencl->initialize(channels, {gpu}, silent);
+            opencl->initialize(channels, board_size, {gpu}, silent);
             m_opencl.push_back(std::move(opencl));
             m_networks.push_back(std::move(net));
 
@@ -58,7 +59,7 @@ void OpenCLScheduler::initialize(const int channels) {
     } else {
         auto opencl = std::make_unique<OpenCL>();
         auto net = std::make_unique<OpenCL_Network>(*opencl);
-        opencl->initialize(channels, {});
+        opencl->initialize(channels, board_size, {});
 
         m_opencl.push_back(std::move(opencl));
         m_networks.push_back(std::move(net));
@@ -67,16 +68,40 @@ void OpenCLScheduler::initialize(const int channels) {
 
 void OpenCLScheduler::forward(const std::vector<net_t>& input,
                               std::vector<net_t>& output_pol,
-                              std::vector<net_t>& output_val) {
+                              std::vector<net_t>& output_val,
+                              const int batch_size) {
+    // A batch is dispatched to one device as a single task, the
+    // positions in it are run back to back on that device's queue.
+    auto forward_batch = [&input, &output_pol, &output_val,
+                          batch_size](OpenCL_Network& network) {
+        if (batch_size == 1) {
+            network.forward(input, output_pol, output_val);
+            return;
+        }
+        const auto in_size = input.size() / batch_size;
+        const auto pol_size = output_pol.size() / batch_size;
+        const auto val_size = output_val.size() / batch_size;
+        auto in = std::vector<net_t>(in_size);
+        auto pol = std::vector<net_t>(pol_size);
+        auto val = std::vector<net_t>(val_size);
+        for (auto n = 0; n < batch_size; n++) {
+            std::copy(begin(input) + n * in_size,
+                      begin(input) + (n + 1) * in_size, begin(in));
+            network.forward(in, pol, val);
+            std::copy(begin(pol), end(pol), begin(output_pol) + n * pol_size);
+            std::copy(begin(val), end(val), begin(output_val) + n * val_size);
+        }
+    };
+
     if (m_networks.size() == 1) {
-        m_networks[0]->forward(input, output_pol, output_val);
+        forward_batch(*m_networks[0]);
         return;
     }
 
-    auto f = m_threadpool.add_task([this, &input, &output_pol, &output_val]{
-        m_networks[current_thread_gpu_num]->forward(input, output_pol, output_val);
+    Utils::ThreadGroup tg(m_threadpool);
+    tg.add_task([this, &forward_batch]{
+        forward_batch(*m_networks[current_thread_gpu_num]);
     });
-
-    f.get();
+    tg.wait_all();
 }
 #endif
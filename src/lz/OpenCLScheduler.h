@@ -28,13 +28,14 @@
 
 class OpenCLScheduler {
 public:
-    void initialize(const int channels);
+    void initialize(const int channels, const int board_size);
     std::vector<std::unique_ptr<OpenCL_Network>> & get_networks() {
         return m_networks;
     }
     void forward(const std::vector<net_t>& input,
                  std::vector<net_t>& output_pol,
-                 std::vector<net_t>& output_val);
+                 std::vector<net_t>& output_val,
+                 const int batch_size = 1);
 private:
     class ForwardTask {
     public:
@@ -52,6 +53,5 @@ private:
     Utils::ThreadPool m_threadpool;
 };
 
-extern OpenCLScheduler opencl;
 
 #endif
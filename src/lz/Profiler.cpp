@@ -0,0 +1,136 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "Profiler.h"
+
+#include <algorithm>
+
+namespace {
+
+thread_local ForwardProfile* t_profile = nullptr;
+
+}
+
+ForwardProfile::ForwardProfile(const int threads)
+    : m_threads(threads), m_previous(t_profile) {
+    t_profile = this;
+}
+
+ForwardProfile::~ForwardProfile() {
+    t_profile = m_previous;
+}
+
+ForwardProfile* ForwardProfile::active() {
+    return t_profile;
+}
+
+int ForwardProfile::threads() const {
+    return m_threads;
+}
+
+bool ForwardProfile::counts_cache_misses() const {
+    // The counter only sees the calling thread, not the NN threads.
+    return m_threads == 1 && m_cache_misses.available();
+}
+
+const std::vector<ForwardProfile::Stage>& ForwardProfile::stages() const {
+    return m_stages;
+}
+
+std::vector<ForwardProfile::Layer> ForwardProfile::layers() const {
+    auto layers = std::vector<Layer>{};
+    for (const auto& stage : m_stages) {
+        auto layer = std::find_if(begin(layers), end(layers),
+            [&stage](const Layer& l) { return l.name == stage.layer; });
+        if (layer == end(layers)) {
+            layers.push_back({stage.layer, 0.0, 0.0});
+            layer = end(layers) - 1;
+        }
+        layer->seconds += stage.seconds;
+    }
+    for (const auto& flops : m_flops) {
+        for (auto& layer : layers) {
+            if (layer.name == flops.first) {
+                layer.flops += flops.second;
+            }
+        }
+    }
+    return layers;
+}
+
+void ForwardProfile::set_layer(const char* name, const int index) {
+    if (!t_profile) {
+        return;
+    }
+    t_profile->m_layer = name;
+    if (index >= 0) {
+        t_profile->m_layer += std::to_string(index);
+    }
+}
+
+void ForwardProfile::add_flops(const double flops) {
+    if (!t_profile) {
+        return;
+    }
+    auto& layers = t_profile->m_flops;
+    const auto& name = t_profile->m_layer;
+    auto layer = std::find_if(begin(layers), end(layers),
+        [&name](const std::pair<std::string, double>& l) {
+            return l.first == name;
+        });
+    if (layer == end(layers)) {
+        layers.emplace_back(name, flops);
+    } else {
+        layer->second += flops;
+    }
+}
+
+ForwardProfile::Stage& ForwardProfile::stage(const std::string& layer,
+                                             const char* stage) {
+    auto it = std::find_if(begin(m_stages), end(m_stages),
+        [&](const Stage& s) { return s.layer == layer && s.stage == stage; });
+    if (it != end(m_stages)) {
+        return *it;
+    }
+    m_stages.push_back({layer, stage, 0.0, 0});
+    return m_stages.back();
+}
+
+ForwardProfile::Scope::Scope(const char* stage)
+    : m_profile(t_profile), m_stage(stage) {
+    if (m_profile) {
+        if (m_profile->counts_cache_misses()) {
+            m_cache_misses = m_profile->m_cache_misses.read();
+        }
+        m_start = std::chrono::steady_clock::now();
+    }
+}
+
+ForwardProfile::Scope::~Scope() {
+    if (!m_profile) {
+        return;
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - m_start;
+    auto& stats = m_profile->stage(m_profile->m_layer, m_stage);
+    stats.seconds += std::chrono::duration<double>(elapsed).count();
+    if (m_profile->counts_cache_misses()) {
+        stats.cache_misses += m_profile->m_cache_misses.read()
+                              - m_cache_misses;
+    }
+}
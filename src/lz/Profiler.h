@@ -0,0 +1,98 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PROFILER_H_INCLUDED
+#define PROFILER_H_INCLUDED
+
+#include "config.h"
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Timing.h"
+
+/*
+    Where the time of network evaluations goes. While a profile is alive
+    on a thread, the evaluations that thread runs record the wall time
+    and cache misses of every stage of every layer into it, and the
+    floating point operations of every layer. Scopes cost a thread local
+    load when no profile is active. Stages that fan out to the NN threads
+    are timed around the whole parallel section. Cache misses are only
+    counted with a single NN thread, the counter sees just one thread.
+*/
+class ForwardProfile {
+public:
+    struct Stage {
+        std::string layer;
+        std::string stage;
+        double seconds;
+        std::uint64_t cache_misses;
+    };
+    struct Layer {
+        std::string name;
+        double seconds;
+        double flops;
+    };
+
+    // Records the evaluations of this thread until destroyed, which run
+    // with the given number of NN threads.
+    explicit ForwardProfile(int threads);
+    ~ForwardProfile();
+    ForwardProfile(const ForwardProfile&) = delete;
+    ForwardProfile& operator=(const ForwardProfile&) = delete;
+
+    static ForwardProfile* active();
+    int threads() const;
+    bool counts_cache_misses() const;
+    const std::vector<Stage>& stages() const;
+    // Stage times summed up per layer, in order of appearance.
+    std::vector<Layer> layers() const;
+
+    // Stages recorded from now on belong to this layer.
+    static void set_layer(const char* name, int index = -1);
+    static void add_flops(double flops);
+
+    class Scope {
+    public:
+        explicit Scope(const char* stage);
+        ~Scope();
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        ForwardProfile* m_profile;
+        const char* m_stage;
+        std::chrono::steady_clock::time_point m_start;
+        std::uint64_t m_cache_misses{0};
+    };
+
+private:
+    Stage& stage(const std::string& layer, const char* stage);
+
+    int m_threads;
+    std::string m_layer;
+    std::vector<Stage> m_stages;
+    // Floating point operations per layer, same order as m_stages
+    std::vector<std::pair<std::string, double>> m_flops;
+    CacheMisses m_cache_misses;
+    ForwardProfile* m_previous;
+};
+
+#endif
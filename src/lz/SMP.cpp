@@ -18,8 +18,21 @@
 
 #include "SMP.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
 #include <thread>
 
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "Telemetry.h"
+
 SMP::Mutex::Mutex() {
     m_lock = false;
 }
@@ -30,7 +43,16 @@ SMP::Lock::Lock(Mutex & m) {
 }
 
 void SMP::Lock::lock() {
-    while (m_mutex->m_lock.exchange(true, std::memory_order_acquire) == true);
+    if (m_mutex->m_lock.exchange(true, std::memory_order_acquire) == false) {
+        return;
+    }
+    // Only the contended path is counted.
+    auto spins = std::uint64_t{0};
+    while (m_mutex->m_lock.exchange(true, std::memory_order_acquire) == true) {
+        spins++;
+    }
+    Telemetry::count(Telemetry::LOCK_CONTENDED);
+    Telemetry::count(Telemetry::LOCK_SPINS, spins);
 }
 
 void SMP::Lock::unlock() {
@@ -41,6 +63,186 @@ SMP::Lock::~Lock() {
     unlock();
 }
 
+namespace {
+
+std::vector<int> read_allowed_cpus() {
+    auto cpus = std::vector<int>{};
+#ifdef __linux__
+    // The process mask, pool threads may be pinned already
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(getpid(), sizeof(set), &set) == 0) {
+        for (auto cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &set)) {
+                cpus.emplace_back(cpu);
+            }
+        }
+    }
+#endif
+    if (cpus.empty()) {
+        const auto count = std::max(1u, std::thread::hardware_concurrency());
+        for (auto cpu = 0; cpu < static_cast<int>(count); cpu++) {
+            cpus.emplace_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+thread_local int t_node = -1;
+
+// "0-3,8-11" to the CPU numbers
+std::vector<int> parse_cpus(const std::string& list) {
+    auto cpus = std::vector<int>{};
+    auto ss = std::istringstream{list};
+    auto range = std::string{};
+    while (std::getline(ss, range, ',')) {
+        const auto dash = range.find('-');
+        try {
+            const auto first = std::stoi(range.substr(0, dash));
+            const auto last = dash == std::string::npos
+                              ? first : std::stoi(range.substr(dash + 1));
+            for (auto cpu = first; cpu <= last; cpu++) {
+                cpus.emplace_back(cpu);
+            }
+        } catch (...) {
+            // Blank line or garbage, nothing to add.
+        }
+    }
+    return cpus;
+}
+
+std::vector<SMP::NumaNode> read_numa_nodes() {
+    auto nodes = std::vector<SMP::NumaNode>{};
+#ifdef __linux__
+    const auto sys = std::string{"/sys/devices/system/node/"};
+    auto online = std::ifstream{sys + "online"};
+    auto list = std::string{};
+    if (std::getline(online, list)) {
+        for (const auto node : parse_cpus(list)) {
+            auto file = std::ifstream{sys + "node" + std::to_string(node)
+                                      + "/cpulist"};
+            auto cpus = std::string{};
+            std::getline(file, cpus);
+            auto parsed = parse_cpus(cpus);
+            const auto& allowed = SMP::get_allowed_cpus();
+            parsed.erase(std::remove_if(begin(parsed), end(parsed),
+                [&allowed](const int cpu) {
+                    return std::find(begin(allowed), end(allowed), cpu)
+                           == end(allowed);
+                }), end(parsed));
+            // Memory only nodes and nodes outside our cpuset have no
+            // CPUs to pin to
+            if (!parsed.empty()) {
+                nodes.push_back({node, std::move(parsed)});
+            }
+        }
+    }
+#endif
+    if (nodes.empty()) {
+        nodes.push_back({0, SMP::get_allowed_cpus()});
+    }
+    return nodes;
+}
+
+#ifdef __linux__
+bool set_affinity(const std::vector<int>& cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (const auto cpu : cpus) {
+        CPU_SET(cpu, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+#endif
+
+}
+
+const std::vector<int>& SMP::get_allowed_cpus() {
+    static const auto cpus = read_allowed_cpus();
+    return cpus;
+}
+
 int SMP::get_num_cpus() {
-    return std::thread::hardware_concurrency();
+    return static_cast<int>(get_allowed_cpus().size());
+}
+
+const std::vector<SMP::NumaNode>& SMP::get_numa_nodes() {
+    static const auto nodes = read_numa_nodes();
+    return nodes;
+}
+
+int SMP::node_of_cpu(const int cpu) {
+    const auto& nodes = get_numa_nodes();
+    for (auto node = size_t{0}; node < nodes.size(); node++) {
+        const auto& cpus = nodes[node].cpus;
+        if (std::find(begin(cpus), end(cpus), cpu) != end(cpus)) {
+            return static_cast<int>(node);
+        }
+    }
+    return 0;
+}
+
+bool SMP::pin_to_cpu(const int cpu) {
+    const auto& allowed = get_allowed_cpus();
+    const auto target = allowed[cpu % allowed.size()];
+#ifdef __linux__
+    if (set_affinity({target})) {
+        t_node = node_of_cpu(target);
+        return true;
+    }
+#else
+    (void)target;
+#endif
+    return false;
+}
+
+bool SMP::pin_to_node(const int node) {
+    const auto& nodes = get_numa_nodes();
+    const auto target = node % static_cast<int>(nodes.size());
+#ifdef __linux__
+    if (set_affinity(nodes[target].cpus)) {
+        t_node = target;
+        return true;
+    }
+#else
+    (void)target;
+#endif
+    return false;
+}
+
+int SMP::current_node() {
+    return t_node;
+}
+
+int SMP::node_of_address(const void* address) {
+#if defined(__linux__) && defined(SYS_move_pages)
+    // With no target nodes move_pages only reports where pages are.
+    const auto page_size = static_cast<std::uintptr_t>(sysconf(_SC_PAGESIZE));
+    void* page = reinterpret_cast<void*>(
+        reinterpret_cast<std::uintptr_t>(address) & ~(page_size - 1));
+    auto status = -1;
+    if (syscall(SYS_move_pages, 0, 1, &page, nullptr, &status, 0) == 0
+        && status >= 0) {
+        return status;
+    }
+#else
+    (void)address;
+#endif
+    return -1;
+}
+
+std::string SMP::format_cpus(const std::vector<int>& cpus) {
+    auto out = std::ostringstream{};
+    for (auto i = size_t{0}; i < cpus.size(); ) {
+        auto j = i;
+        while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) {
+            j++;
+        }
+        out << (i ? "," : "") << cpus[i];
+        if (j > i) {
+            out << "-" << cpus[j];
+        }
+        i = j + 1;
+    }
+    return out.str();
 }
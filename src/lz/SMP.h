@@ -22,10 +22,36 @@
 #include "config.h"
 
 #include <atomic>
+#include <string>
+#include <vector>
 
 namespace SMP {
+    // CPUs the process may run on (taskset, cpusets), read once.
+    const std::vector<int>& get_allowed_cpus();
     int get_num_cpus();
 
+    struct NumaNode {
+        // Number the kernel gives the node, there can be gaps
+        int id;
+        std::vector<int> cpus;
+    };
+    // The NUMA nodes with CPUs, a single node with all CPUs where the
+    // topology is unknown. Everywhere else nodes are indices into this.
+    const std::vector<NumaNode>& get_numa_nodes();
+    int node_of_cpu(int cpu);
+    // Pin the calling thread to one of the allowed CPUs, or to all CPUs
+    // of a node, both modulo the count. False if that is not supported.
+    bool pin_to_cpu(int cpu);
+    bool pin_to_node(int node);
+    // Node the calling thread is pinned to, -1 if it is not.
+    int current_node();
+    // Kernel id (NumaNode::id) of the node of the page holding address,
+    // -1 if unknown. Pages land on the node of the thread touching them
+    // first.
+    int node_of_address(const void* address);
+    // "0-3,8-11"
+    std::string format_cpus(const std::vector<int>& cpus);
+
     class Mutex {
     public:
         Mutex();
@@ -0,0 +1,459 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "Sgemm.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#ifdef USE_CBLAS
+#ifdef __APPLE__
+#include <Accelerate/Accelerate.h>
+#endif
+#ifdef USE_MKL
+#include <mkl.h>
+#endif
+#ifdef USE_OPENBLAS
+#include <cblas.h>
+#endif
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SGEMM_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+#include "CPUKernels.h"
+#include "Memory.h"
+
+namespace {
+
+/*
+    A microkernel computes one full MR x NR block of C = A^T * B over all
+    input channels. a is a packed panel (channels x MR), b is channels x NR
+    with row stride ldb, the block is stored to c with row stride ldc.
+    Every CPU gets one MR and a few widths, the narrower ones keep the
+    zero padding small for the last column blocks.
+*/
+using kernel_t = void (*)(const float* a, const float* b, int ldb,
+                          int channels, float* c, int ldc);
+
+struct Microkernel {
+    kernel_t kernel;
+    int nr;
+};
+
+struct KernelSet {
+    int mr;
+    // Widest first.
+    std::vector<Microkernel> kernels;
+    const char* name;
+};
+
+// The largest MR and NR of any kernel, sizes the edge buffers.
+constexpr auto MAX_MR = 8;
+
+constexpr auto MAX_NR = 32;
+
+template <int MR, int NR>
+void kernel_generic(const float* a, const float* b, const int ldb,
+                    const int channels, float* c, const int ldc) {
+    float acc[MR][NR] = {};
+    for (auto i = 0; i < channels; i++) {
+        const auto brow = b + i * ldb;
+        for (auto r = 0; r < MR; r++) {
+            const auto ar = a[i * MR + r];
+            for (auto j = 0; j < NR; j++) {
+                acc[r][j] += ar * brow[j];
+            }
+        }
+    }
+    for (auto r = 0; r < MR; r++) {
+        std::copy(acc[r], acc[r] + NR, c + r * ldc);
+    }
+}
+
+#ifdef SGEMM_X86_KERNELS
+// MR x (8 * NV): MR rows of NV ymm accumulators.
+template <int MR, int NV>
+__attribute__((target("avx2,fma")))
+void kernel_avx2(const float* a, const float* b, const int ldb,
+                 const int channels, float* c, const int ldc) {
+    __m256 acc[MR][NV];
+    for (auto r = 0; r < MR; r++) {
+        for (auto v = 0; v < NV; v++) {
+            acc[r][v] = _mm256_setzero_ps();
+        }
+    }
+    for (auto i = 0; i < channels; i++) {
+        __m256 bv[NV];
+        for (auto v = 0; v < NV; v++) {
+            bv[v] = _mm256_loadu_ps(b + i * ldb + 8 * v);
+        }
+        for (auto r = 0; r < MR; r++) {
+            const auto ar = _mm256_set1_ps(a[i * MR + r]);
+            for (auto v = 0; v < NV; v++) {
+                acc[r][v] = _mm256_fmadd_ps(ar, bv[v], acc[r][v]);
+            }
+        }
+    }
+    for (auto r = 0; r < MR; r++) {
+        for (auto v = 0; v < NV; v++) {
+            _mm256_storeu_ps(c + r * ldc + 8 * v, acc[r][v]);
+        }
+    }
+}
+
+// Same layout with zmm registers, MR x (16 * NV).
+template <int MR, int NV>
+__attribute__((target("avx512f")))
+void kernel_avx512(const float* a, const float* b, const int ldb,
+                   const int channels, float* c, const int ldc) {
+    __m512 acc[MR][NV];
+    for (auto r = 0; r < MR; r++) {
+        for (auto v = 0; v < NV; v++) {
+            acc[r][v] = _mm512_setzero_ps();
+        }
+    }
+    for (auto i = 0; i < channels; i++) {
+        __m512 bv[NV];
+        for (auto v = 0; v < NV; v++) {
+            bv[v] = _mm512_loadu_ps(b + i * ldb + 16 * v);
+        }
+        for (auto r = 0; r < MR; r++) {
+            const auto ar = _mm512_set1_ps(a[i * MR + r]);
+            for (auto v = 0; v < NV; v++) {
+                acc[r][v] = _mm512_fmadd_ps(ar, bv[v], acc[r][v]);
+            }
+        }
+    }
+    for (auto r = 0; r < MR; r++) {
+        for (auto v = 0; v < NV; v++) {
+            _mm512_storeu_ps(c + r * ldc + 16 * v, acc[r][v]);
+        }
+    }
+}
+#endif
+
+KernelSet select_kernels() {
+#ifdef SGEMM_X86_KERNELS
+    if (CPUKernels::isa() >= CPUKernels::AVX512) {
+        // 16 of the 32 zmm registers accumulate.
+        return {8, {{kernel_avx512<8, 2>, 32}, {kernel_avx512<8, 1>, 16},
+                    {kernel_avx2<8, 1>, 8}}, "AVX-512 8x32"};
+    }
+    if (CPUKernels::isa() >= CPUKernels::AVX2) {
+        // 12 of the 16 ymm registers accumulate.
+        return {6, {{kernel_avx2<6, 2>, 16}, {kernel_avx2<6, 1>, 8}},
+                "AVX2 6x16"};
+    }
+#endif
+    return {6, {{kernel_generic<6, 16>, 16}, {kernel_generic<6, 8>, 8}},
+            "generic 6x16"};
+}
+
+const KernelSet& kernel_set() {
+    static const auto kernels = select_kernels();
+    return kernels;
+}
+
+// The widest kernel that fits in n columns, or the narrowest one.
+const Microkernel& pick_kernel(const KernelSet& set, const int n) {
+    for (const auto& uk : set.kernels) {
+        if (uk.nr <= n) {
+            return uk;
+        }
+    }
+    return set.kernels.back();
+}
+
+// M = U^T * V for one tile, a_tile holds its packed panels.
+void multiply_tile(const KernelSet& set, const float* a_tile,
+                   const float* b_tile, float* m_tile,
+                   const int C, const int K, const int P) {
+    const auto MR = set.mr;
+    const auto panels = (K + MR - 1) / MR;
+
+    // Column blocks of V are copied to a contiguous buffer before use,
+    // rows of V are P apart and would otherwise each touch another page.
+    // A last block narrower than every kernel is zero padded, so the
+    // microkernels only ever see full blocks.
+    thread_local std::vector<float> b_pack;
+    if (b_pack.size() < static_cast<size_t>(C * MAX_NR)) {
+        Memory::resize_workspace(b_pack, C * MAX_NR);
+    }
+    float c_edge[MAX_MR * MAX_NR];
+
+    // A column block of V stays in cache while every panel of U streams
+    // past it.
+    for (auto p0 = 0; p0 < P; ) {
+        const auto& uk = pick_kernel(set, P - p0);
+        const auto nr = uk.nr;
+        const auto n = std::min(nr, P - p0);
+        const auto b = b_pack.data();
+        for (auto c = 0; c < C; c++) {
+            const auto src = b_tile + c * P + p0;
+            std::copy(src, src + n, b + c * nr);
+            std::fill(b + c * nr + n, b + (c + 1) * nr, 0.0f);
+        }
+        for (auto panel = 0; panel < panels; panel++) {
+            const auto k0 = panel * MR;
+            const auto m = std::min(MR, K - k0);
+            const auto a = a_tile + panel * C * MR;
+            const auto c = m_tile + k0 * P + p0;
+            if (m == MR && n == nr) {
+                uk.kernel(a, b, nr, C, c, P);
+            } else {
+                uk.kernel(a, b, nr, C, c_edge, nr);
+                for (auto r = 0; r < m; r++) {
+                    std::copy(c_edge + r * nr, c_edge + r * nr + n,
+                              c + r * P);
+                }
+            }
+        }
+        p0 += n;
+    }
+}
+
+Sgemm::half_t float_to_half(const float f) {
+    auto x = std::uint32_t{0};
+    std::memcpy(&x, &f, sizeof(x));
+    const auto sign = static_cast<std::uint32_t>((x >> 16) & 0x8000);
+    x &= 0x7fffffff;
+    if (x >= 0x7f800000) {
+        // Inf stays inf, NaN stays NaN
+        return sign | 0x7c00 | (x > 0x7f800000 ? 0x200 : 0);
+    }
+    if (x >= 0x477ff000) {
+        // Rounds past 65504
+        return sign | 0x7c00;
+    }
+    if (x < 0x38800000) {
+        // Subnormal halves, in units of 2^-24
+        if (x < 0x33000000) {
+            return sign;
+        }
+        const auto shift = 126 - (x >> 23);
+        const auto m = (x & 0x7fffff) | 0x800000;
+        auto h = m >> shift;
+        const auto rem = m & ((1u << shift) - 1);
+        const auto halfway = 1u << (shift - 1);
+        if (rem > halfway || (rem == halfway && (h & 1))) {
+            h++;
+        }
+        return sign | h;
+    }
+    // Rebias the exponent and round away 13 mantissa bits, a carry
+    // into the exponent is still correct.
+    auto h = (x - 0x38000000) >> 13;
+    const auto rem = x & 0x1fff;
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) {
+        h++;
+    }
+    return sign | h;
+}
+
+float half_to_float(const Sgemm::half_t h) {
+    const auto sign = static_cast<std::uint32_t>(h & 0x8000) << 16;
+    const auto exponent = (h >> 10) & 0x1f;
+    const auto mantissa = static_cast<std::uint32_t>(h & 0x3ff);
+    auto x = std::uint32_t{0};
+    if (exponent == 0) {
+        const auto f = mantissa * (1.0f / 16777216.0f);
+        return sign ? -f : f;
+    } else if (exponent == 0x1f) {
+        x = sign | 0x7f800000 | (mantissa << 13);
+    } else {
+        x = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+    auto f = 0.0f;
+    std::memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+#ifdef SGEMM_X86_KERNELS
+__attribute__((target("avx,f16c")))
+void to_float_f16c(const Sgemm::half_t* src, float* dst, const size_t n) {
+    auto i = size_t{0};
+    for (; i + 8 <= n; i += 8) {
+        const auto h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(h));
+    }
+    for (; i < n; i++) {
+        dst[i] = half_to_float(src[i]);
+    }
+}
+#endif
+
+bool have_f16c() {
+#ifdef SGEMM_X86_KERNELS
+    static const auto f16c = [] {
+        __builtin_cpu_init();
+        return CPUKernels::isa() >= CPUKernels::AVX2
+               && __builtin_cpu_supports("f16c");
+    }();
+    return f16c;
+#else
+    return false;
+#endif
+}
+
+}
+
+bool Sgemm::have_blas() {
+#ifdef USE_CBLAS
+    return true;
+#else
+    return false;
+#endif
+}
+
+const char* Sgemm::kernel_name() {
+    return kernel_set().name;
+}
+
+void Sgemm::sgemm(const bool trans_a, const int M, const int N, const int K,
+                  const float* A, const int lda,
+                  const float* B, const int ldb,
+                  float* C, const int ldc) {
+#ifdef USE_CBLAS
+    cblas_sgemm(CblasRowMajor, trans_a ? CblasTrans : CblasNoTrans,
+                CblasNoTrans,
+                M, N, K,
+                1.0f, A, lda,
+                B, ldb,
+                0.0f, C, ldc);
+#else
+    for (auto m = 0; m < M; m++) {
+        const auto crow = C + m * ldc;
+        std::fill(crow, crow + N, 0.0f);
+        for (auto k = 0; k < K; k++) {
+            const auto a = trans_a ? A[k * lda + m] : A[m * lda + k];
+            const auto brow = B + k * ldb;
+            for (auto n = 0; n < N; n++) {
+                crow[n] += a * brow[n];
+            }
+        }
+    }
+#endif
+}
+
+void Sgemm::sgemv(const int M, const int N,
+                  const float* A, const float* x, float* y) {
+#ifdef USE_CBLAS
+    cblas_sgemv(CblasRowMajor, CblasNoTrans,
+                M, N,
+                1.0f, A, N,
+                x, 1,
+                0.0f, y, 1);
+#else
+    for (auto m = 0; m < M; m++) {
+        auto sum = 0.0f;
+        for (auto n = 0; n < N; n++) {
+            sum += A[m * N + n] * x[n];
+        }
+        y[m] = sum;
+    }
+#endif
+}
+
+HugePages::vector<float> Sgemm::pack_winograd_U(
+    const HugePages::vector<float>& U, const int tiles, const int C,
+    const int K) {
+    assert(U.size() == static_cast<size_t>(tiles) * C * K);
+    // Per tile: K rounded up to MR panels, each panel C rows of MR
+    // output channels, padded with zeroes.
+    const auto MR = kernel_set().mr;
+    const auto panels = (K + MR - 1) / MR;
+    auto packed = HugePages::vector<float>(tiles * panels * C * MR);
+    auto out = begin(packed);
+    for (auto t = 0; t < tiles; t++) {
+        for (auto p = 0; p < panels; p++) {
+            for (auto c = 0; c < C; c++) {
+                for (auto r = 0; r < MR; r++) {
+                    const auto k = p * MR + r;
+                    *out++ = k < K ? U[(t * C + c) * K + k] : 0.0f;
+                }
+            }
+        }
+    }
+    return packed;
+}
+
+int Sgemm::packed_channels(const std::size_t packed_size, const int tiles,
+                           const int K) {
+    const auto MR = kernel_set().mr;
+    const auto panels = (K + MR - 1) / MR;
+    return packed_size / (tiles * panels * MR);
+}
+
+void Sgemm::winograd_sgemm(const HugePages::vector<float>& Upacked,
+                           const float* V, float* M,
+                           const int tiles, const int C, const int K,
+                           const int P, const int first_tile,
+                           const int last_tile) {
+    const auto& set = kernel_set();
+    const auto tile_size = ((K + set.mr - 1) / set.mr) * C * set.mr;
+    assert(Upacked.size() == static_cast<size_t>(tiles) * tile_size);
+    (void)tiles;
+
+    for (auto t = first_tile; t < last_tile; t++) {
+        multiply_tile(set, Upacked.data() + t * tile_size,
+                      V + t * C * P, M + t * K * P, C, K, P);
+    }
+}
+
+void Sgemm::winograd_sgemm(const HugePages::vector<half_t>& Upacked,
+                           const float* V, float* M,
+                           const int tiles, const int C, const int K,
+                           const int P, const int first_tile,
+                           const int last_tile) {
+    const auto& set = kernel_set();
+    const auto tile_size = ((K + set.mr - 1) / set.mr) * C * set.mr;
+    assert(Upacked.size() == static_cast<size_t>(tiles) * tile_size);
+    (void)tiles;
+
+    // The floats of one tile stay in L2 while all column blocks of
+    // V[t] go past them.
+    thread_local std::vector<float> a_tile;
+    Memory::resize_workspace(a_tile, tile_size);
+    for (auto t = first_tile; t < last_tile; t++) {
+        to_float(Upacked.data() + t * tile_size, a_tile.data(), tile_size);
+        multiply_tile(set, a_tile.data(), V + t * C * P, M + t * K * P,
+                      C, K, P);
+    }
+}
+
+HugePages::vector<Sgemm::half_t> Sgemm::to_half(
+    const HugePages::vector<float>& v) {
+    auto h = HugePages::vector<half_t>(v.size());
+    std::transform(begin(v), end(v), begin(h), float_to_half);
+    return h;
+}
+
+void Sgemm::to_float(const half_t* src, float* dst, const std::size_t n) {
+#ifdef SGEMM_X86_KERNELS
+    if (have_f16c()) {
+        to_float_f16c(src, dst, n);
+        return;
+    }
+#endif
+    std::transform(src, src + n, dst, half_to_float);
+}
@@ -0,0 +1,84 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SGEMM_H_INCLUDED
+#define SGEMM_H_INCLUDED
+
+#include "config.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "HugePages.h"
+
+/*
+    Matrix multiplies for the CPU network backend. All matrices are
+    row-major. When built with a BLAS library the generic entry points
+    forward to it, otherwise a simple built-in version is used.
+
+    The Winograd convolutions additionally have a built-in blocked
+    SGEMM: U is packed once at load time into panels of output channels
+    for the register-blocked microkernel picked for the running CPU, and
+    all tiles are multiplied in one loop nest. The packed filters can
+    also be kept in half precision, which halves their footprint and the
+    memory traffic of streaming them. Every tile is then converted back
+    to floats, with F16C when the CPU has it, right before it is used.
+*/
+namespace Sgemm {
+    enum backend_t {
+        AUTO = -1, BUILTIN = 0, BLAS = 1
+    };
+    // IEEE 754 half precision bits
+    using half_t = std::uint16_t;
+
+    // Whether we were built against an external BLAS library.
+    bool have_blas();
+    // Name of the microkernel the built-in Winograd SGEMM uses.
+    const char* kernel_name();
+
+    // C[M x N] = op(A) * B, op(A) is A (M x K) or A^T with A stored K x M.
+    void sgemm(bool trans_a, int M, int N, int K,
+               const float* A, int lda,
+               const float* B, int ldb,
+               float* C, int ldc);
+    // y[M] = A[M x N] * x
+    void sgemv(int M, int N, const float* A, const float* x, float* y);
+
+    // Pack the transformed filters U (tiles x C x K) for winograd_sgemm.
+    HugePages::vector<float> pack_winograd_U(
+        const HugePages::vector<float>& U, int tiles, int C, int K);
+    // Number of input channels of a packed U.
+    int packed_channels(std::size_t packed_size, int tiles, int K);
+    // M[t] = U[t]^T * V[t] for the tiles first_tile <= t < last_tile,
+    // with V[t] C x P.
+    void winograd_sgemm(const HugePages::vector<float>& Upacked,
+                        const float* V, float* M,
+                        int tiles, int C, int K, int P,
+                        int first_tile, int last_tile);
+    void winograd_sgemm(const HugePages::vector<half_t>& Upacked,
+                        const float* V, float* M,
+                        int tiles, int C, int K, int P,
+                        int first_tile, int last_tile);
+
+    // Round to nearest even, and back.
+    HugePages::vector<half_t> to_half(const HugePages::vector<float>& v);
+    void to_float(const half_t* src, float* dst, std::size_t n);
+}
+
+#endif
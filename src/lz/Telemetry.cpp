@@ -0,0 +1,227 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "Telemetry.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+
+using namespace Telemetry;
+
+namespace {
+
+// Layout of the values of a slot
+constexpr auto LATENCY = int{COUNTERS};
+constexpr auto DEPTH = LATENCY + LATENCY_BUCKETS;
+constexpr auto VALUES = DEPTH + DEPTH_BUCKETS;
+
+using Values = std::array<std::uint64_t, VALUES>;
+
+struct Slot {
+    // Only ever written by the owning thread
+    std::array<std::atomic<std::uint64_t>, VALUES> values{};
+};
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Slot>> slots;
+    std::chrono::steady_clock::time_point start{
+        std::chrono::steady_clock::now()};
+};
+
+Registry& registry() {
+    // Never destroyed, tree nodes are still freed by static destructors.
+    static auto registry = new Registry;
+    return *registry;
+}
+
+thread_local Slot* t_slot = nullptr;
+
+void add(const int index, const std::uint64_t amount) {
+    if (!t_slot) {
+        auto& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        reg.slots.emplace_back(std::make_unique<Slot>());
+        t_slot = reg.slots.back().get();
+    }
+    auto& value = t_slot->values[index];
+    value.store(value.load(std::memory_order_relaxed) + amount,
+                std::memory_order_relaxed);
+}
+
+int latency_bucket(std::uint64_t micros) {
+    auto bucket = 0;
+    while (micros && bucket < LATENCY_BUCKETS - 1) {
+        micros >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+// Upper bound of the bucket holding the given fraction of the counts.
+double percentile(const Values& values, const double fraction) {
+    auto total = std::uint64_t{0};
+    for (auto b = 0; b < LATENCY_BUCKETS; b++) {
+        total += values[LATENCY + b];
+    }
+    auto seen = std::uint64_t{0};
+    for (auto b = 0; b < LATENCY_BUCKETS; b++) {
+        seen += values[LATENCY + b];
+        if (seen > 0 && seen >= fraction * total) {
+            return static_cast<double>(std::uint64_t{1} << b);
+        }
+    }
+    return 0.0;
+}
+
+}
+
+void Telemetry::count(const counter_t counter, const std::uint64_t amount) {
+    add(counter, amount);
+}
+
+void Telemetry::nn_eval(const std::uint64_t micros) {
+    add(NN_EVALS, 1);
+    add(NN_MICROS, micros);
+    add(LATENCY + latency_bucket(micros), 1);
+}
+
+void Telemetry::leaf_depth(const int depth) {
+    add(DEPTH + std::min(std::max(depth, 0), DEPTH_BUCKETS - 1), 1);
+}
+
+Telemetry::SearchScope::~SearchScope() {
+    const auto elapsed = std::chrono::steady_clock::now() - m_start;
+    add(SEARCH_MICROS, std::chrono::duration_cast<
+        std::chrono::microseconds>(elapsed).count());
+}
+
+Report Telemetry::snapshot() {
+    auto& reg = registry();
+    auto report = Report{};
+    auto totals = Values{};
+    auto threads = 0;
+    auto rate = 0.0;
+    {
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        const auto elapsed = std::chrono::steady_clock::now() - reg.start;
+        report.emplace_back("uptime_s", std::chrono::duration<double>(
+                                            elapsed).count());
+        for (auto i = size_t{0}; i < reg.slots.size(); i++) {
+            const auto& slot = *reg.slots[i];
+            auto values = Values{};
+            for (auto j = 0; j < VALUES; j++) {
+                values[j] = slot.values[j].load(std::memory_order_relaxed);
+                totals[j] += values[j];
+            }
+            if (!values[SEARCH_MICROS]) {
+                continue;
+            }
+            const auto thread_rate =
+                values[PLAYOUTS] * 1e6 / values[SEARCH_MICROS];
+            const auto prefix = "thread." + std::to_string(i) + ".";
+            report.emplace_back(prefix + "playouts", values[PLAYOUTS]);
+            report.emplace_back(prefix + "playouts_per_s", thread_rate);
+            report.emplace_back(prefix + "nn_evals", values[NN_EVALS]);
+            threads++;
+            rate += thread_rate;
+        }
+    }
+    report.emplace_back("search_threads", threads);
+    report.emplace_back("playouts", totals[PLAYOUTS]);
+    report.emplace_back("playouts_per_s", rate);
+
+    report.emplace_back("nn.evals", totals[NN_EVALS]);
+    report.emplace_back("nn.latency_us.mean", totals[NN_EVALS]
+        ? static_cast<double>(totals[NN_MICROS]) / totals[NN_EVALS] : 0.0);
+    report.emplace_back("nn.latency_us.p50", percentile(totals, 0.50));
+    report.emplace_back("nn.latency_us.p90", percentile(totals, 0.90));
+    report.emplace_back("nn.latency_us.p99", percentile(totals, 0.99));
+    for (auto b = 0; b < LATENCY_BUCKETS; b++) {
+        if (totals[LATENCY + b]) {
+            const auto bound = std::to_string(std::uint64_t{1} << b);
+            report.emplace_back(b < LATENCY_BUCKETS - 1
+                                ? "nn.latency_us.lt_" + bound
+                                : "nn.latency_us.ge_" + bound,
+                                totals[LATENCY + b]);
+        }
+    }
+
+    report.emplace_back("nodes.allocated", totals[NODES_ALLOCATED]);
+    report.emplace_back("nodes.freed", totals[NODES_FREED]);
+    report.emplace_back("vl_collisions", totals[VL_COLLISIONS]);
+    report.emplace_back("lock.contended", totals[LOCK_CONTENDED]);
+    report.emplace_back("lock.spins", totals[LOCK_SPINS]);
+
+    auto leaves = std::uint64_t{0};
+    auto depths = 0.0;
+    auto deepest = 0;
+    for (auto d = 0; d < DEPTH_BUCKETS; d++) {
+        leaves += totals[DEPTH + d];
+        depths += static_cast<double>(d) * totals[DEPTH + d];
+        if (totals[DEPTH + d]) {
+            deepest = d;
+        }
+    }
+    report.emplace_back("depth.mean", leaves ? depths / leaves : 0.0);
+    report.emplace_back("depth.max", deepest);
+    for (auto d = 0; d < DEPTH_BUCKETS; d++) {
+        if (totals[DEPTH + d]) {
+            report.emplace_back("depth." + std::to_string(d),
+                                totals[DEPTH + d]);
+        }
+    }
+    for (auto& item : report) {
+        item.first = "process." + item.first;
+    }
+    return report;
+}
+
+std::string Telemetry::format(const Report& report, const bool json) {
+    auto out = std::string{json ? "{" : ""};
+    for (const auto& item : report) {
+        char value[32];
+        if (item.second == std::floor(item.second)
+            && std::fabs(item.second) < 1e15) {
+            std::snprintf(value, sizeof(value), "%.0f", item.second);
+        } else {
+            std::snprintf(value, sizeof(value), "%.3f", item.second);
+        }
+        if (json) {
+            if (out.size() > 1) {
+                out += ",";
+            }
+            out += "\"" + item.first + "\":" + value;
+        } else {
+            if (!out.empty()) {
+                out += "\n";
+            }
+            out += item.first + "=" + value;
+        }
+    }
+    if (json) {
+        out += "}";
+    }
+    return out;
+}
@@ -0,0 +1,81 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TELEMETRY_H_INCLUDED
+#define TELEMETRY_H_INCLUDED
+
+#include "config.h"
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+    Search counters for monitoring, read with the lz-stats GTP command.
+    They count for the whole process since startup, engines sharing the
+    process add to the same counters, so the keys start with
+    "process.". Every thread counts into its own slot with plain relaxed stores, so
+    counting costs a thread local load and an add. Reading sums the
+    slots up while the search keeps running, the totals are not a
+    consistent snapshot but never go backwards.
+*/
+namespace Telemetry {
+    enum counter_t {
+        PLAYOUTS,
+        SEARCH_MICROS,      // time spent in the playout loops
+        NN_EVALS,
+        NN_MICROS,
+        NODES_ALLOCATED,
+        NODES_FREED,
+        VL_COLLISIONS,      // descents into a node already in flight
+        LOCK_CONTENDED,     // SMP::Lock acquisitions that had to spin
+        LOCK_SPINS,
+        COUNTERS
+    };
+    // Latency bucket b counts evaluations under 2^b microseconds (and
+    // at least 2^(b-1)), depth bucket d leaves d moves deep. The last
+    // buckets take everything bigger.
+    constexpr auto LATENCY_BUCKETS = 24;
+    constexpr auto DEPTH_BUCKETS = 64;
+
+    void count(counter_t counter, std::uint64_t amount = 1);
+    void nn_eval(std::uint64_t micros);
+    // Moves from the root to an expanded or terminal leaf.
+    void leaf_depth(int depth);
+
+    // Adds its lifetime to the search time of the thread.
+    class SearchScope {
+    public:
+        SearchScope() : m_start(std::chrono::steady_clock::now()) {}
+        ~SearchScope();
+        SearchScope(const SearchScope&) = delete;
+        SearchScope& operator=(const SearchScope&) = delete;
+    private:
+        std::chrono::steady_clock::time_point m_start;
+    };
+
+    using Report = std::vector<std::pair<std::string, double>>;
+    // Everything counted since startup, per thread and summed up.
+    Report snapshot();
+    // key=value lines, or one flat JSON object.
+    std::string format(const Report& report, bool json);
+}
+
+#endif
@@ -0,0 +1,170 @@
+/*
+    Extended from code:
+    Copyright (c) 2012 Jakob Progsch, Václav Zeman
+
+    This software is provided 'as-is', without any express or implied
+    warranty. In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#include "config.h"
+#include "ThreadPool.h"
+
+#include "SMP.h"
+#include "Utils.h"
+
+using namespace Utils;
+
+constexpr std::size_t ThreadPool::QUEUE_SIZE;
+
+namespace {
+
+// The pool and deque of the worker running on this thread, if any.
+thread_local ThreadPool* t_pool = nullptr;
+thread_local std::size_t t_index = 0;
+
+}
+
+void ThreadPool::initialize(const std::size_t threads, const pin_t pin,
+                            const int first) {
+    for (auto i = size_t{0}; i < threads; i++) {
+        add_thread([]{} /* null function */,
+                   pin, first + static_cast<int>(i));
+    }
+}
+
+void ThreadPool::add_thread(std::function<void()> initializer,
+                            const pin_t pin, const int target) {
+    const auto nodes = static_cast<int>(SMP::get_numa_nodes().size());
+    if (pin == PIN_CPU) {
+        const auto& allowed = SMP::get_allowed_cpus();
+        m_nodes.emplace_back(SMP::node_of_cpu(
+            allowed[target % allowed.size()]));
+    } else if (pin == PIN_NODE) {
+        m_nodes.emplace_back(target % nodes);
+    } else {
+        m_nodes.emplace_back(-1);
+    }
+    const auto index = m_queues.size();
+    m_queues.emplace_back(std::make_unique<Queue>());
+    m_threads.emplace_back([this, initializer, pin, target, index] {
+        const auto pinned = pin == PIN_CPU ? SMP::pin_to_cpu(target)
+                          : pin == PIN_NODE ? SMP::pin_to_node(target)
+                          : true;
+        static std::atomic<bool> warned{false};
+        if (!pinned && !warned.exchange(true)) {
+            myprintf("Could not pin the threads, not supported here.\n");
+        }
+        t_pool = this;
+        t_index = index;
+        initializer();
+        worker(index);
+    });
+}
+
+void ThreadPool::worker(const std::size_t index) {
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condvar.wait(lock, [this]{ return m_exit || m_pending > 0; });
+            if (m_exit && m_pending <= 0) {
+                return;
+            }
+        }
+        auto task = Task{};
+        while (pop(index, task) || steal(index, task)) {
+            m_pending--;
+            task();
+        }
+    }
+}
+
+bool ThreadPool::pop(const std::size_t index, Task& task) {
+    auto& queue = *m_queues[index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.head == queue.tail) {
+        return false;
+    }
+    queue.tail--;
+    task = queue.tasks[queue.tail % QUEUE_SIZE];
+    return true;
+}
+
+bool ThreadPool::steal(const std::size_t index, Task& task) {
+    for (auto i = size_t{1}; i < m_queues.size(); i++) {
+        auto& queue = *m_queues[(index + i) % m_queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.head != queue.tail) {
+            task = queue.tasks[queue.head % QUEUE_SIZE];
+            queue.head++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::add_task(Task task) {
+    if (m_queues.empty()) {
+        task();
+        return;
+    }
+    // Workers keep what they spawn, the tasks are likely to share data.
+    const auto index = t_pool == this
+                       ? t_index : m_next++ % m_queues.size();
+    auto queued = false;
+    {
+        auto& queue = *m_queues[index];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tail - queue.head < QUEUE_SIZE) {
+            queue.tasks[queue.tail % QUEUE_SIZE] = task;
+            queue.tail++;
+            queued = true;
+        }
+    }
+    if (!queued) {
+        task();
+        return;
+    }
+    {
+        // Under the lock, so that a worker about to sleep sees it.
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pending++;
+    }
+    m_condvar.notify_one();
+}
+
+std::vector<int> ThreadPool::threads_per_node() const {
+    auto counts = std::vector<int>(SMP::get_numa_nodes().size());
+    for (const auto node : m_nodes) {
+        if (node >= 0) {
+            counts[node]++;
+        }
+    }
+    return counts;
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_exit = true;
+    }
+    m_condvar.notify_all();
+    for (std::thread & worker: m_threads) {
+        worker.join();
+    }
+}
@@ -24,114 +24,176 @@
     distribution.
 */
 
-#include <cstddef>
-#include <vector>
-#include <thread>
-#include <queue>
-#include <mutex>
+#include <algorithm>
+#include <atomic>
 #include <condition_variable>
-#include <memory>
-#include <future>
+#include <cstddef>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace Utils {
 
+// Counts outstanding tasks, wait() returns once all of them have run.
+class Latch {
+public:
+    void add(int count) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_count += count;
+    }
+    void count_down() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (--m_count == 0) {
+            m_condvar.notify_all();
+        }
+    }
+    void wait() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_condvar.wait(lock, [this]{ return m_count == 0; });
+    }
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_condvar;
+    int m_count{0};
+};
+
+// A callable stored inline, so that submitting one allocates nothing.
+// The tasks of the engine (search workers, slices of a network layer)
+// are a few pointers each; anything bigger is a compile error rather
+// than a silent trip to the heap.
+class Task {
+public:
+    static constexpr auto CAPACITY = 64 - 2 * sizeof(void*);
+
+    Task() = default;
+    template<class F>
+    Task(F&& f, Latch* latch) : m_latch(latch) {
+        using T = typename std::decay<F>::type;
+        static_assert(sizeof(T) <= CAPACITY,
+                      "task too big to store inline");
+        static_assert(alignof(T) <= alignof(std::max_align_t),
+                      "task alignment not supported");
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "tasks are moved between queues bytewise");
+        new (&m_storage) T(std::forward<F>(f));
+        m_run = [](void* storage) { (*static_cast<T*>(storage))(); };
+    }
+    void operator()() {
+        m_run(&m_storage);
+        if (m_latch) {
+            m_latch->count_down();
+        }
+    }
+private:
+    typename std::aligned_storage<CAPACITY,
+                                  alignof(std::max_align_t)>::type m_storage;
+    void (*m_run)(void*){nullptr};
+    Latch* m_latch{nullptr};
+};
+
+/*
+    Every worker owns a bounded deque. A worker pushes and pops at the
+    back of its own deque and, when that is empty, steals from the front
+    of the others. Threads outside the pool hand their tasks out round
+    robin. Idle workers sleep until a task is queued.
+*/
 class ThreadPool {
 public:
+    // Workers float, or each is pinned to one CPU or to the CPUs of
+    // one NUMA node.
+    enum pin_t { NO_PIN, PIN_CPU, PIN_NODE };
+
     ThreadPool() = default;
     ~ThreadPool();
 
-    // create worker threads.  This version has no initializers.
-    void initialize(std::size_t);
+    // create worker threads.  When pinned, worker i gets CPU or node
+    // first + i, modulo their number.
+    void initialize(std::size_t threads, pin_t pin = NO_PIN, int first = 0);
 
     // add an extra thread.  The thread calls initializer() before doing anything,
     // so that the user can initialize per-thread data structures before doing work.
-    void add_thread(std::function<void()> initializer);
-    template<class F, class... Args>
-    auto add_task(F&& f, Args&&... args)
-        -> std::future<typename std::result_of<F(Args...)>::type>;
-private:
-    std::vector<std::thread> m_threads;
-    std::queue<std::function<void()>> m_tasks;
+    // All threads must be added before the first task.
+    void add_thread(std::function<void()> initializer,
+                    pin_t pin = NO_PIN, int target = 0);
 
-    std::mutex m_mutex;
-    std::condition_variable m_condvar;
-    bool m_exit{false};
-};
+    // Runs the task on a worker, or on the calling thread if the pool
+    // has no workers or the deque is full.
+    void add_task(Task task);
 
-inline void ThreadPool::add_thread(std::function<void()> initializer) {
-    m_threads.emplace_back([this, initializer] {
-        initializer();
-        for (;;) {
-            std::function<void()> task;
-            {
-                std::unique_lock<std::mutex> lock(m_mutex);
-                m_condvar.wait(lock, [this]{ return m_exit || !m_tasks.empty(); });
-                if (m_exit && m_tasks.empty()) {
-                    return;
-                }
-                task = std::move(m_tasks.front());
-                m_tasks.pop();
-            }
-            task();
-        }
-    });
-}
+    std::size_t size() const { return m_threads.size(); }
+    // Workers pinned to each NUMA node.
+    std::vector<int> threads_per_node() const;
 
-inline void ThreadPool::initialize(size_t threads) {
-    for (size_t i = 0; i < threads; i++) {
-        add_thread( [](){} /* null function */);
-    }
-}
+private:
+    static constexpr auto QUEUE_SIZE = std::size_t{256};
 
-template<class F, class... Args>
-auto ThreadPool::add_task(F&& f, Args&&... args)
-    -> std::future<typename std::result_of<F(Args...)>::type> {
-    using return_type = typename std::result_of<F(Args...)>::type;
+    struct Queue {
+        std::mutex mutex;
+        std::vector<Task> tasks = std::vector<Task>(QUEUE_SIZE);
+        std::size_t head{0};
+        std::size_t tail{0};
+    };
 
-    auto task = std::make_shared< std::packaged_task<return_type()> >(
-        std::bind(std::forward<F>(f), std::forward<Args>(args)...)
-    );
+    void worker(std::size_t index);
+    bool pop(std::size_t index, Task& task);
+    bool steal(std::size_t index, Task& task);
 
-    std::future<return_type> res = task->get_future();
-    {
-        std::unique_lock<std::mutex> lock(m_mutex);
-        m_tasks.emplace([task](){(*task)();});
-    }
-    m_condvar.notify_one();
-    return res;
-}
+    std::vector<std::thread> m_threads;
+    // NUMA node of every worker, -1 if it floats
+    std::vector<int> m_nodes;
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::atomic<std::size_t> m_next{0};
+    std::atomic<int> m_pending{0};
 
-inline ThreadPool::~ThreadPool() {
-    {
-        std::unique_lock<std::mutex> lock(m_mutex);
-        m_exit = true;
-    }
-    m_condvar.notify_all();
-    for (std::thread & worker: m_threads) {
-        worker.join();
-    }
-}
+    std::mutex m_mutex;
+    std::condition_variable m_condvar;
+    bool m_exit{false};
+};
 
 class ThreadGroup {
 public:
     ThreadGroup(ThreadPool & pool) : m_pool(pool) {}
-    template<class F, class... Args>
-    void add_task(F&& f, Args&&... args) {
-        m_taskresults.emplace_back(
-            m_pool.add_task(std::forward<F>(f), std::forward<Args>(args)...)
-        );
+    ~ThreadGroup() {
+        // The tasks still point at the latch.
+        wait_all();
+    }
+    template<class F>
+    void add_task(F&& f) {
+        m_latch.add(1);
+        m_pool.add_task(Task(std::forward<F>(f), &m_latch));
     }
     void wait_all() {
-        for (auto && result: m_taskresults) {
-            result.get();
-        }
+        m_latch.wait();
     }
 private:
     ThreadPool & m_pool;
-    std::vector<std::future<void>> m_taskresults;
+    Latch m_latch;
 };
 
+// Calls f(begin, end) on up to `parts` equal ranges of [0, count). The
+// calling thread takes the first range and then waits for the others.
+template<class F>
+void parallel_for(ThreadPool & pool, int parts, int count, F&& f) {
+    parts = std::min(parts, count);
+    if (parts <= 1) {
+        f(0, count);
+        return;
+    }
+    ThreadGroup tg(pool);
+    for (auto i = 1; i < parts; i++) {
+        tg.add_task([&f, i, parts, count] {
+            f(i * count / parts, (i + 1) * count / parts);
+        });
+    }
+    f(0, count / parts);
+    tg.wait_all();
+}
+
 }
 
 #endif
@@ -20,6 +20,13 @@
 
 #include <chrono>
 
+#ifdef __linux__
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 
 int Time::timediff_centis(Time start, Time end) {
     return std::chrono::duration_cast<std::chrono::milliseconds>
@@ -33,3 +40,39 @@ double Time::timediff_seconds(Time start, Time end) {
 Time::Time(void) {
     m_time = std::chrono::steady_clock::now();
 }
+
+CacheMisses::CacheMisses() {
+#ifdef __linux__
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // This thread, on any CPU
+    m_fd = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+}
+
+CacheMisses::~CacheMisses() {
+#ifdef __linux__
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+#endif
+}
+
+bool CacheMisses::available() const {
+    return m_fd >= 0;
+}
+
+std::uint64_t CacheMisses::read() const {
+    auto count = std::uint64_t{0};
+#ifdef __linux__
+    if (m_fd < 0 || ::read(m_fd, &count, sizeof(count)) != sizeof(count)) {
+        return 0;
+    }
+#endif
+    return count;
+}
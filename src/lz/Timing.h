@@ -20,6 +20,7 @@
 #define TIMING_H_INCLUDED
 
 #include <chrono>
+#include <cstdint>
 
 class Time {
 public:
@@ -36,4 +37,23 @@ private:
     std::chrono::steady_clock::time_point m_time;
 };
 
+/*
+    Last level cache misses of the calling thread, read from the hardware
+    performance counters where the OS lets us (Linux perf events).
+*/
+class CacheMisses {
+public:
+    CacheMisses();
+    ~CacheMisses();
+    CacheMisses(const CacheMisses&) = delete;
+    CacheMisses& operator=(const CacheMisses&) = delete;
+
+    bool available() const;
+    /* misses since construction, 0 when not available */
+    std::uint64_t read() const;
+
+private:
+    int m_fd{-1};
+};
+
 #endif
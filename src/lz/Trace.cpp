@@ -0,0 +1,184 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "Trace.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Event {
+    const char* name;
+    const char* category;
+    std::uint64_t start;
+    std::uint64_t duration;
+    char detail[32];
+};
+
+struct Ring {
+    // Only contended while a dump copies the events out
+    std::mutex mutex;
+    std::vector<Event> events = std::vector<Event>(Trace::RING_SIZE);
+    // Events ever recorded
+    std::uint64_t count{0};
+    // Count at the last clear
+    std::uint64_t base{0};
+};
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Ring>> rings;
+};
+
+Registry& registry() {
+    // Never destroyed, threads may still trace during static destruction.
+    static auto registry = new Registry;
+    return *registry;
+}
+
+const auto s_epoch = std::chrono::steady_clock::now();
+std::atomic<bool> s_enabled{false};
+thread_local Ring* t_ring = nullptr;
+
+std::string escape(const char* text) {
+    auto escaped = std::string{};
+    for (auto p = text; *p; p++) {
+        const auto c = static_cast<unsigned char>(*p);
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += *p;
+        } else if (c == '\n') {
+            escaped += "\\n";
+        } else if (c == '\r') {
+            escaped += "\\r";
+        } else if (c == '\t') {
+            escaped += "\\t";
+        } else if (c < 0x20) {
+            char code[8];
+            std::snprintf(code, sizeof(code), "\\u%04x", c);
+            escaped += code;
+        } else {
+            escaped += *p;
+        }
+    }
+    return escaped;
+}
+
+}
+
+void Trace::set_enabled(const bool enabled) {
+    s_enabled = enabled;
+}
+
+bool Trace::enabled() {
+    return s_enabled.load(std::memory_order_relaxed);
+}
+
+std::uint64_t Trace::now() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - s_epoch).count();
+}
+
+void Trace::record(const char* name, const char* category,
+                   const std::uint64_t start, const char* detail) {
+    if (!t_ring) {
+        auto& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        reg.rings.emplace_back(std::make_unique<Ring>());
+        t_ring = reg.rings.back().get();
+    }
+    const auto end = now();
+    std::lock_guard<std::mutex> lock(t_ring->mutex);
+    auto& event = t_ring->events[t_ring->count % RING_SIZE];
+    event.name = name;
+    event.category = category;
+    event.start = start;
+    event.duration = end - start;
+    event.detail[0] = '\0';
+    if (detail) {
+        std::strncat(event.detail, detail, sizeof(event.detail) - 1);
+    }
+    t_ring->count++;
+}
+
+void Trace::Batch::flush() {
+    const auto ticks = std::to_string(m_count);
+    record(m_name, "search", m_start, ticks.c_str());
+    m_count = 0;
+    m_start = now();
+}
+
+void Trace::clear() {
+    auto& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    for (const auto& ring : reg.rings) {
+        std::lock_guard<std::mutex> ring_lock(ring->mutex);
+        ring->base = ring->count;
+    }
+}
+
+std::size_t Trace::dump(std::ostream& out) {
+    auto& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    auto written = std::size_t{0};
+    auto separator = "";
+    out << "{\"traceEvents\":[\n";
+    auto events = std::vector<Event>{};
+    for (auto tid = size_t{0}; tid < reg.rings.size(); tid++) {
+        // Copied out, the thread may keep recording meanwhile.
+        auto& ring = *reg.rings[tid];
+        events.clear();
+        {
+            std::lock_guard<std::mutex> ring_lock(ring.mutex);
+            auto first = ring.base;
+            if (ring.count - first > RING_SIZE) {
+                first = ring.count - RING_SIZE;
+            }
+            for (auto i = first; i < ring.count; i++) {
+                events.emplace_back(ring.events[i % RING_SIZE]);
+            }
+        }
+        out << separator << "{\"name\":\"thread_name\",\"ph\":\"M\","
+            << "\"pid\":1,\"tid\":" << tid
+            << ",\"args\":{\"name\":\"thread " << tid << "\"}}";
+        separator = ",\n";
+        for (const auto& event : events) {
+            out << separator << "{\"name\":\"" << event.name
+                << "\",\"cat\":\"" << event.category
+                << "\",\"ph\":\"X\",\"ts\":" << event.start
+                << ",\"dur\":" << event.duration
+                << ",\"pid\":1,\"tid\":" << tid;
+            if (event.detail[0]) {
+                out << ",\"args\":{\"detail\":\""
+                    << escape(event.detail) << "\"}";
+            }
+            out << "}";
+            written++;
+        }
+    }
+    out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    return written;
+}
@@ -0,0 +1,104 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRACE_H_INCLUDED
+#define TRACE_H_INCLUDED
+
+#include "config.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+/*
+    Timestamped events for chrome://tracing or ui.perfetto.dev, to see
+    where the time of a slow move went (--trace, or lz-trace on). Every
+    thread records into its own ring buffer and the oldest events are
+    overwritten. While tracing is off a scope costs a flag check. A dump
+    copies each ring under its lock, so it may run while threads record.
+*/
+namespace Trace {
+    // Events kept per thread, 2 MiB.
+    constexpr auto RING_SIZE = std::size_t{1} << 15;
+
+    void set_enabled(bool enabled);
+    bool enabled();
+
+    // Microseconds since startup.
+    std::uint64_t now();
+    // An event from start to now. name and category must be literals,
+    // detail is copied (up to 31 characters) and may be nullptr.
+    void record(const char* name, const char* category,
+                std::uint64_t start, const char* detail = nullptr);
+
+    // Forgets the events recorded so far.
+    void clear();
+    // Writes the Chrome trace JSON of the kept events, returns how many.
+    std::size_t dump(std::ostream& out);
+
+    class Scope {
+    public:
+        explicit Scope(const char* name, const char* category = "search",
+                       const char* detail = nullptr)
+            : m_name(enabled() ? name : nullptr), m_category(category),
+              m_detail(detail), m_start(m_name ? now() : 0) {}
+        ~Scope() {
+            if (m_name) {
+                record(m_name, m_category, m_start, m_detail);
+            }
+        }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    private:
+        const char* m_name;
+        const char* m_category;
+        const char* m_detail;
+        std::uint64_t m_start;
+    };
+
+    // One event for every size ticks, for work too fine grained to
+    // trace one by one. The detail is the number of ticks.
+    class Batch {
+    public:
+        Batch(const char* name, int size)
+            : m_name(enabled() ? name : nullptr), m_size(size),
+              m_start(m_name ? now() : 0) {}
+        ~Batch() {
+            if (m_name && m_count) {
+                flush();
+            }
+        }
+        Batch(const Batch&) = delete;
+        Batch& operator=(const Batch&) = delete;
+
+        void tick() {
+            if (m_name && ++m_count == m_size) {
+                flush();
+            }
+        }
+    private:
+        void flush();
+
+        const char* m_name;
+        int m_size;
+        int m_count{0};
+        std::uint64_t m_start;
+    };
+}
+
+#endif
@@ -34,16 +34,7 @@
 #include "Tuner.h"
 #include "Utils.h"
 #include "Random.h"
-
-#ifdef __APPLE__
-#include <Accelerate/Accelerate.h>
-#endif
-#ifdef USE_MKL
-#include <mkl.h>
-#endif
-#ifdef USE_OPENBLAS
-#include <cblas.h>
-#endif
+#include "Sgemm.h"
 
 const auto TUNER_FILE_LOCAL = std::string("leelaz_opencl_tuning");
 constexpr auto MAX_ERROR = 1e-4f;
@@ -60,13 +51,10 @@ static void sgemmBatched_ref(const std::vector<float>& a,
         auto offset_v = batch * n * k;
         auto offset_m = batch * m * n;
 
-        cblas_sgemm(CblasRowMajor, CblasTrans, CblasNoTrans,
-                    m, n, k,
-                    1.0f,
-                    &a[offset_u], m,
-                    &b[offset_v], n,
-                    0.0f,
-                    &c[offset_m], n);
+        Sgemm::sgemm(true, m, n, k,
+                     &a[offset_u], m,
+                     &b[offset_v], n,
+                     &c[offset_m], n);
     }
 }
 
@@ -35,14 +35,57 @@
 #include "FastState.h"
 #include "GTP.h"
 #include "GameState.h"
+#include "HugePages.h"
+#include "Memory.h"
 #include "Network.h"
+#include "Telemetry.h"
 #include "Utils.h"
 
 using namespace Utils;
 
+namespace {
+
+HugePages::Pool& node_pool() {
+    // Never destroyed, nodes may outlive the statics.
+    static auto pool = new HugePages::Pool("tree", sizeof(UCTNode));
+    return *pool;
+}
+
+}
+
+void* UCTNode::operator new(const std::size_t size) {
+    assert(size == sizeof(UCTNode));
+    (void)size;
+    Telemetry::count(Telemetry::NODES_ALLOCATED);
+    Memory::add(Memory::TREE_NODES, node_pool().block_size());
+    return node_pool().allocate();
+}
+
+void UCTNode::operator delete(void* p) noexcept {
+    Telemetry::count(Telemetry::NODES_FREED);
+    Memory::add(Memory::TREE_NODES,
+                -static_cast<std::int64_t>(node_pool().block_size()));
+    node_pool().deallocate(p);
+}
+
 UCTNode::UCTNode(int vertex, float score) : m_move(vertex), m_score(score) {
 }
 
+UCTNode::~UCTNode() {
+    Memory::add(Memory::TREE_CHILDREN,
+                -static_cast<std::int64_t>(children_bytes()));
+}
+
+std::size_t UCTNode::children_bytes() const {
+    auto bytes = m_children.capacity() * sizeof(node_ptr_t);
+    if (m_pending_children) {
+        bytes += sizeof(*m_pending_children)
+                 + m_pending_children->capacity()
+                   * sizeof(Network::scored_node);
+    }
+    return bytes;
+}
+
 bool UCTNode::first_visit() const {
     return m_visits == 0;
 }
@@ -53,9 +96,11 @@ SMP::Mutex& UCTNode::get_mutex() {
 
 bool IsWastefulEscape(const FastState& state, int color, int v);
 
-bool UCTNode::create_children(std::atomic<int>& nodecount,
+bool UCTNode::create_children(Network& network,
+                              std::atomic<int>& nodecount,
                               GameState& state,
-                              float& eval) {
+                              float& eval,
+                              Network::Ensemble ensemble) {
     // check whether somebody beat us to it (atomic)
     if (has_children()) {
         return false;
@@ -78,8 +123,7 @@ bool UCTNode::create_children(std::atomic<int>& nodecount,
     m_is_expanding = true;
     lock.unlock();
 
-    auto raw_netlist = Network::get_scored_moves(
-        &state, Network::Ensemble::RANDOM_ROTATION);
+    auto raw_netlist = network.get_scored_moves(&state, ensemble);
 
     // DCNN returns winrate as side to move
     m_net_eval = raw_netlist.second;
@@ -129,20 +173,54 @@ void UCTNode::link_nodelist(std::atomic<int>& nodecount,
         return;
     }
 
-    // Use best to worst order, so highest go first
-    std::stable_sort(rbegin(nodelist), rend(nodelist));
-
     LOCK(get_mutex(), lock);
 
-    m_children.reserve(nodelist.size());
-    for (const auto& node : nodelist) {
+    const auto bytes = children_bytes();
+    m_pending_children =
+        std::make_unique<std::vector<Network::scored_node>>(std::move(nodelist));
+    Memory::add(Memory::TREE_CHILDREN,
+                static_cast<std::int64_t>(children_bytes() - bytes));
+    materialize_children(nodecount, CHILDREN_BATCH);
+
+    m_has_children = true;
+}
+
+// Turn the best count pending children into nodes. Only the part we
+// take is sorted, the tail stays in whatever order it happens to be.
+// Must be called with the node lock held.
+void UCTNode::materialize_children(std::atomic<int>& nodecount, size_t count) {
+    if (!m_pending_children) {
+        return;
+    }
+    auto& pending = *m_pending_children;
+    count = std::min(count, pending.size());
+    const auto bytes = static_cast<std::int64_t>(children_bytes());
+
+    // Use best to worst order, so highest go first
+    std::partial_sort(begin(pending), begin(pending) + count, end(pending),
+                      std::greater<Network::scored_node>());
+
+    for (auto i = size_t{0}; i < count; i++) {
         m_children.emplace_back(
-            std::make_unique<UCTNode>(node.second, node.first)
+            std::make_unique<UCTNode>(pending[i].second, pending[i].first)
         );
     }
+    nodecount += count;
 
-    nodecount += m_children.size();
-    m_has_children = true;
+    if (count == pending.size()) {
+        m_pending_children.reset();
+    } else {
+        pending.erase(begin(pending), begin(pending) + count);
+    }
+    Memory::add(Memory::TREE_CHILDREN,
+                static_cast<std::int64_t>(children_bytes()) - bytes);
+}
+
+void UCTNode::materialize_all_children(std::atomic<int>& nodecount) {
+    LOCK(get_mutex(), lock);
+    if (m_pending_children) {
+        materialize_children(nodecount, m_pending_children->size());
+    }
 }
 
 const std::vector<UCTNode::node_ptr_t>& UCTNode::get_children() const {
@@ -154,8 +232,8 @@ int UCTNode::get_move() const {
     return m_move;
 }
 
-void UCTNode::virtual_loss() {
-    m_virtual_loss += VIRTUAL_LOSS_COUNT;
+bool UCTNode::virtual_loss() {
+    return m_virtual_loss.fetch_add(VIRTUAL_LOSS_COUNT) != 0;
 }
 
 void UCTNode::virtual_loss_undo() {
@@ -216,7 +294,7 @@ void UCTNode::accumulate_eval(float eval) {
     atomic_add(m_blackevals, (double)eval);
 }
 
-UCTNode* UCTNode::uct_select_child(int color) {
+UCTNode* UCTNode::uct_select_child(int color, std::atomic<int>& nodecount) {
     UCTNode* best = nullptr;
     auto best_value = -1000.0;
 
@@ -225,15 +303,25 @@ UCTNode* UCTNode::uct_select_child(int color) {
     // Count parentvisits manually to avoid issues with transpositions.
     auto total_visited_policy = 0.0f;
     auto parentvisits = size_t{0};
+    auto has_unvisited = false;
     for (const auto& child : m_children) {
         if (child->valid()) {
             parentvisits += child->get_visits();
             if (child->get_visits() > 0) {
                 total_visited_policy += child->get_score();
+            } else if (child->active()) {
+                has_unvisited = true;
             }
         }
     }
 
+    // Unvisited children all get the same FPU eval, so the one with the
+    // highest prior wins. As long as one of the nodes we have is unvisited,
+    // nothing in the pending tail can be selected.
+    if (!has_unvisited) {
+        materialize_children(nodecount, CHILDREN_BATCH);
+    }
+
     auto numerator = std::sqrt((double)parentvisits);
     auto fpu_reduction = cfg_fpu_reduction * std::sqrt(total_visited_policy);
     // Estimated eval for unknown nodes = original parent NN eval - reduction
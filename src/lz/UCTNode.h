@@ -22,6 +22,7 @@
 #include "config.h"
 
 #include <atomic>
+#include <cstddef>
 #include <memory>
 #include <vector>
 
@@ -35,21 +36,29 @@ public:
     // to it to encourage other CPUs to explore other parts of the
     // search tree.
     static constexpr auto VIRTUAL_LOSS_COUNT = 3;
+    // Number of children that are turned into nodes at once. The rest
+    // are kept as (prior, move) pairs until all of those have been visited.
+    static constexpr auto CHILDREN_BATCH = 8;
 
     using node_ptr_t = std::unique_ptr<UCTNode>;
 
     // Defined in UCTNode.cpp
     explicit UCTNode(int vertex, float score);
     UCTNode() = delete;
-    ~UCTNode() = default;
+    ~UCTNode();
+    // Nodes come from an arena on huge pages with --huge-pages.
+    static void* operator new(std::size_t size);
+    static void operator delete(void* p) noexcept;
 
-    bool create_children(std::atomic<int>& nodecount,
-                         GameState& state, float& eval);
+    bool create_children(Network& network, std::atomic<int>& nodecount,
+                         GameState& state, float& eval,
+                         Network::Ensemble ensemble = Network::RANDOM_ROTATION);
 
     const std::vector<node_ptr_t>& get_children() const;
     void sort_children(int color);
     UCTNode& get_best_root_child(int color);
-    UCTNode* uct_select_child(int color);
+    UCTNode* uct_select_child(int color, std::atomic<int>& nodecount);
+    void materialize_all_children(std::atomic<int>& nodecount);
 
     size_t count_nodes() const;
     SMP::Mutex& get_mutex();
@@ -67,7 +76,8 @@ public:
     float get_net_eval(int tomove) const;
     double get_blackevals() const;
     void accumulate_eval(float eval);
-    void virtual_loss(void);
+    // True if another thread was already descending through this node.
+    bool virtual_loss(void);
     void virtual_loss_undo(void);
     void update(float eval);
 
@@ -86,6 +96,9 @@ private:
     };
     void link_nodelist(std::atomic<int>& nodecount,
                        std::vector<Network::scored_node>& nodelist);
+    void materialize_children(std::atomic<int>& nodecount, size_t count);
+    // Heap bytes of m_children and m_pending_children
+    std::size_t children_bytes() const;
 
     // Note : This class is very size-sensitive as we are going to create
     // tens of millions of instances of these.  Please put extra caution
@@ -110,6 +123,9 @@ private:
     // Tree data
     std::atomic<bool> m_has_children{false};
     std::vector<node_ptr_t> m_children;
+    // Children that have not been turned into nodes yet. All of these have
+    // a prior no higher than any child in m_children.
+    std::unique_ptr<std::vector<Network::scored_node>> m_pending_children;
 };
 
 #endif
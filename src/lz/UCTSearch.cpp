@@ -31,15 +31,19 @@
 #include "FullBoard.h"
 #include "GTP.h"
 #include "GameState.h"
+#include "Memory.h"
+#include "NNCache.h"
+#include "Telemetry.h"
 #include "ThreadPool.h"
 #include "TimeControl.h"
 #include "Timing.h"
+#include "Trace.h"
 #include "Utils.h"
 
 using namespace Utils;
 
-UCTSearch::UCTSearch(GameState& g)
-    : m_rootstate(g) {
+UCTSearch::UCTSearch(GameState& g, Network& network)
+    : m_rootstate(g), m_network(network) {
     set_playout_limit(cfg_max_playouts);
     set_visit_limit(cfg_max_visits);
     m_root = std::make_unique<UCTNode>(FastBoard::PASS, 0.0f);
@@ -95,6 +99,9 @@ bool UCTSearch::advance_to_new_rootstate() {
 }
 
 void UCTSearch::update_root() {
+    // Mostly freeing the part of the tree that is not reused
+    Trace::Scope traced("update_root");
+
     // Definition of m_playouts is playouts per search call.
     // So reset this count now.
     m_playouts = 0;
@@ -125,15 +132,19 @@ SearchResult UCTSearch::play_simulation(GameState & currstate,
     const auto color = currstate.get_to_move();
     auto result = SearchResult{};
 
-    node->virtual_loss();
+    if (node->virtual_loss() && node != m_root.get()) {
+        Telemetry::count(Telemetry::VL_COLLISIONS);
+    }
 
     if (!node->has_children()) {
+        Telemetry::leaf_depth(currstate.get_movenum()
+                              - m_rootstate.get_movenum());
         if (currstate.get_passes() >= 2) {
             auto score = currstate.final_score();
             result = SearchResult::from_score(score);
         } else if (m_nodes < MAX_TREE_SIZE) {
             float eval;
-            auto success = node->create_children(m_nodes, currstate, eval);
+            auto success = node->create_children(m_network, m_nodes, currstate, eval);
             if (success) {
                 result = SearchResult::from_eval(eval);
             }
@@ -141,7 +152,7 @@ SearchResult UCTSearch::play_simulation(GameState & currstate,
     }
 
     if (node->has_children() && !result.valid()) {
-        auto next = node->uct_select_child(color);
+        auto next = node->uct_select_child(color, m_nodes);
 
         if (next != nullptr) {
             auto move = next->get_move();
@@ -482,20 +493,26 @@ bool UCTSearch::stop_thinking(int elapsed_centis, int time_for_move) const {
 }
 
 void UCTWorker::operator()() {
+    Telemetry::SearchScope searching;
+    Trace::Batch traced("play_simulation", UCTSearch::TRACE_BATCH);
     do {
         auto currstate = std::make_unique<GameState>(m_rootstate);
         auto result = m_search->play_simulation(*currstate, m_root);
         if (result.valid()) {
             m_search->increment_playouts();
         }
+        traced.tick();
     } while(m_search->is_running());
 }
 
 void UCTSearch::increment_playouts() {
     m_playouts++;
+    Telemetry::count(Telemetry::PLAYOUTS);
 }
 
 int UCTSearch::think(int color, passflag_t passflag) {
+    Trace::Scope traced("think");
+
     // Start counting time for us
     m_rootstate.start_clock(color);
 
@@ -514,12 +531,21 @@ int UCTSearch::think(int color, passflag_t passflag) {
     // create a sorted list off legal moves (make sure we
     // play something legal and decent even in time trouble)
     float root_eval;
+    m_root_eval_seconds = 0.0;
     if (!m_root->has_children()) {
-        m_root->create_children(m_nodes, m_rootstate, root_eval);
+        // Averaging all symmetries costs 8 evaluations, only worth it here
+        const auto ensemble = cfg_root_average ? Network::AVERAGE
+                                               : Network::RANDOM_ROTATION;
+        m_root->create_children(m_network, m_nodes, m_rootstate, root_eval,
+                                ensemble);
         m_root->update(root_eval);
+        m_root_eval_seconds = Time::timediff_seconds(start, Time());
     } else {
         root_eval = m_root->get_eval(color);
     }
+    // The root children are pruned and reported on directly, so they
+    // all need to be real nodes.
+    m_root->materialize_all_children(m_nodes);
     m_root->kill_superkos(m_rootstate);
 
     myprintf("NN eval=%f\n",
@@ -534,6 +560,9 @@ int UCTSearch::think(int color, passflag_t passflag) {
 
     bool keeprunning = true;
     int last_update = 0;
+    auto searching = std::make_unique<Telemetry::SearchScope>();
+    auto batch = std::make_unique<Trace::Batch>("play_simulation",
+                                                TRACE_BATCH);
     do {
         auto currstate = std::make_unique<GameState>(m_rootstate);
 
@@ -541,6 +570,7 @@ int UCTSearch::think(int color, passflag_t passflag) {
         if (result.valid()) {
             increment_playouts();
         }
+        batch->tick();
 
         Time elapsed;
         int elapsed_centis = Time::timediff_centis(start, elapsed);
@@ -561,6 +591,8 @@ int UCTSearch::think(int color, passflag_t passflag) {
             }
         }
     } while(keeprunning);
+    batch.reset();
+    searching.reset();
 
     // reactivate all pruned root children
     for (const auto& node : m_root->get_children()) {
@@ -606,15 +638,20 @@ void UCTSearch::ponder() {
         tg.add_task(UCTWorker(m_rootstate, this, m_root.get()));
     }
     auto keeprunning = true;
-    do {
-        auto currstate = std::make_unique<GameState>(m_rootstate);
-        auto result = play_simulation(*currstate, m_root.get());
-        if (result.valid()) {
-            increment_playouts();
-        }
-        keeprunning  = is_running();
-        keeprunning &= !stop_thinking(0, 1);
-    } while(!Utils::input_pending() && keeprunning);
+    {
+        Telemetry::SearchScope searching;
+        Trace::Batch traced("play_simulation", TRACE_BATCH);
+        do {
+            auto currstate = std::make_unique<GameState>(m_rootstate);
+            auto result = play_simulation(*currstate, m_root.get());
+            if (result.valid()) {
+                increment_playouts();
+            }
+            traced.tick();
+            keeprunning  = is_running();
+            keeprunning &= !stop_thinking(0, 1);
+        } while(!Utils::input_pending() && keeprunning);
+    }
 
     // stop the search
     m_run = false;
@@ -626,6 +663,52 @@ void UCTSearch::ponder() {
     myprintf("\n%d visits, %d nodes\n\n", m_root->get_visits(), m_nodes.load());
 }
 
+Telemetry::Report UCTSearch::memory_usage() {
+    auto& nncache = m_network.get_nncache();
+    const auto nodes = Memory::live(Memory::TREE_NODES);
+    const auto children = Memory::live(Memory::TREE_CHILDREN);
+    const auto cache = nncache.get_memory();
+    const auto history = m_rootstate.get_history_bytes();
+    const auto weights = m_network.get_weight_bytes();
+    const auto workspaces = Memory::live(Memory::WORKSPACES);
+
+    auto report = Telemetry::Report{};
+    report.emplace_back("tree.nodes", m_nodes.load());
+    report.emplace_back("process.tree.node_bytes", nodes);
+    report.emplace_back("process.tree.node_bytes_peak",
+                        Memory::peak(Memory::TREE_NODES));
+    report.emplace_back("process.tree.children_bytes", children);
+    report.emplace_back("process.tree.children_bytes_peak",
+                        Memory::peak(Memory::TREE_CHILDREN));
+    report.emplace_back("nncache.entries", nncache.get_stats().entries);
+    report.emplace_back("nncache.bytes", cache);
+    report.emplace_back("history.positions",
+                        m_rootstate.get_history_size());
+    report.emplace_back("history.bytes", history);
+    report.emplace_back("weights.host_bytes", weights);
+    report.emplace_back("weights.device_bytes",
+                        m_network.get_device_weight_bytes());
+    report.emplace_back("process.workspaces.bytes", workspaces);
+    report.emplace_back("process.workspaces.bytes_peak",
+                        Memory::peak(Memory::WORKSPACES));
+    report.emplace_back("total.host_bytes", nodes + children + cache
+                                            + history + weights
+                                            + workspaces);
+    return report;
+}
+
+int UCTSearch::get_playouts() const {
+    return m_playouts;
+}
+
+int UCTSearch::get_nodes() const {
+    return m_nodes;
+}
+
+double UCTSearch::get_root_eval_seconds() const {
+    return m_root_eval_seconds;
+}
+
 void UCTSearch::set_playout_limit(int playouts) {
     static_assert(std::is_convertible<decltype(playouts),
                                       decltype(m_maxplayouts)>::value,
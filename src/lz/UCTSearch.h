@@ -27,6 +27,8 @@
 #include "FastBoard.h"
 #include "FastState.h"
 #include "GameState.h"
+#include "Network.h"
+#include "Telemetry.h"
 #include "UCTNode.h"
 
 
@@ -80,7 +82,10 @@ public:
     static constexpr auto MAX_TREE_SIZE =
         (sizeof(void*) == 4 ? 25'000'000 : 100'000'000);
 
-    UCTSearch(GameState& g);
+    // Playouts per traced play_simulation event.
+    static constexpr auto TRACE_BATCH = 64;
+
+    UCTSearch(GameState& g, Network& network);
     int think(int color, passflag_t passflag = NORMAL);
     void set_playout_limit(int playouts);
     void set_visit_limit(int visits);
@@ -93,6 +98,18 @@ public:
     void increment_playouts();
     SearchResult play_simulation(GameState& currstate, UCTNode* const node);
 
+    // Statistics of the last search
+    int get_playouts() const;
+    int get_nodes() const;
+    // Time the root evaluation took, 0 if the tree was reused
+    double get_root_eval_seconds() const;
+
+    // Bytes held by the tree, the NNCache, the game history, the
+    // weights and the evaluation buffers, with peaks where counted.
+    // Tree and buffer bytes ("process.") are those of all engines in
+    // the process, see Memory.h.
+    Telemetry::Report memory_usage();
+
 private:
     void dump_stats(FastState& state, UCTNode& parent);
     void tree_stats(const UCTNode& node);
@@ -104,11 +121,13 @@ private:
     bool advance_to_new_rootstate();
 
     GameState & m_rootstate;
+    Network & m_network;
     std::unique_ptr<GameState> m_last_rootstate;
     std::unique_ptr<UCTNode> m_root;
     std::atomic<int> m_nodes{0};
     std::atomic<int> m_playouts{0};
     std::atomic<bool> m_run{false};
+    double m_root_eval_seconds{0.0};
     int m_maxplayouts;
     int m_maxvisits;
 };
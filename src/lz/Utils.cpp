@@ -26,12 +26,14 @@
 #ifdef _WIN32
 #include <windows.h>
 #else
+#include <sys/resource.h>
 #include <sys/select.h>
 #endif
 
 #include "GTP.h"
 
 Utils::ThreadPool thread_pool;
+Utils::ThreadPool nn_thread_pool;
 
 bool Utils::input_pending(void) {
     return GTP::input_pending();
@@ -68,3 +70,20 @@ size_t Utils::ceilMultiple(size_t a, size_t b) {
     auto ret = a + (b - a % b);
     return ret;
 }
+
+size_t Utils::peak_rss() {
+#ifdef _WIN32
+    return 0;
+#else
+    auto usage = rusage{};
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    // Linux reports kilobytes
+    return size_t(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
@@ -28,6 +28,8 @@
 #include "ThreadPool.h"
 
 extern Utils::ThreadPool thread_pool;
+// Workers that help a single network evaluation along
+extern Utils::ThreadPool nn_thread_pool;
 
 namespace Utils {
     void myprintf(const char *fmt, ...);
@@ -49,6 +51,9 @@ namespace Utils {
     }
 
     size_t ceilMultiple(size_t a, size_t b);
+
+    // Largest resident set of the process so far in bytes, 0 if unknown.
+    size_t peak_rss();
 }
 
 #endif
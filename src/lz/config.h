@@ -30,7 +30,10 @@
 #endif
 
 /*
- * BOARD_SIZE: Define size of the board to compile Leela with, must be an odd number due to winograd tiles
+ * BOARD_SIZE: Define the largest board size Leela can play on, must be an
+ * odd number due to winograd tiles. The network code is instantiated for
+ * 9x9, 13x13 and 19x19 and the size is picked at runtime from the weights
+ * file, so BOARD_SIZE must be at least as big as the largest of those.
  */
 #define BOARD_SIZE 19
 #define BOARD_SQUARES BOARD_SIZE*BOARD_SIZE
@@ -42,7 +45,7 @@
 /*
  * Features
  *
- * USE_BLAS: Use a basic linear algebra library.
+ * USE_BLAS: Use the CPU implementation of the network.
  * We currently require this, as not all operations are performed on
  * the GPU - some operations won't get any speedup from it.
  * Also used for OpenCL self-checks.
@@ -50,12 +53,19 @@
 #define USE_BLAS
 
 /*
+ * USE_CBLAS: Use an external basic linear algebra library. Without one
+ * (FEATURE_NO_BLAS, set by the build when none is found) the built-in
+ * SGEMM in Sgemm.cpp does all the matrix multiplies.
+ *
  * We use OpenBLAS by default, except on macOS, which has a fast BLAS
  * built-in. (Accelerate)
  */
+#ifndef FEATURE_NO_BLAS
+#define USE_CBLAS
 #if !defined(__APPLE__) && !defined(__MACOSX)
 #define USE_OPENBLAS
 #endif
+#endif
 
 /*
  * USE_MKL: Optionally allows using Intel Math Kernel library as
@@ -85,7 +95,7 @@
  * OpenBLAS limitation: the default configuration on some Linuxes
  * is limited to 64 cores.
  */
-#if defined(USE_BLAS) && defined(USE_OPENBLAS)
+#if defined(USE_OPENBLAS)
 #define MAX_CPUS 64
 #else
 #define MAX_CPUS 128
@@ -16,22 +16,27 @@ using namespace std;
 #include "board_ui.h"
 #endif
 #include "tools.h"
+#include "lz/Benchmark.h"
 
-static constexpr int default_board_size = 19;
+static int opt_board_size = 19;
 
 
 static bool opt_comupter_is_black = true;
 static bool opt_hint = true;
 static bool opt_uionly = false;
 static bool opt_noui = false;
+static string opt_bench_command;
+static int opt_bench_board_games = 0;
 
 constexpr int wait_time_secs = 40;
 
 
 void autogtpui();
 int gtp(const string& cmdline, const string& selfpath);
+int bench(const string& command);
 int advisor(const string& cmdline, const string& selfpath);
-int playMatch(int rounds, const string& selfpath, const std::vector<string>& players);
+int playMatch(int rounds, const string& selfpath, const std::vector<string>& players,
+              const std::vector<string>& weights);
 
 
 int main(int argc, char **argv) {
@@ -51,7 +56,10 @@ int main(int argc, char **argv) {
     selfpath = selfpath.substr(0, pos); 
 
     std::vector<string> players;
+    std::vector<string> weights;
     int rounds = 1;
+    int make_blocks = 0, make_filters = 0;
+    string make_file;
 
     for (int i=1; i<argc; i++) {
         string opt = argv[i];
@@ -62,6 +70,10 @@ int main(int argc, char **argv) {
             cout << "--human, computer is WHITE" << endl;
             cout << "--hint" << endl;
             cout << "--ui-only" << endl;
+            cout << "--boardsize <9|13|19>, board size for match play" << endl;
+            cout << "--bench-search, search the benchmark positions and exit" << endl;
+            cout << "--bench-board <games>, play random games on --boardsize and exit" << endl;
+            cout << "--make-weights <blocks>x<filters> <file>, write random weights for --boardsize and exit" << endl;
             cout << endl;
 
             cout << "--player <gtp engine command line or weights file>" << endl;
@@ -97,16 +109,57 @@ int main(int argc, char **argv) {
         else if (opt == "--rounds") {
             rounds = stoi(argv[++i]);
         }
+        else if (opt == "--boardsize") {
+            opt_board_size = stoi(argv[++i]);
+        }
+        else if (opt == "--bench-search") {
+            opt_bench_command = "lz-bench-search";
+        }
+        else if (opt == "--bench-board") {
+            opt_bench_board_games = stoi(argv[++i]);
+        }
+        else if (opt == "--make-weights") {
+            if (i + 2 >= argc
+                || sscanf(argv[i + 1], "%dx%d", &make_blocks, &make_filters) != 2
+                || make_blocks <= 0 || make_filters <= 0) {
+                cerr << "--make-weights needs <blocks>x<filters> <file>" << endl;
+                return 1;
+            }
+            make_file = argv[i + 2];
+            i += 2;
+        }
+    }
+
+    if (!make_file.empty()) {
+        ofstream file(make_file);
+        Network::write_random_weights(file, make_blocks, make_filters, opt_board_size);
+        if (!file) {
+            cerr << "Could not write " << make_file << endl;
+            return 1;
+        }
+        return 0;
     }
 
     if (!opt_uionly)
-        parseLeelaZeroArgs(argc, argv, players);
+        parseLeelaZeroArgs(argc, argv, players, weights);
 
     if (players.size() && players[0].empty()) {
         fprintf(stderr, "RNG seed: %llu\n", cfg_rng_seed);
     }
 
-    if (cfg_gtp_mode) {
+    if (opt_bench_board_games > 0) {
+        // The rules engine alone, no network needed
+        init_global_objects();
+        Benchmark::board(opt_board_size, opt_bench_board_games);
+    }
+    else if (!opt_bench_command.empty()) {
+        if (players.empty() || !players[0].empty()) {
+            fprintf(stderr, "Benchmarks run the built-in engine, they need a weights file.\n");
+            throw std::runtime_error("Benchmarks need a weights file");
+        }
+        bench(opt_bench_command);
+    }
+    else if (cfg_gtp_mode) {
         if (players.empty()) {
             fprintf(stderr, "A network weights file is required to use the program.\n");
             throw std::runtime_error("A network weights file is required to use the program");
@@ -114,7 +167,7 @@ int main(int argc, char **argv) {
         gtp(players[0], selfpath);
     }
     else if (players.size() > 1) {
-        playMatch(rounds, selfpath, players);
+        playMatch(rounds, selfpath, players, weights);
     }
     else if (players.size() == 1) {
         advisor(players[0], selfpath);
@@ -235,6 +288,21 @@ int gtp(const string& cmdline, const string& selfpath) {
     return 0;
 }
 
+// Runs one command on the built-in engine, for the benchmark modes.
+int bench(const string& command) {
+
+    GtpChoice agent;
+
+    agent.onOutput = [&](const string& line) {
+        cout << line;
+    };
+
+    agent.execute();
+    agent.send_command(command);
+    agent.send_command("quit");
+    return agent.join();
+}
+
 int advisor(const string& cmdline, const string& selfpath) {
 
     GameAdvisor<GtpChoice> agent;
@@ -413,7 +481,8 @@ int playMatch(int index, GtpChoice& black, GtpChoice& white, function<void()> ui
     uiReset();
 
 
-    for (int move_count = 0; move_count<361*2; move_count++) {
+    const auto max_moves = black.boardsize() * black.boardsize() * 2;
+    for (int move_count = 0; move_count<max_moves; move_count++) {
             
         auto vtx = GtpState::send_command_sync(*me, black_to_move ? "genmove b" : "genmove w", ok);
         if (!ok)
@@ -490,7 +559,8 @@ int playMatch(int index, GtpChoice& black, GtpChoice& white, function<void()> ui
         return -1;
 }
 
-int playMatch(int rounds, const string& selfpath, const std::vector<string>& players) {
+int playMatch(int rounds, const string& selfpath, const std::vector<string>& players,
+              const std::vector<string>& weights) {
 
     GtpChoice black;
     GtpChoice white;
@@ -503,8 +573,10 @@ int playMatch(int rounds, const string& selfpath, const std::vector<string>& pla
         cout << line;
     };
 
+    // Built-in players run in this process, each with its own weights
+    auto builtin = size_t{0};
     if (players[0].empty())
-        black.execute();
+        black.execute_builtin(weights[builtin++]);
     else
         black.execute(players[0], selfpath, wait_time_secs);
 
@@ -514,7 +586,7 @@ int playMatch(int rounds, const string& selfpath, const std::vector<string>& pla
     }
 
     if (players[1].empty())
-        white.execute();
+        white.execute_builtin(weights[builtin++]);
     else
         white.execute(players[1], selfpath, wait_time_secs);
     if (!white.isReady()) {
@@ -523,17 +595,17 @@ int playMatch(int rounds, const string& selfpath, const std::vector<string>& pla
         return -1;
     }
 
-    if (default_board_size != 19) {
+    if (opt_board_size != 19) {
         bool ok;
-        GtpState::send_command_sync(black, "boardsize " + to_string(default_board_size), ok);
+        GtpState::send_command_sync(black, "boardsize " + to_string(opt_board_size), ok);
         if (!ok) {
-            std::cerr << "player 1 do not support size " << default_board_size << std::endl;
+            std::cerr << "player 1 do not support size " << opt_board_size << std::endl;
             return -1;
         }
 
-        GtpState::send_command_sync(white, "boardsize " + to_string(default_board_size), ok);
+        GtpState::send_command_sync(white, "boardsize " + to_string(opt_board_size), ok);
         if (!ok) {
-            std::cerr << "player 2 do not support size " << default_board_size << std::endl;
+            std::cerr << "player 2 do not support size " << opt_board_size << std::endl;
             return -1;
         }
     }
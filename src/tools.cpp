@@ -1,5 +1,7 @@
 #include "tools.h"
 #include "lz/GTP.h"
+#include "lz/CPUKernels.h"
+#include "lz/CPUTuner.h"
 
 #include <iostream>
 #ifdef _WIN32
@@ -151,7 +153,8 @@ string findPossibleWeightsFile(const string &directory) {
 }
 
 
-void parseLeelaZeroArgs(int argc, char **argv, vector<string>& players) {
+void parseLeelaZeroArgs(int argc, char **argv, vector<string>& players,
+                        vector<string>& weights) {
 
     string append_str;
 
@@ -201,6 +204,24 @@ void parseLeelaZeroArgs(int argc, char **argv, vector<string>& players) {
                 cfg_num_threads = num_threads;
             }
         }
+        else if (opt == "--nn-threads") {
+            cfg_nn_threads = std::stoi(argv[++i]);
+        }
+        else if (opt == "--pin-threads") {
+            cfg_pin_threads = true;
+        }
+        else if (opt == "--pin-nodes") {
+            cfg_pin_nodes = true;
+        }
+        else if (opt == "--numa-replicas") {
+            cfg_numa_replicas = true;
+        }
+        else if (opt == "--huge-pages") {
+            cfg_huge_pages = true;
+        }
+        else if (opt == "--trace") {
+            cfg_trace = true;
+        }
         else if (opt == "--playouts" || opt == "-p") {
             cfg_max_playouts = std::stoi(argv[++i]);
         }
@@ -233,6 +254,7 @@ void parseLeelaZeroArgs(int argc, char **argv, vector<string>& players) {
         else if (opt == "--weights" || opt == "-w") {
             cfg_weightsfile = argv[++i];
             players.push_back("");
+            weights.push_back(cfg_weightsfile);
         }
         else if (opt == "--logfile" || opt == "-l") {
                 cfg_logfile = argv[++i];
@@ -256,6 +278,66 @@ void parseLeelaZeroArgs(int argc, char **argv, vector<string>& players) {
         else if (opt == "--fpu_reduction") {
             cfg_fpu_reduction = std::stof(argv[++i]);
         }
+        else if (opt == "--root-average") {
+            cfg_root_average = true;
+        }
+        else if (opt == "--sgemm") {
+            std::string backend = argv[++i];
+            if (backend == "auto") {
+                cfg_cpu_sgemm = Sgemm::AUTO;
+            } else if (backend == "builtin") {
+                cfg_cpu_sgemm = Sgemm::BUILTIN;
+            } else if (backend == "blas") {
+                cfg_cpu_sgemm = Sgemm::BLAS;
+            } else {
+                fprintf(stderr, "Invalid sgemm value.\n");
+                throw std::runtime_error("Invalid sgemm value.");
+            }
+        }
+        else if (opt == "--cpu-conv") {
+            std::string conv = argv[++i];
+            auto algorithm = CPUTuner::algorithm_t{};
+            if (conv != "auto"
+                && !CPUTuner::algorithm_from_name(conv, algorithm)) {
+                fprintf(stderr, "Invalid cpu-conv value.\n");
+                throw std::runtime_error("Invalid cpu-conv value.");
+            }
+            cfg_cpu_conv = conv;
+        }
+        else if (opt == "--int8") {
+            cfg_cpu_int8 = true;
+        }
+        else if (opt == "--fp16") {
+            cfg_cpu_fp16 = true;
+        }
+        else if (opt == "--cpu-kernels") {
+            std::string kernels = argv[++i];
+            auto isa = CPUKernels::isa_t{};
+            if (kernels != "auto"
+                && !CPUKernels::isa_from_name(kernels, isa)) {
+                fprintf(stderr, "Invalid cpu-kernels value.\n");
+                throw std::runtime_error("Invalid cpu-kernels value.");
+            }
+            cfg_cpu_kernels = kernels;
+        }
+        else if (opt == "--nn-backend") {
+            std::string backend = argv[++i];
+            if (backend != "network" && backend != "synthetic") {
+                fprintf(stderr, "Invalid nn-backend value.\n");
+                throw std::runtime_error("Invalid nn-backend value.");
+            }
+            cfg_nn_backend = backend;
+        }
+        else if (opt == "--nn-latency") {
+            cfg_nn_latency = std::stoi(argv[++i]);
+        }
+        else if (opt == "--nn-record") {
+            cfg_nn_record = argv[++i];
+        }
+        else if (opt == "--nn-replay") {
+            cfg_nn_replay = argv[++i];
+            cfg_nn_backend = "replay";
+        }
         else if (opt == "--timemanage") {
             std::string tm = argv[++i];
             if (tm == "auto") {
@@ -293,6 +375,11 @@ void parseLeelaZeroArgs(int argc, char **argv, vector<string>& players) {
         if (w.size()) {
             cfg_weightsfile = w;
             players.push_back("");
+            weights.push_back(w);
+        } else if (cfg_nn_backend != "network") {
+            // Built-in engine that needs no weights
+            players.push_back("");
+            weights.push_back("");
         }
     }
 }
@@ -4,4 +4,6 @@
 #include <vector>
 
 std::string findPossibleWeightsFile(const std::string &directory);
-void parseLeelaZeroArgs(int argc, char **argv, std::vector<std::string>& players);
+// Built-in players are "" in players, with their weights file in weights.
+void parseLeelaZeroArgs(int argc, char **argv, std::vector<std::string>& players,
+                        std::vector<std::string>& weights);